@@ -0,0 +1,151 @@
+#include "aot_predictor.h"
+
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Weverything"
+#endif
+
+#define EIGEN_USE_THREADS
+#include "third_party/eigen3/unsupported/Eigen/CXX11/Tensor"
+
+// Generated by tfcompile(bazel build //aot:resfcn256)
+#include "resfcn256.h"
+
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+namespace prnet {
+
+namespace {
+
+// Fixed in aot/resfcn256.config.pbtxt
+const size_t kInputWidth = 256;
+const size_t kInputHeight = 256;
+const size_t kInputChannels = 3;
+const size_t kOutputWidth = 256;
+const size_t kOutputHeight = 256;
+const size_t kOutputChannels = 3;
+
+} // anonymous namespace
+
+class AotPredictor::Impl {
+public:
+  void init(int argc, char* argv[]) {
+    (void)argc;
+    (void)argv;
+  }
+
+  bool load(const std::string& graph_filename, const std::string& inp_layer,
+            const std::string& out_layer, const SessionConfig& config) {
+    (void)inp_layer;
+    (void)out_layer;
+    if (!graph_filename.empty()) {
+      std::cout << "AOT backend: graph is compiled in. Ignoring "
+                << graph_filename << std::endl;
+    }
+
+    std::lock_guard<std::mutex> guard(mutex);
+
+    // Compiled function runs in the calling thread unless a thread pool is
+    // given.
+    computation.set_thread_pool(nullptr);
+    device.reset();
+    pool.reset();
+    // 0 = the number of cores, as with TensorFlow sessions.
+    const int n_threads =
+        (config.intra_op_threads > 0)
+            ? config.intra_op_threads
+            : int(std::max(1u, std::thread::hardware_concurrency()));
+    if (n_threads > 1) {
+      pool.reset(new Eigen::ThreadPool(n_threads));
+      device.reset(new Eigen::ThreadPoolDevice(pool.get(), n_threads));
+      computation.set_thread_pool(device.get());
+    }
+
+    return true;
+  }
+
+  bool allocate_input(size_t width, size_t height, size_t channels,
+                      Image<float>* img) {
+    img->create(width, height, channels);
+    return true;
+  }
+
+  bool predict(const Image<float>& inp_img, Image<float>& out_img) {
+    if ((inp_img.getWidth() != kInputWidth) ||
+        (inp_img.getHeight() != kInputHeight) ||
+        (inp_img.getChannels() != kInputChannels)) {
+      std::cerr << "AOT backend: input image must be " << kInputWidth << "x"
+                << kInputHeight << "x" << kInputChannels << " but got "
+                << inp_img.getWidth() << "x" << inp_img.getHeight() << "x"
+                << inp_img.getChannels() << std::endl;
+      return false;
+    }
+
+    // Argument and result buffers of the compiled function are reused by
+    // every Run().
+    std::lock_guard<std::mutex> guard(mutex);
+
+    std::copy_n(inp_img.getData(),
+                kInputWidth * kInputHeight * kInputChannels,
+                computation.arg0_data());
+
+    if (!computation.Run()) {
+      std::cerr << "Running model failed: " << computation.error_msg()
+                << std::endl;
+      return false;
+    }
+
+    out_img.create(kOutputWidth, kOutputHeight, kOutputChannels,
+                   computation.result0_data());
+
+    return true;
+  }
+
+  bool predict(const std::vector<Image<float>>& inp_imgs,
+               std::vector<Image<float>>& out_imgs) {
+    out_imgs.resize(inp_imgs.size());
+    for (size_t i = 0; i < inp_imgs.size(); i++) {
+      if (!predict(inp_imgs[i], out_imgs[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+private:
+  std::mutex mutex;
+  std::unique_ptr<Eigen::ThreadPool> pool;
+  std::unique_ptr<Eigen::ThreadPoolDevice> device;
+  Resfcn256Aot computation;
+};
+
+// PImpl pattern
+AotPredictor::AotPredictor() : impl(new Impl()) {}
+AotPredictor::~AotPredictor() {}
+void AotPredictor::init(int argc, char* argv[]) { impl->init(argc, argv); }
+bool AotPredictor::load(const std::string& graph_filename,
+                        const std::string& inp_layer,
+                        const std::string& out_layer,
+                        const SessionConfig& config) {
+  return impl->load(graph_filename, inp_layer, out_layer, config);
+}
+bool AotPredictor::allocate_input(size_t width, size_t height,
+                                  size_t channels, Image<float>* img) {
+  return impl->allocate_input(width, height, channels, img);
+}
+bool AotPredictor::predict(const Image<float>& inp_img, Image<float>& out_img) {
+  return impl->predict(inp_img, out_img);
+}
+bool AotPredictor::predict(const std::vector<Image<float>>& inp_imgs,
+                           std::vector<Image<float>>& out_imgs) {
+  return impl->predict(inp_imgs, out_imgs);
+}
+
+} // namespace prnet
@@ -0,0 +1,54 @@
+#ifndef PRNET_INFER_AOT_PREDICTOR_H_
+#define PRNET_INFER_AOT_PREDICTOR_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "predictor.h"
+
+namespace prnet {
+
+///
+/// Evaluates resfcn256 compiled ahead-of-time by tfcompile(see `aot/`).
+/// Same interface as TensorflowPredictor, but no Session, graph parsing or
+/// op dispatch at runtime. The graph and 1x256x256x3 input shape are fixed
+/// at compile time.
+///
+class AotPredictor : public Predictor {
+public:
+  AotPredictor();
+  ~AotPredictor() override;
+  void init(int argc, char* argv[]) override;
+
+  ///
+  /// `graph_filename`, `inp_layer` and `out_layer` are ignored since the
+  /// graph is compiled in. Only `config.intra_op_threads` is used.
+  ///
+  bool load(const std::string& graph_filename, const std::string& inp_layer,
+            const std::string& out_layer,
+            const SessionConfig& config) override;
+
+  bool allocate_input(size_t width, size_t height, size_t channels,
+                      Image<float>* img) override;
+
+  ///
+  /// Input image must be 256x256x3.
+  ///
+  bool predict(const Image<float>& inp_img, Image<float>& out_img) override;
+
+  ///
+  /// Batched prediction. Images are evaluated one by one since the compiled
+  /// function has a fixed batch size of 1.
+  ///
+  bool predict(const std::vector<Image<float>>& inp_imgs,
+               std::vector<Image<float>>& out_imgs) override;
+
+private:
+  class Impl;
+  std::unique_ptr<Impl> impl;
+};
+
+} // namespace prnet
+
+#endif // PRNET_INFER_AOT_PREDICTOR_H_
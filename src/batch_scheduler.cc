@@ -0,0 +1,184 @@
+#include "batch_scheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace prnet {
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct Request {
+  Image<float> inp_img;
+  std::promise<Image<float>> promise;
+  Clock::time_point enqueue_time;
+};
+
+// The number of recent queueing delay samples used for percentiles.
+const size_t kMaxDelaySamples = 65536;
+
+double Percentile(std::vector<double> samples, double p) {
+  if (samples.empty()) {
+    return 0.0;
+  }
+  size_t n = size_t(p * double(samples.size() - 1) + 0.5);
+  std::nth_element(samples.begin(), samples.begin() + long(n), samples.end());
+  return samples[n];
+}
+
+} // anonymous namespace
+
+class BatchScheduler::Impl {
+public:
+  Impl(Predictor& _predictor, size_t _max_batch_size,
+       double deadline_ms)
+      : predictor(_predictor),
+        max_batch_size(std::max(size_t(1), _max_batch_size)),
+        deadline(std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double, std::milli>(deadline_ms))) {
+    worker = std::thread([this]() { run(); });
+  }
+
+  ~Impl() {
+    {
+      std::lock_guard<std::mutex> guard(mutex);
+      quit = true;
+    }
+    cond.notify_all();
+    worker.join();
+  }
+
+  std::future<Image<float>> submit(Image<float> inp_img) {
+    Request req;
+    req.inp_img = std::move(inp_img);
+    req.enqueue_time = Clock::now();
+    std::future<Image<float>> future = req.promise.get_future();
+    {
+      std::lock_guard<std::mutex> guard(mutex);
+      queue.push_back(std::move(req));
+    }
+    cond.notify_all();
+    return future;
+  }
+
+  Statistics statistics() const {
+    std::vector<double> samples;
+    Statistics stats;
+    {
+      std::lock_guard<std::mutex> guard(mutex);
+      samples = delay_samples;
+      stats.num_requests = num_requests;
+      stats.num_batches = num_batches;
+    }
+    if (stats.num_batches > 0) {
+      stats.mean_batch_size =
+          double(stats.num_requests) / double(stats.num_batches);
+    }
+    stats.p50_queue_ms = Percentile(samples, 0.50);
+    stats.p99_queue_ms = Percentile(samples, 0.99);
+    stats.max_queue_ms = Percentile(samples, 1.0);
+    return stats;
+  }
+
+private:
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      cond.wait(lock, [this]() { return quit || !queue.empty(); });
+      if (queue.empty()) {
+        // quit
+        return;
+      }
+
+      // Wait until the batch is full or the oldest request hits the deadline.
+      const Clock::time_point flush_time = queue.front().enqueue_time + deadline;
+      while (!quit && (queue.size() < max_batch_size) &&
+             (Clock::now() < flush_time)) {
+        cond.wait_until(lock, flush_time);
+      }
+
+      // Requests in a batch must have the same image size.
+      std::vector<Request> batch;
+      const Image<float>& front_img = queue.front().inp_img;
+      const size_t width = front_img.getWidth();
+      const size_t height = front_img.getHeight();
+      const size_t channels = front_img.getChannels();
+      while (!queue.empty() && (batch.size() < max_batch_size) &&
+             (queue.front().inp_img.getWidth() == width) &&
+             (queue.front().inp_img.getHeight() == height) &&
+             (queue.front().inp_img.getChannels() == channels)) {
+        batch.push_back(std::move(queue.front()));
+        queue.pop_front();
+      }
+
+      const Clock::time_point start_time = Clock::now();
+      for (size_t i = 0; i < batch.size(); i++) {
+        std::chrono::duration<double, std::milli> ms =
+            start_time - batch[i].enqueue_time;
+        if (delay_samples.size() < kMaxDelaySamples) {
+          delay_samples.push_back(ms.count());
+        } else {
+          delay_samples[num_requests % kMaxDelaySamples] = ms.count();
+        }
+        num_requests++;
+      }
+      num_batches++;
+
+      lock.unlock();
+
+      std::vector<Image<float>> inp_imgs(batch.size());
+      for (size_t i = 0; i < batch.size(); i++) {
+        inp_imgs[i] = std::move(batch[i].inp_img);
+      }
+      std::vector<Image<float>> out_imgs;
+      if (!predictor.predict(inp_imgs, out_imgs)) {
+        std::cerr << "Failed to run batch of " << batch.size() << " images."
+                  << std::endl;
+        out_imgs.clear();
+        out_imgs.resize(batch.size());
+      }
+      for (size_t i = 0; i < batch.size(); i++) {
+        batch[i].promise.set_value(std::move(out_imgs[i]));
+      }
+
+      lock.lock();
+    }
+  }
+
+  Predictor& predictor;
+  const size_t max_batch_size;
+  const Clock::duration deadline;
+
+  mutable std::mutex mutex;
+  std::condition_variable cond;
+  std::deque<Request> queue;
+  bool quit = false;
+
+  size_t num_requests = 0;
+  size_t num_batches = 0;
+  std::vector<double> delay_samples;
+
+  std::thread worker;
+};
+
+// PImpl pattern
+BatchScheduler::BatchScheduler(Predictor& predictor,
+                               size_t max_batch_size, double deadline_ms)
+    : impl(new Impl(predictor, max_batch_size, deadline_ms)) {}
+BatchScheduler::~BatchScheduler() {}
+std::future<Image<float>> BatchScheduler::submit(Image<float> inp_img) {
+  return impl->submit(std::move(inp_img));
+}
+BatchScheduler::Statistics BatchScheduler::statistics() const {
+  return impl->statistics();
+}
+
+} // namespace prnet
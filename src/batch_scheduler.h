@@ -0,0 +1,51 @@
+#ifndef PRNET_INFER_BATCH_SCHEDULER_H_
+#define PRNET_INFER_BATCH_SCHEDULER_H_
+
+#include <future>
+#include <memory>
+
+#include "image.h"
+#include "predictor.h"
+
+namespace prnet {
+
+///
+/// Collects prediction requests from concurrent callers into batches.
+///
+/// A batch is sent to the predictor when it reaches `max_batch_size` requests
+/// or when the oldest request has waited for `deadline_ms`.
+///
+class BatchScheduler {
+public:
+  struct Statistics {
+    size_t num_requests = 0;
+    size_t num_batches = 0;
+    double mean_batch_size = 0.0;
+    // Queueing delay(from submit() to the start of network evaluation)
+    double p50_queue_ms = 0.0;
+    double p99_queue_ms = 0.0;
+    double max_queue_ms = 0.0;
+  };
+
+  BatchScheduler(Predictor& predictor, size_t max_batch_size,
+                 double deadline_ms);
+  ~BatchScheduler();  // Flushes pending requests.
+
+  ///
+  /// Enqueue an input image. Returned future holds the position map.
+  /// Position map is empty(width == 0) when network evaluation failed.
+  /// The image is moved through the queue to the network input, pass it
+  /// with std::move() to avoid a copy.
+  ///
+  std::future<Image<float>> submit(Image<float> inp_img);
+
+  Statistics statistics() const;
+
+private:
+  class Impl;
+  std::unique_ptr<Impl> impl;
+};
+
+} // namespace prnet
+
+#endif // PRNET_INFER_BATCH_SCHEDULER_H_
@@ -1,8 +1,18 @@
 #include "face_cropper.h"
+#include "image_convert.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <iostream>
+#include <vector>
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+// SIMD kernels are compiled with target attribute and selected at runtime.
+#define PRNET_CROP_HAS_AVX2_KERNEL 1
+#include <immintrin.h>
+#endif
 
 #ifdef USE_DLIB
 #ifdef __clang__
@@ -27,91 +37,359 @@ inline T clamp(T f, T fmin, T fmax) {
   return std::max(std::min(fmax, f), fmin);
 }
 
-inline void FilterFloat(float *rgba, const float *image, int i00, int i10,
-                        int i01, int i11,
-                        float w[4],  // weight
-                        int channels) {
-  float texel[4][4];
+// Texels of float images are used as is.
+struct FloatTexel {
+  float operator()(float v) const { return v; }
+};
 
-  rgba[0] = rgba[1] = rgba[2] = 0.0f;
+// 8-bit texels are converted to linear color space with a table on the fly.
+struct DecodeTexel {
+  float lut[256];
 
-  // Filter in linear space
-  for (int i = 0; i < channels; i++) {
-    texel[0][i] = image[i00 + i];
-    texel[1][i] = image[i10 + i];
-    texel[2][i] = image[i01 + i];
-    texel[3][i] = image[i11 + i];
-  }
+  explicit DecodeTexel(float gamma) { MakeGammaTable(gamma, lut); }
+  float operator()(uint8_t v) const { return lut[v]; }
+};
+
+//
+// Bilinear taps along one axis of the crop. The sampling position depends
+// only on x for columns(only on y for rows), so positions, tap offsets and
+// weights are computed once per column and once per row instead of per
+// pixel. Arithmetic is the same as the former per pixel fetch, so the crop
+// is bit identical to it.
+//
+struct CropTaps {
+  std::vector<size_t> i0;  // offset of the first tap(elements)
+  std::vector<size_t> i1;  // offset of the second tap
+  std::vector<float> w0;   // 1 - d
+  std::vector<float> w1;   // d
+  size_t begin = 0;        // samples in [begin, end) are inside of the image
+  size_t end = 0;
+};
+
+// Buffers of a thread cropping rows(see RgbRowCropper<uint8_t>).
+struct CropRowScratch {
+  CropTaps taps;               // offsets in the decoded rows
+  std::vector<float> rows[2];  // decoded source rows
+};
+
+//
+// Buffers of CropImage() kept per calling thread(e.g. a batch worker), so
+// that crops do not allocate once the sizes reach steady state. `slots` has
+// one entry per thread of the row loop.
+//
+struct CropScratch {
+  CropTaps cols;
+  CropTaps rows;
+  std::vector<CropRowScratch> slots;
+};
 
-  for (int i = 0; i < channels; i++) {
-    rgba[i] = w[0] * texel[0][i] + w[1] * texel[1][i] + w[2] * texel[2][i] +
-              w[3] * texel[3][i];
+CropScratch &GetCropScratch() {
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wexit-time-destructors"
+#endif
+  thread_local CropScratch scratch;
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+  return scratch;
+}
+
+// Taps of samples [0, dst_size) for pixel box [s, e] of an axis of
+// `src_size` pixels. `stride` is the pixel(row) stride of the axis.
+void ComputeCropTaps(int s, int e, size_t dst_size, size_t src_size,
+                     size_t stride, CropTaps *taps) {
+  const int size = int(src_size);
+  taps->i0.resize(dst_size);
+  taps->i1.resize(dst_size);
+  taps->w0.resize(dst_size);
+  taps->w1.resize(dst_size);
+  taps->begin = dst_size;
+  taps->end = 0;
+  for (size_t i = 0; i < dst_size; i++) {
+    const float u =
+        (s + 0.5f + (i / float(dst_size)) * (e - s + 1)) / float(src_size);
+
+    // Outside of the image(the sample is zero). `u` is monotonic in `i`.
+    if ((u < 0.0f) || (u >= 1.0f)) {
+      taps->i0[i] = taps->i1[i] = 0;
+      taps->w0[i] = taps->w1[i] = 0.0f;
+      continue;
+    }
+    taps->begin = std::min(taps->begin, i);
+    taps->end = i + 1;
+
+    const float uu = clamp(u - std::floor(u), 0.0f, 1.0f);
+    const float p = (size - 1) * uu;
+    const int p0 = int(p);
+    const int p1 = ((p0 + 1) >= size) ? (size - 1) : (p0 + 1);
+    const float d = p - float(p0);
+
+    taps->i0[i] = size_t(p0) * stride;
+    taps->i1[i] = size_t(p1) * stride;
+    taps->w0[i] = 1.0f - d;
+    taps->w1[i] = d;
+  }
+  if (taps->begin > taps->end) {
+    taps->begin = taps->end = 0;
   }
+}
 
-  if (channels < 4) {
-    rgba[3] = 1.0;
+//
+// Pixels [x_begin, x_end) of an output row of the crop. Weights of a pixel
+// are products of the column and row weights, texels of the 4 taps are
+// blended in linear space.
+//
+template <int kChannels, typename T, typename Decode>
+void CropRow(const T *r0, const T *r1, float wy0, float wy1,
+             const CropTaps &cols, size_t x_begin, size_t x_end, int channels,
+             size_t channel_stride, const Decode &decode, float *dst) {
+  const size_t n_ch = size_t((kChannels > 0) ? kChannels : channels);
+  for (size_t x = x_begin; x < x_end; x++) {
+    const float w00 = cols.w0[x] * wy0;
+    const float w10 = cols.w0[x] * wy1;
+    const float w01 = cols.w1[x] * wy0;
+    const float w11 = cols.w1[x] * wy1;
+    const T *t00 = r0 + cols.i0[x];
+    const T *t10 = r1 + cols.i0[x];
+    const T *t01 = r0 + cols.i1[x];
+    const T *t11 = r1 + cols.i1[x];
+    float *o = dst + x * n_ch;
+    for (size_t c = 0; c < n_ch; c++) {
+      const size_t k = c * channel_stride;
+      o[c] = w00 * decode(t00[k]) + w10 * decode(t10[k]) +
+             w01 * decode(t01[k]) + w11 * decode(t11[k]);
+    }
   }
 }
 
-// Fetch texture with bilinear filtering.
-static void FetchTexture(const float u, const float v, int width, int height,
-                         int components, const float *image, float *rgba) {
-  // clamp to edge
-  if ((u < 0.0f) || (u >= 1.0f) || (v < 0.0f) || (v >= 1.0f)) {
-    rgba[0] = 0.0f;
-    rgba[1] = 0.0f;
-    rgba[2] = 0.0f;
-    rgba[3] = 0.0f;
-    return;
+#ifdef PRNET_CROP_HAS_AVX2_KERNEL
+//
+// CropRow<3> of a float image with interleaved RGB, two pixels per 256-bit
+// register(one per 128-bit lane). Same operations in the same order as the
+// scalar code(no FMA), so results are bit identical. Each tap loads 4 floats
+// and each pixel stores 4 floats, so the caller must ensure one more
+// readable float after the last tap, and the last pixel is left to the
+// scalar code. Returns the first pixel not processed.
+//
+__attribute__((target("avx2")))
+size_t CropRowRgbAvx2(const float *r0, const float *r1, float wy0, float wy1,
+                      const CropTaps &cols, float *dst) {
+  const __m256 vy0 = _mm256_set1_ps(wy0);
+  const __m256 vy1 = _mm256_set1_ps(wy1);
+  size_t x = cols.begin;
+  for (; x + 2 < cols.end; x += 2) {
+    // Broadcast column weights of pixel x to the lower lane and pixel x + 1
+    // to the upper lane.
+    const __m256 wx0 = _mm256_insertf128_ps(
+        _mm256_castps128_ps256(_mm_set1_ps(cols.w0[x])),
+        _mm_set1_ps(cols.w0[x + 1]), 1);
+    const __m256 wx1 = _mm256_insertf128_ps(
+        _mm256_castps128_ps256(_mm_set1_ps(cols.w1[x])),
+        _mm_set1_ps(cols.w1[x + 1]), 1);
+    const size_t a0 = cols.i0[x], a1 = cols.i1[x];
+    const size_t b0 = cols.i0[x + 1], b1 = cols.i1[x + 1];
+    const __m256 t00 = _mm256_insertf128_ps(
+        _mm256_castps128_ps256(_mm_loadu_ps(r0 + a0)), _mm_loadu_ps(r0 + b0),
+        1);
+    const __m256 t10 = _mm256_insertf128_ps(
+        _mm256_castps128_ps256(_mm_loadu_ps(r1 + a0)), _mm_loadu_ps(r1 + b0),
+        1);
+    const __m256 t01 = _mm256_insertf128_ps(
+        _mm256_castps128_ps256(_mm_loadu_ps(r0 + a1)), _mm_loadu_ps(r0 + b1),
+        1);
+    const __m256 t11 = _mm256_insertf128_ps(
+        _mm256_castps128_ps256(_mm_loadu_ps(r1 + a1)), _mm_loadu_ps(r1 + b1),
+        1);
+    __m256 v = _mm256_mul_ps(_mm256_mul_ps(wx0, vy0), t00);
+    v = _mm256_add_ps(v, _mm256_mul_ps(_mm256_mul_ps(wx0, vy1), t10));
+    v = _mm256_add_ps(v, _mm256_mul_ps(_mm256_mul_ps(wx1, vy0), t01));
+    v = _mm256_add_ps(v, _mm256_mul_ps(_mm256_mul_ps(wx1, vy1), t11));
+    // The 4th float of each pixel is overwritten by the next pixel.
+    _mm_storeu_ps(dst + 3 * x, _mm256_castps256_ps128(v));
+    _mm_storeu_ps(dst + 3 * x + 3, _mm256_extractf128_ps(v, 1));
   }
+  return x;
+}
 
-  float sx = std::floor(u);
-  float sy = std::floor(v);
+bool CpuHasAvx2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+#endif
 
-  float uu = u - sx;
-  float vv = v - sy;
+// Whether the AVX2 kernel can be used(checked once).
+bool UseRgbAvx2() {
+#ifdef PRNET_CROP_HAS_AVX2_KERNEL
+  static const bool has_avx2 = CpuHasAvx2();
+  return has_avx2;
+#else
+  return false;
+#endif
+}
 
-  // clamp
-  uu = clamp(uu, 0.0f, 1.0f);
-  vv = clamp(vv, 0.0f, 1.0f);
+size_t CropRowRgbSimd(const float *r0, const float *r1, float wy0, float wy1,
+                      const CropTaps &cols, float *dst) {
+#ifdef PRNET_CROP_HAS_AVX2_KERNEL
+  return CropRowRgbAvx2(r0, r1, wy0, wy1, cols, dst);
+#else
+  (void)r0;
+  (void)r1;
+  (void)wy0;
+  (void)wy1;
+  (void)dst;
+  return cols.begin;
+#endif
+}
 
-  float px = (width - 1) * uu;
-  float py = (height - 1) * vv;
+//
+// Output rows of an interleaved RGB crop(channels == 3). One instance per
+// task of CropImage(). Float images run the SIMD kernel on the source rows
+// directly.
+//
+template <typename T, typename Decode>
+class RgbRowCropper {
+public:
+  RgbRowCropper(const ImageView<const T> &img, const CropTaps &_cols,
+                const Decode &_decode, CropRowScratch *scratch)
+      : src(img.getData()), cs(img.getChannelStride()), cols(_cols),
+        decode(_decode) {
+    (void)scratch;
+    // The SIMD kernel reads one element past the taps, which must stay
+    // inside of the view.
+    extent = (img.getHeight() - 1) * img.getRowStride() +
+             (img.getWidth() - 1) * img.getPixelStride() + 2 * cs + 1;
+    simd = (cs == 1) && UseRgbAvx2();
+  }
 
-  int x0 = int(px);
-  int y0 = int(py);
-  int x1 = ((x0 + 1) >= width) ? (width - 1) : (x0 + 1);
-  int y1 = ((y0 + 1) >= height) ? (height - 1) : (y0 + 1);
+  // `r0`, `r1` are offsets of the two source rows.
+  void crop(size_t r0, size_t r1, float wy0, float wy1, float *dst) {
+    size_t x = cols.begin;
+    if (simd && (r1 + cols.i1[cols.end - 1] + 3 < extent)) {
+      x = CropRowRgbSimd(src + r0, src + r1, wy0, wy1, cols, dst);
+    }
+    CropRow<3>(src + r0, src + r1, wy0, wy1, cols, x, cols.end, 3, cs, decode,
+               dst);
+  }
 
-  float dx = px - float(x0);
-  float dy = py - float(y0);
+private:
+  const T *src;
+  size_t cs;
+  const CropTaps &cols;
+  const Decode &decode;
+  size_t extent;
+  bool simd;
+};
 
-  float w[4];
+//
+// 8-bit frames. With AVX2, the column span of the source rows is decoded
+// through the table into float rows once, instead of per tap, and the float
+// kernel runs on them. The last two decoded rows are kept, so that output
+// rows sharing a source row(enlarging) do not decode them again. Same values
+// as CropRow<3>() with DecodeTexel, so results are bit identical.
+// Decoding the span costs more than the per tap lookups when the box is
+// shrunk by more than about 1.5x(e.g. faces larger than 384 pixels), so
+// those crops stay on the scalar code.
+// Decoded taps and rows are kept in `scratch` of the thread.
+//
+template <>
+class RgbRowCropper<uint8_t, DecodeTexel> {
+public:
+  RgbRowCropper(const ImageView<const uint8_t> &img, const CropTaps &_cols,
+                const DecodeTexel &_decode, CropRowScratch *scratch)
+      : src(img.getData()), ps(img.getPixelStride()),
+        cs(img.getChannelStride()), cols(_cols), decode(_decode),
+        taps(scratch->taps), rows(scratch->rows) {
+    if ((img.getChannels() != 3) || (cs != 1) || (cols.begin >= cols.end) ||
+        !UseRgbAvx2()) {
+      return;
+    }
+    const size_t n = cols.end - cols.begin;
+    first = cols.i0[cols.begin] / ps;
+    span = cols.i1[cols.end - 1] / ps - first + 1;
+    decoded = (2 * span <= 3 * n);
+    if (!decoded) {
+      return;
+    }
 
-  w[0] = (1.0f - dx) * (1.0f - dy);
-  w[1] = (1.0f - dx) * (dy);
-  w[2] = (dx) * (1.0f - dy);
-  w[3] = (dx) * (dy);
+    // Taps in the decoded rows.
+    taps = cols;
+    for (size_t x = cols.begin; x < cols.end; x++) {
+      taps.i0[x] = (cols.i0[x] / ps - first) * 3;
+      taps.i1[x] = (cols.i1[x] / ps - first) * 3;
+    }
+    // + 1 for the kernel reading one element past the taps.
+    for (size_t k = 0; k < 2; k++) {
+      rows[k].assign(3 * span + 1, 0.0f);
+    }
+  }
 
-  int i00 = components * (y0 * width + x0);
-  int i01 = components * (y0 * width + x1);
-  int i10 = components * (y1 * width + x0);
-  int i11 = components * (y1 * width + x1);
+  void crop(size_t r0, size_t r1, float wy0, float wy1, float *dst) {
+    if (!decoded) {
+      CropRow<3>(src + r0, src + r1, wy0, wy1, cols, cols.begin, cols.end, 3,
+                 cs, decode, dst);
+      return;
+    }
+    const float *d0 = decoded_row(r0, nullptr);
+    const float *d1 = decoded_row(r1, d0);
+    const size_t x = CropRowRgbSimd(d0, d1, wy0, wy1, taps, dst);
+    CropRow<3>(d0, d1, wy0, wy1, taps, x, taps.end, 3, 1, FloatTexel(), dst);
+  }
 
-  FilterFloat(rgba, image, i00, i10, i01, i11, w, components);
-}
+private:
+  static const size_t kNoRow = ~size_t(0);
+
+  // Decoded source row at `offset`. Does not overwrite `keep`.
+  const float *decoded_row(size_t offset, const float *keep) {
+    for (size_t k = 0; k < 2; k++) {
+      if (keys[k] == offset) {
+        last = k;
+        return rows[k].data();
+      }
+    }
+    size_t k = 1 - last;
+    if (rows[k].data() == keep) {
+      k = last;
+    }
+    float *out = rows[k].data();
+    const uint8_t *p = src + offset + first * ps;
+    for (size_t i = 0; i < span; i++, p += ps) {
+      out[3 * i + 0] = decode(p[0]);
+      out[3 * i + 1] = decode(p[1]);
+      out[3 * i + 2] = decode(p[2]);
+    }
+    keys[k] = offset;
+    last = k;
+    return out;
+  }
+
+  const uint8_t *src;
+  size_t ps;
+  size_t cs;
+  const CropTaps &cols;
+  const DecodeTexel &decode;
+
+  bool decoded = false;
+  size_t first = 0;     // first source pixel of the column span
+  size_t span = 0;      // source pixels of the column span
+  CropTaps &taps;       // offsets in the decoded rows
+  std::vector<float> (&rows)[2];
+  size_t keys[2] = {kNoRow, kNoRow};  // source row offsets of `rows`
+  size_t last = 0;                    // most recently used row
+};
 
 //
 // Crop an image with bilinear filtering.
 // pixel bounding box is defined in (xs, ys) - (xe, ye)
 // bounding box range is in (0, 0) x (width-1, height-1)
+// Samples outside of the image are zero. Rows are cropped in parallel.
+// Taps and row buffers are reused from the scratch of the calling thread.
 //
-static void CropImage(const Image<float> &in_img, int xs, int xe, int ys,
-                      int ye, Image<float> *out_img, size_t dst_width,
-                      size_t dst_height) {
-  size_t width = in_img.getWidth();
-  size_t height = in_img.getHeight();
-  size_t channels = in_img.getChannels();
+template <typename T, typename Decode>
+void CropImage(const ImageView<const T> &in_img, int xs, int xe, int ys,
+               int ye, Image<float> *out_img, size_t dst_width,
+               size_t dst_height, const Decode &decode) {
+  const size_t channels = in_img.getChannels();
 
   out_img->create(dst_width, dst_height, channels);
 
@@ -119,87 +397,177 @@ static void CropImage(const Image<float> &in_img, int xs, int xe, int ys,
     return;
   }
 
-  const float *src = in_img.getData();
-  float *dst = out_img->getData();
-
-  for (size_t y = 0; y < dst_height; y++) {
-    float v = (ys + 0.5f + (y / float(dst_height)) * (ye - ys + 1)) / float(height);
-    for (size_t x = 0; x < dst_width; x++) {
-      float u = (xs + 0.5f + (x / float(dst_width)) * (xe - xs + 1)) / float(width);
-
-      float rgba[4];
-      FetchTexture(u, v, int(width), int(height), int(channels), src, rgba);
+  CropScratch &scratch = GetCropScratch();
+  const CropTaps &cols = scratch.cols;
+  const CropTaps &rows = scratch.rows;
+  ComputeCropTaps(xs, xe, dst_width, in_img.getWidth(),
+                  in_img.getPixelStride(), &scratch.cols);
+  ComputeCropTaps(ys, ye, dst_height, in_img.getHeight(),
+                  in_img.getRowStride(), &scratch.rows);
+
+  ThreadPool &pool = ThreadPool::global();
+  if (scratch.slots.size() < pool.size()) {
+    scratch.slots.resize(pool.size());
+  }
 
-      for (size_t c = 0; c < channels; c++) {
-        dst[channels * (y * dst_width + x) + c] = rgba[c];
+  const T *src = in_img.getData();
+  const size_t cs = in_img.getChannelStride();
+  const size_t row_size = dst_width * channels;
+  float *dst = out_img->getData();
+  auto crop_rows = [&](size_t y_begin, size_t y_end, size_t slot) {
+    RgbRowCropper<T, Decode> rgb(in_img, cols, decode, &scratch.slots[slot]);
+    for (size_t y = y_begin; y < y_end; y++) {
+      float *row = dst + y * row_size;
+      if ((y < rows.begin) || (y >= rows.end)) {
+        std::fill(row, row + row_size, 0.0f);
+        continue;
+      }
+      std::fill(row, row + cols.begin * channels, 0.0f);
+      std::fill(row + cols.end * channels, row + row_size, 0.0f);
+
+      if (channels == 3) {
+        rgb.crop(rows.i0[y], rows.i1[y], rows.w0[y], rows.w1[y], row);
+      } else {
+        CropRow<0>(src + rows.i0[y], src + rows.i1[y], rows.w0[y], rows.w1[y],
+                   cols, cols.begin, cols.end, int(channels), cs, decode, row);
       }
     }
-  }
+  };
+  typedef decltype(crop_rows) CropRows;
+  pool.parallel_for(
+      0, dst_height, 0, 0,
+      [](void *ctx, size_t begin, size_t end, size_t slot) {
+        (*static_cast<CropRows *>(ctx))(begin, end, slot);
+      },
+      &crop_rows);
 }
 
 } // anonymous namespace
 
+void CropImage(const ImageView<const float>& inp_img, const CropRegion& region,
+               size_t width, size_t height, Image<float>* out_img) {
+  CropImage(inp_img, region.xs, region.xe, region.ys, region.ye, out_img,
+            width, height, FloatTexel());
+}
+
+void CropImage(const ImageView<const uint8_t>& frame, const CropRegion& region,
+               size_t width, size_t height, Image<float>* out_img,
+               float gamma) {
+  CropImage(frame, region.xs, region.xe, region.ys, region.ye, out_img, width,
+            height, DecodeTexel(gamma));
+}
+
 class FaceCropper::Impl {
 public:
-  bool crop_dlib(const Image<float>& inp_img, Image<float>& out_img,
+  explicit Impl(size_t _min_face_size) : min_face_size(_min_face_size) {}
+
+  bool crop_dlib(const ImageView<const uint8_t>& frame, Image<float>& out_img,
                  float* scale, float *shift_x, float *shift_y) {
+    CropRegion region;
+    if (!detect_dlib(frame, &region)) {
+      return false;
+    }
+    CropImage(frame, region, 256, 256, &out_img, 2.2f);  // sRGB -> linear
+
+    *scale = region.scale;
+    *shift_x = region.shift_x;
+    *shift_y = region.shift_y;
+
+    return true;
+  }
+
+  bool crop_center(const ImageView<const uint8_t>& frame,
+                   Image<float>& out_img,
+                   float* scale, float *shift_x, float *shift_y) {
+    CropRegion region;
+    center_region(frame.getWidth(), frame.getHeight(), &region);
+
+    CropImage(frame, region, 256, 256, &out_img, 2.2f);  // sRGB -> linear
+
+    *scale = region.scale;
+    *shift_x = region.shift_x;
+    *shift_y = region.shift_y;
+
+    return true;
+  }
+
+  bool detect_dlib(const ImageView<const uint8_t>& inp_img,
+                   CropRegion* region) {
+    std::vector<CropRegion> regions;
+    if (!detect_dlib(inp_img, &regions)) {
+      return false;
+    }
+    *region = regions[0];
+    return true;
+  }
+
+  bool detect_dlib(const ImageView<const uint8_t>& inp_img,
+                   std::vector<CropRegion>* regions) {
+    regions->clear();
 #ifdef USE_DLIB
-    const int width = int(inp_img.getWidth());
-    const int height = int(inp_img.getHeight());
     assert(inp_img.getChannels() == 3);
 
-    // Create dlib image
-    dlib::array2d<unsigned char> dlib_img(height, width);
-    inp_img.foreach ([&](int x, int y, const float *v) {
-      // Gray scale
-      dlib_img[y][x] = static_cast<uint8_t>(clamp( (0.2126f * v[0] + 0.7152f * v[1] + 0.0722f * v[2]) * 255.0f, 0.0f, 255.0f));
+    // The detector finds faces of kDetectorFaceSize pixels and larger(its
+    // image pyramid only goes down). Detect on the frame shrunk by the
+    // integer factor floor(min_face_size / kDetectorFaceSize), so that
+    // `min_face_size` faces become kDetectorFaceSize or a bit larger, then
+    // map the boxes back to the full resolution frame. The frame is never
+    // upscaled(factor >= 1).
+    const size_t factor =
+        std::max(size_t(1), min_face_size / kDetectorFaceSize);
+    const size_t width = inp_img.getWidth() / factor;
+    const size_t height = inp_img.getHeight() / factor;
+    if ((width == 0) || (height == 0)) {
+      return false;
+    }
+
+    // Gray scale in linear space, averaged over `factor` x `factor` pixel
+    // boxes in a single pass over the frame(no full resolution gray image).
+    // Only built when detection runs.
+    float to_linear[256];
+    MakeGammaTable(2.2f, to_linear);
+
+    dlib::array2d<unsigned char> dlib_img(static_cast<long>(height),
+                                          static_cast<long>(width));
+    const size_t ps = inp_img.getPixelStride();
+    const size_t cs = inp_img.getChannelStride();
+    const float norm = 1.0f / float(factor * factor);
+    ParallelFor(height, [&](size_t y_begin, size_t y_end) {
+      std::vector<float> sum(width);
+      for (size_t y = y_begin; y < y_end; y++) {
+        std::fill(sum.begin(), sum.end(), 0.0f);
+        for (size_t j = 0; j < factor; j++) {
+          const uint8_t *v = inp_img.row(y * factor + j);
+          for (size_t x = 0; x < width; x++) {
+            float s = 0.0f;
+            for (size_t i = 0; i < factor; i++, v += ps) {
+              const float r = to_linear[v[0]];
+              const float g = to_linear[v[cs]];
+              const float b = to_linear[v[2 * cs]];
+              s += 0.2126f * r + 0.7152f * g + 0.0722f * b;
+            }
+            sum[x] += s;
+          }
+        }
+        unsigned char* dst = &dlib_img[long(y)][0];
+        for (size_t x = 0; x < width; x++) {
+          dst[x] = static_cast<uint8_t>(
+              clamp(sum[x] * norm * 255.0f, 0.0f, 255.0f));
+        }
+      }
     });
 
-    // Detect
-    const std::vector<dlib::rectangle> dets = detector(dlib_img);
-    if (0 < dets.size()) {
-      const dlib::rectangle &d = dets[0];
-
-      // Crop
-      const float left = float(d.left());
-      const float right = float(d.right());
-      const float top = float(d.top());
-      const float bottom = float(d.bottom());
-      const float old_size = (right - left + bottom - top) / 2.f;
-      const float center[2] =
-        {right - (right - left) / 2.f,
-         bottom - (bottom - top) / 2.f + old_size * 0.14f};
-      const float size = old_size * 1.58f;
-
-      int region[4];
-      region[0] = int(center[0] - (size / 2.0f));
-      region[1] = int(center[0] + (size / 2.0f));
-      region[2] = int(center[1] - (size / 2.0f));
-      region[3] = int(center[1] + (size / 2.0f));
-
-      CropImage(inp_img, region[0], region[1], region[2], region[3], &out_img,
-                256, 256);
-
-      *scale = size / float(width);
-      *shift_x = center[0];
-      *shift_y = center[1];
-
-      return true;
-    }
+    return detect(dlib_img, factor, inp_img.getWidth(), regions);
 #else
     (void)inp_img;
-    (void)out_img;
-    (void)scale;
-    (void)shift_x;
-    (void)shift_y;
-#endif
+    (void)min_face_size;
     return false;
+#endif
   }
 
-  bool crop_center(const Image<float>& inp_img, Image<float>& out_img,
-                   float* scale, float *shift_x, float *shift_y) {
-    const int width = int(inp_img.getWidth());
-    const int height = int(inp_img.getHeight());
+  void center_region(size_t _width, size_t _height, CropRegion* region) {
+    const int width = int(_width);
+    const int height = int(_height);
 
     // In non dlib path, PRNet crops image from image center with 1/1.6 scaling
     // (minify) then revert it by x1.6 scaling.
@@ -207,42 +575,91 @@ public:
     const float SCALE = 1.6f;
     float center[2] = {width / 2.0f - 0.5f, height / 2.0f - 0.5f};
 
-    int region[4];
-    region[0] = int(center[0] - (width / 2.0f) * SCALE);
-    region[1] = int(center[0] + (width / 2.0f) * SCALE);
-    region[2] = int(center[1] - (height / 2.0f) * SCALE);
-    region[3] = int(center[1] + (height / 2.0f) * SCALE);
-
-    std::cout << "region = " << region[0] << ", " << region[1] << ", " << region[2] << ", " << region[3] << std::endl;
+    region->xs = int(center[0] - (width / 2.0f) * SCALE);
+    region->xe = int(center[0] + (width / 2.0f) * SCALE);
+    region->ys = int(center[1] - (height / 2.0f) * SCALE);
+    region->ye = int(center[1] + (height / 2.0f) * SCALE);
 
-    CropImage(inp_img, region[0], region[1], region[2], region[3], &out_img,
-              256, 256);
+    std::cout << "region = " << region->xs << ", " << region->xe << ", " << region->ys << ", " << region->ye << std::endl;
 
-    *scale = SCALE;
-    *shift_x = center[0] - ((256.0f / 2.0f) - 0.5f) * SCALE;
-    *shift_y = center[1] - ((256.0f / 2.0f) - 0.5f) * SCALE;
-
-    return true;
+    region->scale = SCALE;
+    region->shift_x = center[0] - ((256.0f / 2.0f) - 0.5f) * SCALE;
+    region->shift_y = center[1] - ((256.0f / 2.0f) - 0.5f) * SCALE;
   }
 
 private:
+  size_t min_face_size;
+
 #ifdef USE_DLIB
+  // `dlib_img` is the frame shrunk by `factor`.
+  bool detect(dlib::array2d<unsigned char>& dlib_img, size_t factor,
+              size_t width, std::vector<CropRegion>* regions) {
+    // Detect
+    const std::vector<dlib::rectangle> dets = detector(dlib_img);
+    regions->resize(dets.size());
+    const long f = long(factor);
+    for (size_t i = 0; i < dets.size(); i++) {
+      const dlib::rectangle &d = dets[i];
+      const dlib::rectangle box(d.left() * f, d.top() * f,
+                                (d.right() + 1) * f - 1,
+                                (d.bottom() + 1) * f - 1);
+      to_region(box, width, &(*regions)[i]);
+    }
+    return !dets.empty();
+  }
+
+  // Square region around a detected face box, as in PRNet's api.py.
+  static void to_region(const dlib::rectangle &d, size_t width,
+                        CropRegion *region) {
+    const float left = float(d.left());
+    const float right = float(d.right());
+    const float top = float(d.top());
+    const float bottom = float(d.bottom());
+    const float old_size = (right - left + bottom - top) / 2.f;
+    const float center[2] =
+      {right - (right - left) / 2.f,
+       bottom - (bottom - top) / 2.f + old_size * 0.14f};
+    const float size = old_size * 1.58f;
+
+    region->xs = int(center[0] - (size / 2.0f));
+    region->xe = int(center[0] + (size / 2.0f));
+    region->ys = int(center[1] - (size / 2.0f));
+    region->ye = int(center[1] + (size / 2.0f));
+
+    region->scale = size / float(width);
+    region->shift_x = center[0];
+    region->shift_y = center[1];
+  }
+
   dlib::frontal_face_detector detector = dlib::get_frontal_face_detector();
 #endif
 };
 
 // PImpl pattern
-FaceCropper::FaceCropper() : impl(new Impl()) {}
+FaceCropper::FaceCropper(size_t min_face_size)
+    : impl(new Impl(min_face_size)) {}
 FaceCropper::~FaceCropper() {}
-bool FaceCropper::crop_dlib(const Image<float>& inp_img,
+bool FaceCropper::crop_dlib(const ImageView<const uint8_t>& frame,
                             Image<float>& out_img, float* scale,
                             float *shift_x, float *shift_y) {
-  return impl->crop_dlib(inp_img, out_img, scale, shift_x, shift_y);
+  return impl->crop_dlib(frame, out_img, scale, shift_x, shift_y);
 }
-bool FaceCropper::crop_center(const Image<float>& inp_img,
+bool FaceCropper::crop_center(const ImageView<const uint8_t>& frame,
                               Image<float>& out_img, float* scale,
                               float *shift_x, float *shift_y) {
-  return impl->crop_center(inp_img, out_img, scale, shift_x, shift_y);
+  return impl->crop_center(frame, out_img, scale, shift_x, shift_y);
+}
+bool FaceCropper::detect_dlib(const ImageView<const uint8_t>& inp_img,
+                              CropRegion* region) {
+  return impl->detect_dlib(inp_img, region);
+}
+bool FaceCropper::detect_dlib(const ImageView<const uint8_t>& inp_img,
+                              std::vector<CropRegion>* regions) {
+  return impl->detect_dlib(inp_img, regions);
+}
+void FaceCropper::center_region(size_t width, size_t height,
+                                CropRegion* region) {
+  impl->center_region(width, height, region);
 }
 
 } // namespace prnet
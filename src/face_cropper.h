@@ -1,18 +1,94 @@
 #ifndef FACE_CROPPER_H_180610
 #define FACE_CROPPER_H_180610
 
+#include <memory>
+#include <vector>
+
 #include "image.h"
 
 namespace prnet {
 
+///
+/// Face region of an input image. Pixel bounding box (xs, ys) - (xe, ye) is
+/// resampled to the network input. `scale` and `shift_x`, `shift_y` map the
+/// network output back to the input image.
+///
+struct CropRegion {
+  int xs = 0;
+  int xe = 0;
+  int ys = 0;
+  int ye = 0;
+  float scale = 1.f;
+  float shift_x = 0.f;
+  float shift_y = 0.f;
+};
+
+///
+/// Crop `region` of an image(or a view of it) into `width` x `height` image
+/// with bilinear filtering. Pixels outside of the input image are zero.
+///
+void CropImage(const ImageView<const float>& inp_img, const CropRegion& region,
+               size_t width, size_t height, Image<float>* out_img);
+
+///
+/// Crop `region` of an 8-bit frame into float image in linear color space
+/// (pow(v / 255, gamma)). Texels are decoded with a table while sampling, so
+/// the full frame is never converted to float. Same result as
+/// ConvertImage(frame, &linear, gamma) followed by CropImage(linear, ...).
+///
+void CropImage(const ImageView<const uint8_t>& frame, const CropRegion& region,
+               size_t width, size_t height, Image<float>* out_img,
+               float gamma);
+
 class FaceCropper {
 public:
-  FaceCropper();
+  ///
+  /// Smallest face(in pixels) found by dlib's frontal face detector.
+  ///
+  static const size_t kDetectorFaceSize = 80;
+
+  ///
+  /// `min_face_size` is the smallest face(in pixels of the input image)
+  /// found by detect_dlib(). The detector runs on the image downscaled by
+  /// the integer factor floor(min_face_size / kDetectorFaceSize), which is
+  /// much faster on high resolution frames. The smallest face actually found
+  /// is kDetectorFaceSize times the factor(e.g. 80 to 159 all run at full
+  /// resolution). The image is never upscaled, so values below
+  /// kDetectorFaceSize are clamped to kDetectorFaceSize.
+  ///
+  explicit FaceCropper(size_t min_face_size = kDetectorFaceSize);
   ~FaceCropper();
-  bool crop_dlib(const Image<float>& inp_img, Image<float>& out_img,
+
+  ///
+  /// Detect face region with dlib(see detect_dlib()) and crop it from 8-bit
+  /// sRGB `frame` into `out_img`(linear color space, 256 x 256). `out_img`
+  /// may be the network input buffer.
+  ///
+  bool crop_dlib(const ImageView<const uint8_t>& frame, Image<float>& out_img,
                  float* scale, float *shift_x, float *shift_y);
-  bool crop_center(const Image<float>& inp_img, Image<float>& out_img,
-                   float* scale, float *shift_x, float *shift_y);
+  bool crop_center(const ImageView<const uint8_t>& frame,
+                   Image<float>& out_img, float* scale, float *shift_x,
+                   float *shift_y);
+
+  ///
+  /// Detect face region with dlib without cropping. `inp_img` is 8-bit sRGB.
+  /// Returns false when no face is found(always false without dlib).
+  ///
+  bool detect_dlib(const ImageView<const uint8_t>& inp_img,
+                   CropRegion* region);
+
+  ///
+  /// Detect all face regions with dlib(one HOG pass), in the order of the
+  /// detector. Returns false when no face is found(always false without
+  /// dlib).
+  ///
+  bool detect_dlib(const ImageView<const uint8_t>& inp_img,
+                   std::vector<CropRegion>* regions);
+
+  ///
+  /// Region at the image center(PRNet's path when no face is detected).
+  ///
+  void center_region(size_t width, size_t height, CropRegion* region);
 
 private:
   class Impl;
@@ -17,17 +17,18 @@
 
 namespace prnet {
 
-void FrontalizeFaceMesh(Mesh *front_mesh, const FaceData &face_data) {
+bool FrontalizeFaceMesh(const Mesh &mesh, const FaceData &face_data,
+                        std::vector<float> *front_vertices_out) {
 #ifdef USE_DLIB
     const int N_VTX = 43867;  // Defined by PRNet template.
 
-    assert(front_mesh->vertices.size() == N_VTX * 3);
+    assert(mesh.vertices.size() == N_VTX * 3);
 
     dlib::matrix<float, N_VTX, 4> vertices_homo;
     for (int i = 0; i < N_VTX; i++) {
-        vertices_homo(i, 0) = front_mesh->vertices[3 * size_t(i) + 0];
-        vertices_homo(i, 1) = front_mesh->vertices[3 * size_t(i) + 1];
-        vertices_homo(i, 2) = front_mesh->vertices[3 * size_t(i) + 2];
+        vertices_homo(i, 0) = mesh.vertices[3 * size_t(i) + 0];
+        vertices_homo(i, 1) = mesh.vertices[3 * size_t(i) + 1];
+        vertices_homo(i, 2) = mesh.vertices[3 * size_t(i) + 2];
         vertices_homo(i, 3) = 1.f;
     }
 
@@ -43,10 +44,12 @@ void FrontalizeFaceMesh(Mesh *front_mesh, const FaceData &face_data) {
     dlib::matrix<float, 4, 3> P = dlib::pinv(vertices_homo) * canonical_vertices;
     dlib::matrix<float, N_VTX, 3> front_vertices = vertices_homo * P;
 
+    std::vector<float> &out = *front_vertices_out;
+    out.resize(3 * N_VTX);
     for (int i = 0; i < N_VTX; i++) {
-        front_mesh->vertices[3 * size_t(i) + 0] = front_vertices(i, 0);
-        front_mesh->vertices[3 * size_t(i) + 1] = front_vertices(i, 1);
-        front_mesh->vertices[3 * size_t(i) + 2] = front_vertices(i, 2);
+        out[3 * size_t(i) + 0] = front_vertices(i, 0);
+        out[3 * size_t(i) + 1] = front_vertices(i, 1);
+        out[3 * size_t(i) + 2] = front_vertices(i, 2);
     }
 
 #if 1
@@ -55,9 +58,9 @@ void FrontalizeFaceMesh(Mesh *front_mesh, const FaceData &face_data) {
         float bmin[3];
         float bmax[3];
         for (size_t i = 0; i < N_VTX; i++) {
-            float x = front_mesh->vertices[3 * i + 0];
-            float y = front_mesh->vertices[3 * i + 1];
-            float z = front_mesh->vertices[3 * i + 2];
+            float x = out[3 * i + 0];
+            float y = out[3 * i + 1];
+            float z = out[3 * i + 2];
             if (i == 0) {
                 bmin[0] = bmax[0] = x;
                 bmin[1] = bmax[1] = y;
@@ -76,20 +79,23 @@ void FrontalizeFaceMesh(Mesh *front_mesh, const FaceData &face_data) {
         bsize[0] = bmax[0] - bmin[0];
         bsize[1] = bmax[1] - bmin[1];
         bsize[2] = bmax[2] - bmin[2];
-        for (size_t i = 0; i < front_mesh->vertices.size() / 3; i++) {
-            front_mesh->vertices[3 * i + 0] -= (bmin[0] + 0.5f * bsize[0]);
-            front_mesh->vertices[3 * i + 1] -= (bmin[1] + 0.5f * bsize[1]);
-            front_mesh->vertices[3 * i + 2] -= (bmin[2] + 0.5f * bsize[2]);
+        for (size_t i = 0; i < out.size() / 3; i++) {
+            out[3 * i + 0] -= (bmin[0] + 0.5f * bsize[0]);
+            out[3 * i + 1] -= (bmin[1] + 0.5f * bsize[1]);
+            out[3 * i + 2] -= (bmin[2] + 0.5f * bsize[2]);
         }
     }
 #endif
 
+    return true;
 #else
-  (void)front_mesh;
+  (void)mesh;
   (void)face_data;
+  (void)front_vertices_out;
 
   std::cerr << "Face frontalization is not supported in non dlib buid at the momemnt." << std::endl;
 
+  return false;
 #endif
 }
 
@@ -7,7 +7,13 @@
 
 namespace prnet {
 
-void FrontalizeFaceMesh(Mesh *front_mesh, const FaceData &face_data);
+///
+/// Compute frontalized `mesh.vertices` into `front_vertices`. Faces and uvs of
+/// the frontalized mesh are the same as `mesh`, so they are not copied.
+/// Returns false when frontalization is not supported(non dlib build).
+///
+bool FrontalizeFaceMesh(const Mesh &mesh, const FaceData &face_data,
+                        std::vector<float> *front_vertices);
 
 } // namespace prnet
 
@@ -0,0 +1,520 @@
+#include "graph_def_reader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace prnet {
+
+namespace {
+
+// Protobuf wire types
+const int kWireVarint = 0;
+const int kWireFixed64 = 1;
+const int kWireLengthDelimited = 2;
+const int kWireFixed32 = 5;
+
+class WireReader {
+public:
+  WireReader(const char* _begin, const char* _end) : p(_begin), end(_end) {}
+
+  bool done() const { return p >= end; }
+
+  const char* position() const { return p; }
+
+  bool tag(uint32_t* field, int* wire_type) {
+    uint64_t v;
+    if (!varint(&v)) {
+      return false;
+    }
+    *field = uint32_t(v >> 3);
+    *wire_type = int(v & 0x7);
+    return true;
+  }
+
+  bool varint(uint64_t* v) {
+    *v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      if (p >= end) {
+        return false;
+      }
+      const uint8_t byte = uint8_t(*p++);
+      *v |= uint64_t(byte & 0x7f) << shift;
+      if ((byte & 0x80) == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool fixed32(uint32_t* v) {
+    if (end - p < 4) {
+      return false;
+    }
+    std::memcpy(v, p, 4);  // Assume little endian host.
+    p += 4;
+    return true;
+  }
+
+  bool bytes(const char** b, const char** e) {
+    uint64_t len;
+    if (!varint(&len) || (len > uint64_t(end - p))) {
+      return false;
+    }
+    *b = p;
+    *e = p + len;
+    p += len;
+    return true;
+  }
+
+  bool string(std::string* s) {
+    const char* b;
+    const char* e;
+    if (!bytes(&b, &e)) {
+      return false;
+    }
+    s->assign(b, e);
+    return true;
+  }
+
+  bool skip(int wire_type) {
+    uint64_t v;
+    const char* b;
+    const char* e;
+    switch (wire_type) {
+    case kWireVarint:
+      return varint(&v);
+    case kWireFixed64:
+      if (end - p < 8) {
+        return false;
+      }
+      p += 8;
+      return true;
+    case kWireLengthDelimited:
+      return bytes(&b, &e);
+    case kWireFixed32:
+      if (end - p < 4) {
+        return false;
+      }
+      p += 4;
+      return true;
+    default:
+      return false;
+    }
+  }
+
+private:
+  const char* p;
+  const char* end;
+};
+
+float BitsToFloat(uint32_t bits) {
+  float f;
+  std::memcpy(&f, &bits, 4);
+  return f;
+}
+
+// Repeated scalar field is either packed(length delimited) or unpacked.
+template <typename F>
+bool ReadRepeated(WireReader* r, int wire_type, int element_wire_type,
+                  const F& append) {
+  if (wire_type == kWireLengthDelimited) {
+    const char* b;
+    const char* e;
+    if (!r->bytes(&b, &e)) {
+      return false;
+    }
+    WireReader packed(b, e);
+    while (!packed.done()) {
+      if (!append(&packed)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  if (wire_type != element_wire_type) {
+    return false;
+  }
+  return append(r);
+}
+
+bool ReadVarints(WireReader* r, int wire_type, std::vector<int64_t>* values) {
+  return ReadRepeated(r, wire_type, kWireVarint, [values](WireReader* rr) {
+    uint64_t v;
+    if (!rr->varint(&v)) {
+      return false;
+    }
+    values->push_back(int64_t(v));
+    return true;
+  });
+}
+
+bool ReadFloats(WireReader* r, int wire_type, std::vector<float>* values) {
+  return ReadRepeated(r, wire_type, kWireFixed32, [values](WireReader* rr) {
+    uint32_t v;
+    if (!rr->fixed32(&v)) {
+      return false;
+    }
+    values->push_back(BitsToFloat(v));
+    return true;
+  });
+}
+
+bool ParseTensorShape(const char* b, const char* e,
+                      std::vector<int64_t>* shape) {
+  WireReader r(b, e);
+  while (!r.done()) {
+    uint32_t field;
+    int wire_type;
+    if (!r.tag(&field, &wire_type)) {
+      return false;
+    }
+    if ((field == 2) && (wire_type == kWireLengthDelimited)) {  // dim
+      const char* db;
+      const char* de;
+      if (!r.bytes(&db, &de)) {
+        return false;
+      }
+      WireReader dr(db, de);
+      int64_t size = 0;
+      while (!dr.done()) {
+        uint32_t dfield;
+        int dwire_type;
+        if (!dr.tag(&dfield, &dwire_type)) {
+          return false;
+        }
+        if ((dfield == 1) && (dwire_type == kWireVarint)) {
+          uint64_t v;
+          if (!dr.varint(&v)) {
+            return false;
+          }
+          size = int64_t(v);
+        } else if (!dr.skip(dwire_type)) {
+          return false;
+        }
+      }
+      shape->push_back(size);
+    } else if (!r.skip(wire_type)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ConvertTensorContent(const char* b, const char* e, GraphTensor* tensor) {
+  const size_t n = tensor->num_elements();
+  const size_t len = size_t(e - b);
+  tensor->values.resize(n);
+  switch (tensor->dtype) {
+  case kGraphDataTypeFloat:
+    if (len != n * 4) {
+      return false;
+    }
+    std::memcpy(tensor->values.data(), b, len);
+    return true;
+  case kGraphDataTypeHalf:
+    if (len != n * 2) {
+      return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+      uint16_t h;
+      std::memcpy(&h, b + i * 2, 2);
+      tensor->values[i] = HalfToFloat(h);
+    }
+    return true;
+  case kGraphDataTypeUInt8:
+  case kGraphDataTypeQUInt8:
+    if (len != n) {
+      return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+      tensor->values[i] = float(uint8_t(b[i]));
+    }
+    return true;
+  case kGraphDataTypeInt32:
+    if (len != n * 4) {
+      return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+      int32_t v;
+      std::memcpy(&v, b + i * 4, 4);
+      tensor->values[i] = float(v);
+    }
+    return true;
+  case kGraphDataTypeInt64:
+    if (len != n * 8) {
+      return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+      int64_t v;
+      std::memcpy(&v, b + i * 8, 8);
+      tensor->values[i] = float(v);
+    }
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool ParseTensor(const char* b, const char* e, GraphTensor* tensor) {
+  WireReader r(b, e);
+  const char* content_begin = nullptr;
+  const char* content_end = nullptr;
+  std::vector<float> float_vals;
+  std::vector<int64_t> int_vals;
+  while (!r.done()) {
+    uint32_t field;
+    int wire_type;
+    if (!r.tag(&field, &wire_type)) {
+      return false;
+    }
+    bool ok = true;
+    if ((field == 1) && (wire_type == kWireVarint)) {  // dtype
+      uint64_t v;
+      ok = r.varint(&v);
+      tensor->dtype = int(v);
+    } else if ((field == 2) && (wire_type == kWireLengthDelimited)) {  // shape
+      const char* sb;
+      const char* se;
+      ok = r.bytes(&sb, &se) && ParseTensorShape(sb, se, &tensor->shape);
+    } else if ((field == 4) && (wire_type == kWireLengthDelimited)) {
+      ok = r.bytes(&content_begin, &content_end);  // tensor_content
+    } else if (field == 5) {  // float_val
+      ok = ReadFloats(&r, wire_type, &float_vals);
+    } else if ((field == 6) || (field == 10) || (field == 13)) {
+      // int_val, int64_val, half_val
+      ok = ReadVarints(&r, wire_type, &int_vals);
+    } else {
+      ok = r.skip(wire_type);
+    }
+    if (!ok) {
+      return false;
+    }
+  }
+
+  if (content_begin) {
+    return ConvertTensorContent(content_begin, content_end, tensor);
+  }
+
+  std::vector<float> vals;
+  if (tensor->dtype == kGraphDataTypeFloat) {
+    vals.swap(float_vals);
+  } else if (tensor->dtype == kGraphDataTypeHalf) {
+    for (size_t i = 0; i < int_vals.size(); i++) {
+      vals.push_back(HalfToFloat(uint16_t(int_vals[i])));
+    }
+  } else {
+    for (size_t i = 0; i < int_vals.size(); i++) {
+      vals.push_back(float(int_vals[i]));
+    }
+  }
+
+  const size_t n = tensor->num_elements();
+  if (vals.size() == n) {
+    tensor->values.swap(vals);
+  } else if (vals.size() <= 1) {
+    tensor->values.assign(n, vals.empty() ? 0.0f : vals[0]);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool ParseAttrList(const char* b, const char* e, GraphAttr* attr) {
+  WireReader r(b, e);
+  while (!r.done()) {
+    uint32_t field;
+    int wire_type;
+    if (!r.tag(&field, &wire_type)) {
+      return false;
+    }
+    bool ok = true;
+    if ((field == 2) && (wire_type == kWireLengthDelimited)) {  // s
+      std::string s;
+      ok = r.string(&s);
+      attr->list_s.push_back(s);
+    } else if (field == 3) {  // i
+      ok = ReadVarints(&r, wire_type, &attr->list_i);
+    } else if (field == 4) {  // f
+      ok = ReadFloats(&r, wire_type, &attr->list_f);
+    } else {
+      ok = r.skip(wire_type);
+    }
+    if (!ok) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ParseAttrValue(const char* b, const char* e, GraphAttr* attr) {
+  WireReader r(b, e);
+  while (!r.done()) {
+    uint32_t field;
+    int wire_type;
+    if (!r.tag(&field, &wire_type)) {
+      return false;
+    }
+    bool ok = true;
+    uint64_t v = 0;
+    uint32_t f32 = 0;
+    const char* vb = nullptr;
+    const char* ve = nullptr;
+    if ((field == 1) && (wire_type == kWireLengthDelimited)) {  // list
+      ok = r.bytes(&vb, &ve) && ParseAttrList(vb, ve, attr);
+    } else if ((field == 2) && (wire_type == kWireLengthDelimited)) {  // s
+      ok = r.string(&attr->s);
+    } else if ((field == 3) && (wire_type == kWireVarint)) {  // i
+      ok = r.varint(&v);
+      attr->i = int64_t(v);
+    } else if ((field == 4) && (wire_type == kWireFixed32)) {  // f
+      ok = r.fixed32(&f32);
+      attr->f = BitsToFloat(f32);
+    } else if ((field == 5) && (wire_type == kWireVarint)) {  // b
+      ok = r.varint(&v);
+      attr->b = (v != 0);
+    } else if ((field == 6) && (wire_type == kWireVarint)) {  // type
+      ok = r.varint(&v);
+      attr->type = int(v);
+    } else if ((field == 7) && (wire_type == kWireLengthDelimited)) {  // shape
+      ok = r.bytes(&vb, &ve) && ParseTensorShape(vb, ve, &attr->shape);
+    } else if ((field == 8) && (wire_type == kWireLengthDelimited)) {  // tensor
+      ok = r.bytes(&vb, &ve) && ParseTensor(vb, ve, &attr->tensor);
+      attr->has_tensor = ok;
+    } else {
+      ok = r.skip(wire_type);
+    }
+    if (!ok) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ParseNode(const char* b, const char* e, GraphNode* node) {
+  WireReader r(b, e);
+  while (!r.done()) {
+    uint32_t field;
+    int wire_type;
+    if (!r.tag(&field, &wire_type)) {
+      return false;
+    }
+    bool ok = true;
+    if ((field == 1) && (wire_type == kWireLengthDelimited)) {
+      ok = r.string(&node->name);
+    } else if ((field == 2) && (wire_type == kWireLengthDelimited)) {
+      ok = r.string(&node->op);
+    } else if ((field == 3) && (wire_type == kWireLengthDelimited)) {
+      std::string input;
+      ok = r.string(&input);
+      node->inputs.push_back(input);
+    } else if ((field == 5) && (wire_type == kWireLengthDelimited)) {
+      // map<string, AttrValue> entry
+      const char* mb;
+      const char* me;
+      ok = r.bytes(&mb, &me);
+      WireReader mr(mb, me);
+      std::string key;
+      const char* vb = nullptr;
+      const char* ve = nullptr;
+      while (ok && !mr.done()) {
+        uint32_t mfield;
+        int mwire_type;
+        ok = mr.tag(&mfield, &mwire_type);
+        if (!ok) {
+          break;
+        }
+        if ((mfield == 1) && (mwire_type == kWireLengthDelimited)) {
+          ok = mr.string(&key);
+        } else if ((mfield == 2) && (mwire_type == kWireLengthDelimited)) {
+          ok = mr.bytes(&vb, &ve);
+        } else {
+          ok = mr.skip(mwire_type);
+        }
+      }
+      if (ok && vb) {
+        ok = ParseAttrValue(vb, ve, &node->attrs[key]);
+      }
+    } else {
+      ok = r.skip(wire_type);
+    }
+    if (!ok) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // anonymous namespace
+
+size_t GraphTensor::num_elements() const {
+  size_t n = 1;
+  for (size_t i = 0; i < shape.size(); i++) {
+    n *= size_t(std::max(int64_t(0), shape[i]));
+  }
+  return n;
+}
+
+const GraphAttr* GraphNode::attr(const std::string& key) const {
+  std::map<std::string, GraphAttr>::const_iterator it = attrs.find(key);
+  return (it == attrs.end()) ? nullptr : &it->second;
+}
+
+bool ParseGraphDef(const std::string& serialized,
+                   std::vector<GraphNode>* nodes,
+                   std::vector<GraphFieldRange>* node_ranges) {
+  nodes->clear();
+  if (node_ranges) {
+    node_ranges->clear();
+  }
+  WireReader r(serialized.data(), serialized.data() + serialized.size());
+  while (!r.done()) {
+    const char* field_begin = r.position();
+    uint32_t field;
+    int wire_type;
+    if (!r.tag(&field, &wire_type)) {
+      return false;
+    }
+    if ((field == 1) && (wire_type == kWireLengthDelimited)) {  // node
+      const char* b;
+      const char* e;
+      if (!r.bytes(&b, &e)) {
+        return false;
+      }
+      nodes->push_back(GraphNode());
+      if (!ParseNode(b, e, &nodes->back())) {
+        std::cerr << "Failed to parse NodeDef #" << nodes->size() - 1
+                  << std::endl;
+        return false;
+      }
+      if (node_ranges) {
+        GraphFieldRange range;
+        range.offset = size_t(field_begin - serialized.data());
+        range.size = size_t(e - field_begin);
+        node_ranges->push_back(range);
+      }
+    } else if (!r.skip(wire_type)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ReadGraphDef(const std::string& filename, std::vector<GraphNode>* nodes) {
+  std::ifstream ifs(filename.c_str(), std::ios::binary);
+  if (!ifs) {
+    std::cerr << "Failed to open graph file : " << filename << std::endl;
+    return false;
+  }
+  std::stringstream ss;
+  ss << ifs.rdbuf();
+  if (!ParseGraphDef(ss.str(), nodes)) {
+    std::cerr << "Failed to parse graph file : " << filename << std::endl;
+    return false;
+  }
+  return true;
+}
+
+} // namespace prnet
@@ -0,0 +1,88 @@
+#ifndef PRNET_INFER_GRAPH_DEF_READER_H_
+#define PRNET_INFER_GRAPH_DEF_READER_H_
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "half.h"
+
+namespace prnet {
+
+///
+/// Minimal reader of frozen TensorFlow GraphDef(binary protobuf).
+/// Only the fields required for inference are decoded, so that the graph can
+/// be loaded without libprotobuf and TensorFlow runtime.
+///
+
+// Subset of tensorflow::DataType
+enum GraphDataType {
+  kGraphDataTypeInvalid = 0,
+  kGraphDataTypeFloat = 1,
+  kGraphDataTypeInt32 = 3,
+  kGraphDataTypeUInt8 = 4,
+  kGraphDataTypeInt64 = 9,
+  kGraphDataTypeQUInt8 = 12,
+  kGraphDataTypeHalf = 19
+};
+
+struct GraphTensor {
+  int dtype = kGraphDataTypeInvalid;
+  std::vector<int64_t> shape;  // empty = scalar
+  // Elements converted to float. Scalar value is broadcasted to all
+  // elements as TensorFlow does for `float_val` of size 1.
+  std::vector<float> values;
+
+  size_t num_elements() const;
+};
+
+struct GraphAttr {
+  std::string s;
+  int64_t i = 0;
+  float f = 0.0f;
+  bool b = false;
+  int type = kGraphDataTypeInvalid;
+  std::vector<int64_t> shape;  // -1 = unknown dim
+  std::vector<std::string> list_s;
+  std::vector<int64_t> list_i;
+  std::vector<float> list_f;
+  bool has_tensor = false;
+  GraphTensor tensor;
+};
+
+struct GraphNode {
+  std::string name;
+  std::string op;
+  std::vector<std::string> inputs;  // "name", "name:index" or "^name"
+  std::map<std::string, GraphAttr> attrs;
+
+  const GraphAttr* attr(const std::string& key) const;
+};
+
+///
+/// Byte range [offset, offset + size) of a top-level GraphDef field in the
+/// serialized string(including field tag and length).
+///
+struct GraphFieldRange {
+  size_t offset = 0;
+  size_t size = 0;
+};
+
+///
+/// Parse serialized GraphDef.
+/// When `node_ranges` is given, the range of each `node` field is stored so
+/// that a graph can be rewritten without re-encoding untouched nodes.
+///
+bool ParseGraphDef(const std::string& serialized,
+                   std::vector<GraphNode>* nodes,
+                   std::vector<GraphFieldRange>* node_ranges = nullptr);
+
+///
+/// Read binary GraphDef file.
+///
+bool ReadGraphDef(const std::string& filename, std::vector<GraphNode>* nodes);
+
+} // namespace prnet
+
+#endif // PRNET_INFER_GRAPH_DEF_READER_H_
@@ -0,0 +1,135 @@
+#include "graph_def_writer.h"
+
+#include <cmath>
+#include <cstring>
+
+namespace prnet {
+
+namespace {
+
+// Protobuf wire types
+const uint32_t kWireVarint = 0;
+const uint32_t kWireLengthDelimited = 2;
+
+void AppendVarint(uint64_t v, std::string* out) {
+  while (v >= 0x80) {
+    out->push_back(char(uint8_t(v & 0x7f) | 0x80));
+    v >>= 7;
+  }
+  out->push_back(char(uint8_t(v)));
+}
+
+void AppendTag(uint32_t field, uint32_t wire_type, std::string* out) {
+  AppendVarint((uint64_t(field) << 3) | wire_type, out);
+}
+
+void AppendVarintField(uint32_t field, uint64_t v, std::string* out) {
+  AppendTag(field, kWireVarint, out);
+  AppendVarint(v, out);
+}
+
+void AppendBytesField(uint32_t field, const std::string& bytes,
+                      std::string* out) {
+  AppendTag(field, kWireLengthDelimited, out);
+  AppendVarint(bytes.size(), out);
+  out->append(bytes);
+}
+
+std::string EncodeTensorShape(const std::vector<int64_t>& shape) {
+  std::string s;
+  for (size_t i = 0; i < shape.size(); i++) {
+    std::string dim;
+    AppendVarintField(1, uint64_t(shape[i]), &dim);  // size
+    AppendBytesField(2, dim, &s);                    // dim
+  }
+  return s;
+}
+
+} // anonymous namespace
+
+GraphNodeWriter::GraphNodeWriter(const std::string& _name,
+                                 const std::string& _op)
+    : name(_name), op(_op) {}
+
+void GraphNodeWriter::add_input(const std::string& input) {
+  inputs.push_back(input);
+}
+
+void GraphNodeWriter::set_attr_type(const std::string& key, int type) {
+  std::string value;
+  AppendVarintField(6, uint64_t(type), &value);
+  attrs[key] = value;
+}
+
+void GraphNodeWriter::set_attr_int(const std::string& key, int64_t i) {
+  std::string value;
+  AppendVarintField(3, uint64_t(i), &value);
+  attrs[key] = value;
+}
+
+void GraphNodeWriter::set_attr_bool(const std::string& key, bool b) {
+  std::string value;
+  AppendVarintField(5, b ? 1 : 0, &value);
+  attrs[key] = value;
+}
+
+void GraphNodeWriter::set_attr_string(const std::string& key,
+                                      const std::string& s) {
+  std::string value;
+  AppendBytesField(2, s, &value);
+  attrs[key] = value;
+}
+
+void GraphNodeWriter::set_attr_int_list(const std::string& key,
+                                        const std::vector<int64_t>& list) {
+  std::string packed;
+  for (size_t i = 0; i < list.size(); i++) {
+    AppendVarint(uint64_t(list[i]), &packed);
+  }
+  std::string list_value;
+  AppendBytesField(3, packed, &list_value);  // i
+  std::string value;
+  AppendBytesField(1, list_value, &value);
+  attrs[key] = value;
+}
+
+void GraphNodeWriter::set_attr_shape(const std::string& key,
+                                     const std::vector<int64_t>& shape) {
+  std::string value;
+  AppendBytesField(7, EncodeTensorShape(shape), &value);
+  attrs[key] = value;
+}
+
+void GraphNodeWriter::set_attr_tensor(const std::string& key, int dtype,
+                                      const std::vector<int64_t>& shape,
+                                      const std::string& content) {
+  std::string tensor;
+  AppendVarintField(1, uint64_t(dtype), &tensor);          // dtype
+  AppendBytesField(2, EncodeTensorShape(shape), &tensor);  // tensor_shape
+  AppendBytesField(4, content, &tensor);                   // tensor_content
+  std::string value;
+  AppendBytesField(8, tensor, &value);
+  attrs[key] = value;
+}
+
+std::string GraphNodeWriter::serialize_field() const {
+  std::string node;
+  AppendBytesField(1, name, &node);
+  AppendBytesField(2, op, &node);
+  for (size_t i = 0; i < inputs.size(); i++) {
+    AppendBytesField(3, inputs[i], &node);
+  }
+  std::map<std::string, std::string>::const_iterator it;
+  for (it = attrs.begin(); it != attrs.end(); it++) {
+    std::string entry;
+    AppendBytesField(1, it->first, &entry);   // key
+    AppendBytesField(2, it->second, &entry);  // value
+    AppendBytesField(5, entry, &node);
+  }
+
+  std::string field;
+  AppendBytesField(1, node, &field);  // GraphDef.node
+  return field;
+}
+
+} // namespace prnet
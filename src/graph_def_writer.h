@@ -0,0 +1,55 @@
+#ifndef PRNET_INFER_GRAPH_DEF_WRITER_H_
+#define PRNET_INFER_GRAPH_DEF_WRITER_H_
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "half.h"
+
+namespace prnet {
+
+///
+/// Minimal writer of GraphDef NodeDef(binary protobuf). Counterpart of
+/// graph_def_reader.h, used to rewrite frozen graphs without libprotobuf.
+///
+class GraphNodeWriter {
+public:
+  GraphNodeWriter(const std::string& name, const std::string& op);
+
+  void add_input(const std::string& input);
+
+  void set_attr_type(const std::string& key, int type);
+  void set_attr_int(const std::string& key, int64_t i);
+  void set_attr_bool(const std::string& key, bool b);
+  void set_attr_string(const std::string& key, const std::string& s);
+  void set_attr_int_list(const std::string& key,
+                         const std::vector<int64_t>& list);
+  void set_attr_shape(const std::string& key,
+                      const std::vector<int64_t>& shape);
+
+  ///
+  /// Set tensor attr. `content` is `tensor_content`(raw little endian
+  /// elements of `dtype`).
+  ///
+  void set_attr_tensor(const std::string& key, int dtype,
+                       const std::vector<int64_t>& shape,
+                       const std::string& content);
+
+  ///
+  /// Serialized `node` field of GraphDef(field tag + length + NodeDef), which
+  /// can be appended to a serialized GraphDef as is.
+  ///
+  std::string serialize_field() const;
+
+private:
+  std::string name;
+  std::string op;
+  std::vector<std::string> inputs;
+  std::map<std::string, std::string> attrs;  // key -> serialized AttrValue
+};
+
+} // namespace prnet
+
+#endif // PRNET_INFER_GRAPH_DEF_WRITER_H_
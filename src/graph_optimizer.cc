@@ -0,0 +1,729 @@
+#include "graph_optimizer.h"
+
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Weverything"
+#endif
+
+#include "tensorflow/core/framework/attr_value.pb.h"
+#include "tensorflow/core/framework/graph.pb.h"
+#include "tensorflow/core/framework/node_def.pb.h"
+#include "tensorflow/core/framework/op.h"
+#include "tensorflow/core/framework/op_def.pb.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor.pb.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/public/session.h"
+#include "tensorflow/core/public/version.h"
+
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+
+// `_FusedConv2D` CPU kernel is available since r1.13.
+#if (TF_MAJOR_VERSION > 1) || ((TF_MAJOR_VERSION == 1) && (TF_MINOR_VERSION >= 13))
+#define PRNET_TF_HAS_FUSED_CONV2D 1
+#endif
+
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+
+using namespace tensorflow;
+
+namespace prnet {
+
+namespace {
+
+// Increment when optimization passes change. Invalidates cached graphs.
+const char kOptimizerVersion[] = "2";
+
+struct NodeInput {
+  std::string name;
+  int port = 0;
+  bool is_control = false;
+};
+
+// "^name", "name", "name:port"
+NodeInput ParseNodeInput(const std::string& input) {
+  NodeInput ret;
+  std::string s = input;
+  if (!s.empty() && (s[0] == '^')) {
+    ret.is_control = true;
+    s = s.substr(1);
+  }
+  const size_t colon = s.rfind(':');
+  if (colon != std::string::npos) {
+    ret.name = s.substr(0, colon);
+    ret.port = std::stoi(s.substr(colon + 1));
+  } else {
+    ret.name = s;
+  }
+  return ret;
+}
+
+std::string NodeOutputName(const std::string& name, int port) {
+  if (port == 0) {
+    return name;
+  }
+  return name + ":" + std::to_string(port);
+}
+
+typedef std::map<std::string, NodeDef*> NodeMap;
+
+NodeMap BuildNodeMap(GraphDef* graph_def) {
+  NodeMap node_map;
+  for (int i = 0; i < graph_def->node_size(); i++) {
+    NodeDef* node = graph_def->mutable_node(i);
+    node_map[node->name()] = node;
+  }
+  return node_map;
+}
+
+// The number of data inputs which refer to each node.
+std::map<std::string, int> CountConsumers(const GraphDef& graph_def) {
+  std::map<std::string, int> counts;
+  for (int i = 0; i < graph_def.node_size(); i++) {
+    const NodeDef& node = graph_def.node(i);
+    for (int k = 0; k < node.input_size(); k++) {
+      const NodeInput input = ParseNodeInput(node.input(k));
+      if (!input.is_control) {
+        counts[input.name]++;
+      }
+    }
+  }
+  return counts;
+}
+
+// Rewrite all references to `from`(data output `from_port` and control
+// dependency) into `to`.
+void RedirectConsumers(const std::string& from, int from_port,
+                       const std::string& to, GraphDef* graph_def) {
+  for (int i = 0; i < graph_def->node_size(); i++) {
+    NodeDef* node = graph_def->mutable_node(i);
+    for (int k = 0; k < node->input_size(); k++) {
+      const NodeInput input = ParseNodeInput(node->input(k));
+      if (input.name != from) {
+        continue;
+      }
+      if (input.is_control) {
+        node->set_input(k, "^" + ParseNodeInput(to).name);
+      } else if (input.port == from_port) {
+        node->set_input(k, to);
+      }
+    }
+  }
+}
+
+std::string UniqueNodeName(const std::string& base, const NodeMap& node_map) {
+  std::string name = base;
+  int suffix = 1;
+  while (node_map.count(name)) {
+    name = base + "_" + std::to_string(suffix++);
+  }
+  return name;
+}
+
+bool GetConstTensor(const NodeDef* node, Tensor* tensor) {
+  if ((node == nullptr) || (node->op() != "Const")) {
+    return false;
+  }
+  auto it = node->attr().find("value");
+  if (it == node->attr().end()) {
+    return false;
+  }
+  return tensor->FromProto(it->second.tensor());
+}
+
+NodeDef* AddConstNode(const std::string& base_name, const Tensor& tensor,
+                      const std::string& device, NodeMap* node_map,
+                      GraphDef* graph_def) {
+  NodeDef* node = graph_def->add_node();
+  node->set_name(UniqueNodeName(base_name, *node_map));
+  node->set_op("Const");
+  node->set_device(device);
+  (*node->mutable_attr())["dtype"].set_type(tensor.dtype());
+  tensor.AsProtoTensorContent(
+      (*node->mutable_attr())["value"].mutable_tensor());
+  (*node_map)[node->name()] = node;
+  return node;
+}
+
+std::string GetStringAttr(const NodeDef* node, const std::string& key,
+                          const std::string& default_value) {
+  auto it = node->attr().find(key);
+  if (it == node->attr().end()) {
+    return default_value;
+  }
+  return it->second.s();
+}
+
+// Remove nodes which are not required to compute `outputs`.
+void StripUnusedNodes(const std::set<std::string>& inputs,
+                      const std::set<std::string>& outputs,
+                      GraphDef* graph_def) {
+  const NodeMap node_map = BuildNodeMap(graph_def);
+
+  std::set<std::string> required(inputs.begin(), inputs.end());
+  std::vector<std::string> stack(outputs.begin(), outputs.end());
+  while (!stack.empty()) {
+    const std::string name = stack.back();
+    stack.pop_back();
+    if (!required.insert(name).second) {
+      continue;
+    }
+    auto it = node_map.find(name);
+    if (it == node_map.end()) {
+      continue;
+    }
+    const NodeDef* node = it->second;
+    for (int k = 0; k < node->input_size(); k++) {
+      const std::string input_name = ParseNodeInput(node->input(k)).name;
+      if (!required.count(input_name)) {
+        stack.push_back(input_name);
+      }
+    }
+  }
+
+  GraphDef result;
+  *result.mutable_versions() = graph_def->versions();
+  *result.mutable_library() = graph_def->library();
+  for (int i = 0; i < graph_def->node_size(); i++) {
+    if (required.count(graph_def->node(i).name())) {
+      *result.add_node() = graph_def->node(i);
+    }
+  }
+  graph_def->Swap(&result);
+}
+
+// Bypass Identity nodes. Nodes in `protected_names` are kept.
+void RemoveIdentityNodes(const std::set<std::string>& protected_names,
+                         GraphDef* graph_def) {
+  std::map<std::string, std::string> forward;
+  for (int i = 0; i < graph_def->node_size(); i++) {
+    const NodeDef& node = graph_def->node(i);
+    if (((node.op() == "Identity") || (node.op() == "StopGradient")) &&
+        (node.input_size() == 1) && !protected_names.count(node.name()) &&
+        !ParseNodeInput(node.input(0)).is_control) {
+      forward[node.name()] = node.input(0);
+    }
+  }
+
+  for (int i = 0; i < graph_def->node_size(); i++) {
+    NodeDef* node = graph_def->mutable_node(i);
+    for (int k = 0; k < node->input_size(); k++) {
+      NodeInput input = ParseNodeInput(node->input(k));
+      if (!input.is_control && (input.port != 0)) {
+        continue;
+      }
+      // Follow Identity chain.
+      std::string target = node->input(k);
+      bool forwarded = false;
+      while (forward.count(input.name)) {
+        target = forward[input.name];
+        input.name = ParseNodeInput(target).name;
+        forwarded = true;
+      }
+      if (forwarded) {
+        node->set_input(k, input.is_control ? ("^" + input.name) : target);
+      }
+    }
+  }
+}
+
+// Evaluate subgraphs which only depend on constants and replace them with
+// Const nodes.
+bool FoldConstants(GraphDef* graph_def) {
+  const NodeMap node_map = BuildNodeMap(graph_def);
+
+  std::map<std::string, bool> memo;
+  std::function<bool(const std::string&)> is_constant =
+      [&](const std::string& name) {
+        auto memo_it = memo.find(name);
+        if (memo_it != memo.end()) {
+          return memo_it->second;
+        }
+        memo[name] = false;  // guard against cycle
+
+        auto it = node_map.find(name);
+        if (it == node_map.end()) {
+          return false;
+        }
+        const NodeDef* node = it->second;
+        bool result = false;
+        if (node->op() == "Const") {
+          result = true;
+        } else {
+          const OpDef* op_def = nullptr;
+          if (node->input_size() > 0 &&
+              OpRegistry::Global()->LookUpOpDef(node->op(), &op_def).ok() &&
+              !op_def->is_stateful() && (node->op() != "Placeholder") &&
+              (node->op() != "PlaceholderWithDefault")) {
+            result = true;
+            for (int k = 0; k < node->input_size(); k++) {
+              if (!is_constant(ParseNodeInput(node->input(k)).name)) {
+                result = false;
+                break;
+              }
+            }
+          }
+        }
+        memo[name] = result;
+        return result;
+      };
+
+  // Constant outputs consumed by non-constant nodes.
+  std::set<std::string> fetch_set;
+  for (int i = 0; i < graph_def->node_size(); i++) {
+    const NodeDef& node = graph_def->node(i);
+    if (is_constant(node.name())) {
+      continue;
+    }
+    for (int k = 0; k < node.input_size(); k++) {
+      const NodeInput input = ParseNodeInput(node.input(k));
+      if (!input.is_control && is_constant(input.name) &&
+          (node_map.at(input.name)->op() != "Const")) {
+        fetch_set.insert(NodeOutputName(input.name, input.port));
+      }
+    }
+  }
+
+  if (fetch_set.empty()) {
+    return true;
+  }
+
+  const std::vector<std::string> fetch_names(fetch_set.begin(),
+                                             fetch_set.end());
+  std::vector<Tensor> values;
+  {
+    std::unique_ptr<Session> session(NewSession(SessionOptions()));
+    Status status = session->Create(*graph_def);
+    if (status.ok()) {
+      status = session->Run({}, fetch_names, {}, &values);
+    }
+    if (!status.ok()) {
+      std::cerr << "Failed to evaluate constant subgraphs : " << status
+                << std::endl;
+      return false;
+    }
+  }
+
+  NodeMap new_node_map = node_map;
+  for (size_t i = 0; i < fetch_names.size(); i++) {
+    const NodeInput output = ParseNodeInput(fetch_names[i]);
+    const std::string device = node_map.at(output.name)->device();
+    const NodeDef* const_node =
+        AddConstNode(output.name + "/folded", values[i], device,
+                     &new_node_map, graph_def);
+    const std::string const_name = const_node->name();
+
+    // Redirect non-constant consumers.
+    for (int n = 0; n < graph_def->node_size(); n++) {
+      NodeDef* node = graph_def->mutable_node(n);
+      if (memo.count(node->name()) && memo[node->name()]) {
+        continue;
+      }
+      for (int k = 0; k < node->input_size(); k++) {
+        const NodeInput input = ParseNodeInput(node->input(k));
+        if (!input.is_control && (input.name == output.name) &&
+            (input.port == output.port)) {
+          node->set_input(k, const_name);
+        }
+      }
+    }
+  }
+
+  std::cout << "Folded " << fetch_names.size() << " constant subgraphs"
+            << std::endl;
+
+  return true;
+}
+
+bool IsConvOp(const NodeDef* node) {
+  return (node->op() == "Conv2D") || (node->op() == "Conv2DBackpropInput") ||
+         (node->op() == "DepthwiseConv2dNative");
+}
+
+// The number of output channels of convolution op.
+int64 GetConvOutputChannels(const NodeDef* conv, const Tensor& filter) {
+  if (conv->op() == "Conv2D") {
+    return filter.dim_size(3);  // HWIO
+  } else if (conv->op() == "DepthwiseConv2dNative") {
+    return filter.dim_size(2) * filter.dim_size(3);  // H W In Multiplier
+  }
+  // Conv2DBackpropInput(Conv2DTranspose). H W Out In
+  return filter.dim_size(2);
+}
+
+// Output channel index of filter element `i`.
+int64 GetConvFilterChannel(const NodeDef* conv, const Tensor& filter,
+                           int64 i) {
+  if (conv->op() == "Conv2D") {
+    return i % filter.dim_size(3);
+  } else if (conv->op() == "DepthwiseConv2dNative") {
+    return i % (filter.dim_size(2) * filter.dim_size(3));
+  }
+  return (i / filter.dim_size(3)) % filter.dim_size(2);
+}
+
+// Returns convolution node whose output(port 0) is `input`, or nullptr.
+NodeDef* GetFoldableConv(const std::string& input, const NodeMap& node_map,
+                         Tensor* filter) {
+  const NodeInput conv_input = ParseNodeInput(input);
+  if (conv_input.is_control || (conv_input.port != 0)) {
+    return nullptr;
+  }
+  auto it = node_map.find(conv_input.name);
+  if (it == node_map.end() || !IsConvOp(it->second)) {
+    return nullptr;
+  }
+  NodeDef* conv = it->second;
+  if (GetStringAttr(conv, "data_format", "NHWC") != "NHWC") {
+    return nullptr;
+  }
+  auto filter_it = node_map.find(ParseNodeInput(conv->input(1)).name);
+  if ((filter_it == node_map.end()) ||
+      !GetConstTensor(filter_it->second, filter) ||
+      (filter->dtype() != DT_FLOAT) || (filter->dims() != 4)) {
+    return nullptr;
+  }
+  return conv;
+}
+
+// Per-channel values of constant node. Scalar is broadcasted to `channels`.
+bool GetChannelConst(const std::string& input, const NodeMap& node_map,
+                     int64 channels, std::vector<float>* values) {
+  auto it = node_map.find(ParseNodeInput(input).name);
+  Tensor tensor;
+  if ((it == node_map.end()) || !GetConstTensor(it->second, &tensor) ||
+      (tensor.dtype() != DT_FLOAT)) {
+    return false;
+  }
+  // Only the last dim can be greater than 1.
+  for (int d = 0; d + 1 < tensor.dims(); d++) {
+    if (tensor.dim_size(d) != 1) {
+      return false;
+    }
+  }
+  const auto flat = tensor.flat<float>();
+  if (tensor.NumElements() == 1) {
+    values->assign(size_t(channels), flat(0));
+  } else if (tensor.NumElements() == channels) {
+    values->assign(flat.data(), flat.data() + channels);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Multiply filter weights of `conv` by per output channel `multiplier`.
+void ScaleConvFilter(NodeDef* conv, const Tensor& filter,
+                     const std::vector<float>& multiplier, NodeMap* node_map,
+                     GraphDef* graph_def) {
+  Tensor scaled(DT_FLOAT, filter.shape());
+  const auto src = filter.flat<float>();
+  auto dst = scaled.flat<float>();
+  for (int64 i = 0; i < filter.NumElements(); i++) {
+    dst(i) = src(i) * multiplier[size_t(GetConvFilterChannel(conv, filter, i))];
+  }
+  const NodeDef* filter_node = node_map->at(ParseNodeInput(conv->input(1)).name);
+  const NodeDef* new_filter =
+      AddConstNode(conv->name() + "/folded_filter", scaled,
+                   filter_node->device(), node_map, graph_def);
+  conv->set_input(1, new_filter->name());
+}
+
+// Turn `node` into BiasAdd(input, bias).
+void SetBiasAddNode(const std::string& input, const std::vector<float>& bias,
+                    NodeDef* node, NodeMap* node_map, GraphDef* graph_def) {
+  Tensor bias_tensor(DT_FLOAT, TensorShape({int64(bias.size())}));
+  std::copy(bias.begin(), bias.end(), bias_tensor.flat<float>().data());
+  const NodeDef* bias_node =
+      AddConstNode(node->name() + "/folded_bias", bias_tensor, node->device(),
+                   node_map, graph_def);
+
+  const std::string name = node->name();
+  const std::string device = node->device();
+  node->Clear();
+  node->set_name(name);
+  node->set_op("BiasAdd");
+  node->set_device(device);
+  node->add_input(input);
+  node->add_input(bias_node->name());
+  (*node->mutable_attr())["T"].set_type(DT_FLOAT);
+  (*node->mutable_attr())["data_format"].set_s("NHWC");
+}
+
+// Fold a BatchNorm(or Mul/Add after constant folding) into preceding
+// convolution. Returns true when the graph is modified.
+bool FoldBatchNormOnce(const std::set<std::string>& protected_names,
+                       GraphDef* graph_def) {
+  NodeMap node_map = BuildNodeMap(graph_def);
+  std::map<std::string, int> consumers = CountConsumers(*graph_def);
+
+  for (int i = 0; i < graph_def->node_size(); i++) {
+    NodeDef* node = graph_def->mutable_node(i);
+    Tensor filter;
+
+    // V2/V3(TensorFlow 1.13 or later) have the same inputs and `y` output.
+    if ((node->op() == "FusedBatchNorm") ||
+        (node->op() == "FusedBatchNormV2") ||
+        (node->op() == "FusedBatchNormV3")) {
+      auto training_it = node->attr().find("is_training");
+      if ((training_it != node->attr().end()) && training_it->second.b()) {
+        continue;
+      }
+      NodeDef* conv = GetFoldableConv(node->input(0), node_map, &filter);
+      if (!conv || (consumers[conv->name()] != 1)) {
+        continue;
+      }
+      // Only `y`(port 0) can be used.
+      bool uses_other_outputs = false;
+      for (int n = 0; n < graph_def->node_size(); n++) {
+        for (int k = 0; k < graph_def->node(n).input_size(); k++) {
+          const NodeInput input = ParseNodeInput(graph_def->node(n).input(k));
+          if ((input.name == node->name()) && !input.is_control &&
+              (input.port != 0)) {
+            uses_other_outputs = true;
+          }
+        }
+      }
+      if (uses_other_outputs) {
+        continue;
+      }
+
+      const int64 channels = GetConvOutputChannels(conv, filter);
+      std::vector<float> scale, offset, mean, variance;
+      if (!GetChannelConst(node->input(1), node_map, channels, &scale) ||
+          !GetChannelConst(node->input(2), node_map, channels, &offset) ||
+          !GetChannelConst(node->input(3), node_map, channels, &mean) ||
+          !GetChannelConst(node->input(4), node_map, channels, &variance)) {
+        continue;
+      }
+      auto epsilon_it = node->attr().find("epsilon");
+      const float epsilon =
+          (epsilon_it != node->attr().end()) ? epsilon_it->second.f() : 0.0001f;
+
+      std::vector<float> multiplier(size_t(channels)), bias(size_t(channels));
+      for (size_t c = 0; c < size_t(channels); c++) {
+        multiplier[c] = scale[c] / std::sqrt(variance[c] + epsilon);
+        bias[c] = offset[c] - mean[c] * multiplier[c];
+      }
+
+      ScaleConvFilter(conv, filter, multiplier, &node_map, graph_def);
+      SetBiasAddNode(conv->name(), bias, node, &node_map, graph_def);
+      return true;
+
+    } else if (node->op() == "Mul") {
+      if (protected_names.count(node->name())) {
+        continue;
+      }
+      for (int k = 0; k < 2; k++) {
+        NodeDef* conv = GetFoldableConv(node->input(k), node_map, &filter);
+        if (!conv || (consumers[conv->name()] != 1)) {
+          continue;
+        }
+        std::vector<float> multiplier;
+        if (!GetChannelConst(node->input(1 - k), node_map,
+                             GetConvOutputChannels(conv, filter),
+                             &multiplier)) {
+          continue;
+        }
+        ScaleConvFilter(conv, filter, multiplier, &node_map, graph_def);
+        RedirectConsumers(node->name(), 0, conv->name(), graph_def);
+        return true;
+      }
+
+    } else if ((node->op() == "Add") || (node->op() == "AddV2")) {
+      for (int k = 0; k < 2; k++) {
+        NodeDef* conv = GetFoldableConv(node->input(k), node_map, &filter);
+        if (!conv) {
+          continue;
+        }
+        std::vector<float> bias;
+        if (!GetChannelConst(node->input(1 - k), node_map,
+                             GetConvOutputChannels(conv, filter), &bias)) {
+          continue;
+        }
+        SetBiasAddNode(conv->name(), bias, node, &node_map, graph_def);
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+// Conv2D + BiasAdd + Relu -> _FusedConv2D
+int FuseConvBiasRelu(const std::set<std::string>& protected_names,
+                     GraphDef* graph_def) {
+  int n_fused = 0;
+#ifdef PRNET_TF_HAS_FUSED_CONV2D
+  NodeMap node_map = BuildNodeMap(graph_def);
+  std::map<std::string, int> consumers = CountConsumers(*graph_def);
+
+  for (int i = 0; i < graph_def->node_size(); i++) {
+    NodeDef* relu = graph_def->mutable_node(i);
+    if (relu->op() != "Relu") {
+      continue;
+    }
+    const NodeInput bias_input = ParseNodeInput(relu->input(0));
+    auto bias_it = node_map.find(bias_input.name);
+    if ((bias_input.port != 0) || (bias_it == node_map.end()) ||
+        (bias_it->second->op() != "BiasAdd") ||
+        (consumers[bias_input.name] != 1) ||
+        protected_names.count(bias_input.name)) {
+      continue;
+    }
+    const NodeDef* bias_add = bias_it->second;
+    const NodeInput conv_input = ParseNodeInput(bias_add->input(0));
+    auto conv_it = node_map.find(conv_input.name);
+    if ((conv_input.port != 0) || (conv_it == node_map.end()) ||
+        (conv_it->second->op() != "Conv2D") ||
+        (consumers[conv_input.name] != 1) ||
+        protected_names.count(conv_input.name)) {
+      continue;
+    }
+    const NodeDef* conv = conv_it->second;
+
+    NodeDef fused;
+    fused.set_name(relu->name());
+    fused.set_op("_FusedConv2D");
+    fused.set_device(relu->device());
+    fused.add_input(conv->input(0));
+    fused.add_input(conv->input(1));
+    fused.add_input(bias_add->input(1));
+    *fused.mutable_attr() = conv->attr();
+    (*fused.mutable_attr())["num_args"].set_i(1);
+    AttrValue::ListValue* fused_ops =
+        (*fused.mutable_attr())["fused_ops"].mutable_list();
+    fused_ops->add_s("BiasAdd");
+    fused_ops->add_s("Relu");
+    *relu = fused;
+    n_fused++;
+  }
+#else
+  (void)protected_names;
+  (void)graph_def;
+#endif
+  return n_fused;
+}
+
+uint64_t HashString(const std::string& s, uint64_t hash) {
+  // FNV-1a
+  for (size_t i = 0; i < s.size(); i++) {
+    hash ^= uint64_t(static_cast<unsigned char>(s[i]));
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+} // anonymous namespace
+
+bool OptimizeGraph(const std::vector<std::string>& inputs,
+                   const std::vector<std::string>& outputs,
+                   tensorflow::GraphDef* graph_def) {
+  std::set<std::string> input_names, output_names;
+  for (size_t i = 0; i < inputs.size(); i++) {
+    input_names.insert(ParseNodeInput(inputs[i]).name);
+  }
+  for (size_t i = 0; i < outputs.size(); i++) {
+    output_names.insert(ParseNodeInput(outputs[i]).name);
+  }
+  std::set<std::string> protected_names(input_names);
+  protected_names.insert(output_names.begin(), output_names.end());
+
+  const int n_nodes_org = graph_def->node_size();
+
+  StripUnusedNodes(input_names, output_names, graph_def);
+  RemoveIdentityNodes(protected_names, graph_def);
+  StripUnusedNodes(input_names, output_names, graph_def);
+
+  if (!FoldConstants(graph_def)) {
+    return false;
+  }
+  StripUnusedNodes(input_names, output_names, graph_def);
+
+  int n_folded = 0;
+  while (FoldBatchNormOnce(protected_names, graph_def)) {
+    n_folded++;
+  }
+  StripUnusedNodes(input_names, output_names, graph_def);
+
+  const int n_fused = FuseConvBiasRelu(protected_names, graph_def);
+  StripUnusedNodes(input_names, output_names, graph_def);
+
+  std::cout << "Optimized graph: " << n_nodes_org << " nodes -> "
+            << graph_def->node_size() << " nodes(folded " << n_folded
+            << " batch norm ops, fused " << n_fused << " conv+bias+relu)"
+            << std::endl;
+
+  return true;
+}
+
+bool LoadOptimizedGraph(const std::string& graph_filename,
+                        const std::vector<std::string>& inputs,
+                        const std::vector<std::string>& outputs,
+                        tensorflow::GraphDef* graph_def) {
+  std::string content;
+  Status status =
+      ReadFileToString(Env::Default(), graph_filename, &content);
+  if (!status.ok()) {
+    std::cerr << "Failed to read graph : " << status << std::endl;
+    return false;
+  }
+
+  // Cache key = graph content + optimizer version + inputs/outputs
+  uint64_t hash = 14695981039346656037ULL;
+  hash = HashString(content, hash);
+  hash = HashString(kOptimizerVersion, hash);
+  for (size_t i = 0; i < inputs.size(); i++) {
+    hash = HashString("i:" + inputs[i], hash);
+  }
+  for (size_t i = 0; i < outputs.size(); i++) {
+    hash = HashString("o:" + outputs[i], hash);
+  }
+  content.clear();
+  content.shrink_to_fit();
+
+  std::stringstream ss;
+  ss << graph_filename << ".opt-" << std::hex << std::setw(16)
+     << std::setfill('0') << hash << ".pb";
+  const std::string cache_filename = ss.str();
+
+  if (Env::Default()->FileExists(cache_filename).ok() &&
+      ReadBinaryProto(Env::Default(), cache_filename, graph_def).ok()) {
+    std::cout << "Loaded optimized graph from cache : " << cache_filename
+              << std::endl;
+    return true;
+  }
+
+  status = ReadBinaryProto(Env::Default(), graph_filename, graph_def);
+  if (!status.ok()) {
+    std::cerr << "Failed to load compute graph : " << status << std::endl;
+    return false;
+  }
+
+  if (!OptimizeGraph(inputs, outputs, graph_def)) {
+    return false;
+  }
+
+  status = WriteBinaryProto(Env::Default(), cache_filename, *graph_def);
+  if (!status.ok()) {
+    // Not fatal. Optimize again at next load.
+    std::cerr << "Failed to write optimized graph cache : " << status
+              << std::endl;
+  } else {
+    std::cout << "Wrote optimized graph cache : " << cache_filename
+              << std::endl;
+  }
+
+  return true;
+}
+
+} // namespace prnet
@@ -0,0 +1,39 @@
+#ifndef PRNET_INFER_GRAPH_OPTIMIZER_H_
+#define PRNET_INFER_GRAPH_OPTIMIZER_H_
+
+#include <string>
+#include <vector>
+
+namespace tensorflow {
+class GraphDef;
+} // namespace tensorflow
+
+namespace prnet {
+
+///
+/// Optimize frozen graph for inference.
+///
+///  - Strip nodes not required to compute `outputs`(e.g. training nodes)
+///  - Remove Identity nodes
+///  - Fold constant subgraphs
+///  - Fold BatchNorm(FusedBatchNorm{,V2,V3}, or Mul + Add after constant
+///    folding) into the weights of preceding Conv2D/Conv2DTranspose
+///  - Fuse Conv2D + BiasAdd + Relu(TensorFlow r1.13 or later)
+///
+bool OptimizeGraph(const std::vector<std::string>& inputs,
+                   const std::vector<std::string>& outputs,
+                   tensorflow::GraphDef* graph_def);
+
+///
+/// Load frozen graph and optimize it with OptimizeGraph().
+/// Optimized graph is cached as `<graph_filename>.opt-<hash>.pb`, where the
+/// hash is computed from the content of the original graph file.
+///
+bool LoadOptimizedGraph(const std::string& graph_filename,
+                        const std::vector<std::string>& inputs,
+                        const std::vector<std::string>& outputs,
+                        tensorflow::GraphDef* graph_def);
+
+} // namespace prnet
+
+#endif // PRNET_INFER_GRAPH_OPTIMIZER_H_
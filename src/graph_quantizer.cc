@@ -0,0 +1,297 @@
+#include "graph_quantizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include "graph_def_reader.h"
+#include "graph_def_writer.h"
+
+namespace prnet {
+
+namespace {
+
+// Result of FindWeightAxis()
+const int kPerTensor = -1;  // Consumers disagree on the output channel axis.
+const int kNotWeight = -2;  // Used by other than filter inputs.
+
+typedef std::map<std::string, std::vector<std::pair<size_t, size_t>>>
+    ConsumerMap;  // node name -> (consumer node index, input slot)
+
+ConsumerMap BuildConsumerMap(const std::vector<GraphNode>& nodes) {
+  ConsumerMap consumers;
+  for (size_t i = 0; i < nodes.size(); i++) {
+    for (size_t slot = 0; slot < nodes[i].inputs.size(); slot++) {
+      std::string input = nodes[i].inputs[slot];
+      if (!input.empty() && (input[0] == '^')) {
+        input = input.substr(1);  // Control dependency
+      } else {
+        const size_t colon = input.rfind(':');
+        if (colon != std::string::npos) {
+          input = input.substr(0, colon);
+        }
+      }
+      consumers[input].push_back(std::make_pair(i, slot));
+    }
+  }
+  return consumers;
+}
+
+// Output channel axis of weight tensor `name`, following Identity nodes.
+int FindWeightAxis(const std::string& name, const std::vector<GraphNode>& nodes,
+                   const ConsumerMap& consumers) {
+  ConsumerMap::const_iterator it = consumers.find(name);
+  if (it == consumers.end()) {
+    return kNotWeight;
+  }
+  bool found = false;
+  int axis = kNotWeight;
+  for (size_t i = 0; i < it->second.size(); i++) {
+    const GraphNode& node = nodes[it->second[i].first];
+    const size_t slot = it->second[i].second;
+    int a = kNotWeight;
+    if ((node.op == "Identity") || (node.op == "Snapshot") ||
+        (node.op == "StopGradient")) {
+      a = FindWeightAxis(node.name, nodes, consumers);
+    } else if (((node.op == "Conv2D") || (node.op == "_FusedConv2D")) &&
+               (slot == 1)) {
+      a = 3;  // HWIO
+    } else if ((node.op == "Conv2DBackpropInput") && (slot == 1)) {
+      a = 2;  // [kh][kw][out][in]
+    } else if ((node.op == "MatMul") && (slot == 1)) {
+      const GraphAttr* transpose_b = node.attr("transpose_b");
+      a = (transpose_b && transpose_b->b) ? 0 : 1;
+    }
+    if (a == kNotWeight) {
+      return kNotWeight;
+    }
+    if (!found) {
+      axis = a;
+      found = true;
+    } else if (axis != a) {
+      axis = kPerTensor;
+    }
+  }
+  return axis;
+}
+
+void AppendFloats(const std::vector<float>& values, std::string* out) {
+  const size_t offset = out->size();
+  out->resize(offset + values.size() * 4);
+  std::memcpy(&(*out)[offset], values.data(), values.size() * 4);
+}
+
+std::string ConstNodeField(const std::string& name, int dtype,
+                           const std::vector<int64_t>& shape,
+                           const std::string& content) {
+  GraphNodeWriter node(name, "Const");
+  node.set_attr_type("dtype", dtype);
+  node.set_attr_tensor("value", dtype, shape, content);
+  return node.serialize_field();
+}
+
+std::string CastNodeField(const std::string& name, const std::string& input,
+                          int src_type) {
+  GraphNodeWriter node(name, "Cast");
+  node.add_input(input);
+  node.set_attr_type("SrcT", src_type);
+  node.set_attr_type("DstT", kGraphDataTypeFloat);
+  return node.serialize_field();
+}
+
+std::string BinaryNodeField(const std::string& name, const std::string& op,
+                            const std::string& a, const std::string& b) {
+  GraphNodeWriter node(name, op);
+  node.add_input(a);
+  node.add_input(b);
+  node.set_attr_type("T", kGraphDataTypeFloat);
+  return node.serialize_field();
+}
+
+std::string QuantizeHalf(const std::string& name, const GraphTensor& weight,
+                         QuantizeStats* stats) {
+  std::string content(weight.values.size() * 2, '\0');
+  for (size_t i = 0; i < weight.values.size(); i++) {
+    const uint16_t h = FloatToHalf(weight.values[i]);
+    std::memcpy(&content[i * 2], &h, 2);
+    stats->max_abs_error = std::max(
+        stats->max_abs_error, std::fabs(weight.values[i] - HalfToFloat(h)));
+  }
+  stats->quantized_bytes += content.size();
+
+  return ConstNodeField(name + "/half", kGraphDataTypeHalf, weight.shape,
+                        content) +
+         CastNodeField(name, name + "/half", kGraphDataTypeHalf);
+}
+
+//
+// w = float(q) * scale[c] + min[c], q in [0, 255], c = output channel.
+//
+std::string QuantizeInt8(const std::string& name, const GraphTensor& weight,
+                         int axis, QuantizeStats* stats) {
+  const size_t rank = weight.shape.size();
+  size_t outer = 1;
+  size_t n_channels = 1;
+  size_t inner = weight.values.size();
+  std::vector<int64_t> param_shape;  // scalar for per-tensor range
+  if ((axis >= 0) && (size_t(axis) < rank)) {
+    outer = 1;
+    inner = 1;
+    for (size_t d = 0; d < size_t(axis); d++) {
+      outer *= size_t(weight.shape[d]);
+    }
+    for (size_t d = size_t(axis) + 1; d < rank; d++) {
+      inner *= size_t(weight.shape[d]);
+    }
+    n_channels = size_t(weight.shape[size_t(axis)]);
+    // Broadcasts against the weight from the trailing dims.
+    param_shape.assign(rank - size_t(axis), 1);
+    param_shape[0] = int64_t(n_channels);
+  }
+
+  std::vector<float> mins(n_channels, 0.0f);
+  std::vector<float> maxs(n_channels, 0.0f);
+  std::vector<bool> initialized(n_channels, false);
+  for (size_t o = 0; o < outer; o++) {
+    for (size_t c = 0; c < n_channels; c++) {
+      for (size_t i = 0; i < inner; i++) {
+        const float w = weight.values[(o * n_channels + c) * inner + i];
+        if (!initialized[c]) {
+          mins[c] = maxs[c] = w;
+          initialized[c] = true;
+        }
+        mins[c] = std::min(mins[c], w);
+        maxs[c] = std::max(maxs[c], w);
+      }
+    }
+  }
+
+  std::vector<float> scales(n_channels);
+  for (size_t c = 0; c < n_channels; c++) {
+    scales[c] = (maxs[c] > mins[c]) ? (maxs[c] - mins[c]) / 255.0f : 1.0f;
+  }
+
+  std::string content(weight.values.size(), '\0');
+  for (size_t o = 0; o < outer; o++) {
+    for (size_t c = 0; c < n_channels; c++) {
+      for (size_t i = 0; i < inner; i++) {
+        const size_t idx = (o * n_channels + c) * inner + i;
+        const float w = weight.values[idx];
+        const float q = std::min(
+            255.0f, std::max(0.0f, std::round((w - mins[c]) / scales[c])));
+        content[idx] = char(uint8_t(q));
+        stats->max_abs_error = std::max(
+            stats->max_abs_error, std::fabs(w - (q * scales[c] + mins[c])));
+      }
+    }
+  }
+
+  std::string scale_content;
+  std::string min_content;
+  AppendFloats(scales, &scale_content);
+  AppendFloats(mins, &min_content);
+  stats->quantized_bytes +=
+      content.size() + scale_content.size() + min_content.size();
+
+  return ConstNodeField(name + "/quantized", kGraphDataTypeUInt8, weight.shape,
+                        content) +
+         ConstNodeField(name + "/scale", kGraphDataTypeFloat, param_shape,
+                        scale_content) +
+         ConstNodeField(name + "/min", kGraphDataTypeFloat, param_shape,
+                        min_content) +
+         CastNodeField(name + "/dequantize", name + "/quantized",
+                       kGraphDataTypeUInt8) +
+         BinaryNodeField(name + "/dequantize/mul", "Mul", name + "/dequantize",
+                         name + "/scale") +
+         BinaryNodeField(name, "Add", name + "/dequantize/mul", name + "/min");
+}
+
+} // anonymous namespace
+
+bool QuantizeGraph(const std::string& serialized,
+                   const QuantizeOptions& options, std::string* quantized,
+                   QuantizeStats* stats) {
+  std::vector<GraphNode> nodes;
+  std::vector<GraphFieldRange> ranges;
+  if (!ParseGraphDef(serialized, &nodes, &ranges)) {
+    return false;
+  }
+
+  const ConsumerMap consumers = BuildConsumerMap(nodes);
+
+  *stats = QuantizeStats();
+  quantized->clear();
+  size_t copied = 0;  // serialized[0, copied) is already emitted.
+  for (size_t i = 0; i < nodes.size(); i++) {
+    const GraphNode& node = nodes[i];
+    if (node.op != "Const") {
+      continue;
+    }
+    const GraphAttr* value = node.attr("value");
+    if (!value || !value->has_tensor ||
+        (value->tensor.dtype != kGraphDataTypeFloat) ||
+        (value->tensor.values.size() < options.min_elements)) {
+      continue;
+    }
+    const int axis = FindWeightAxis(node.name, nodes, consumers);
+    if (axis == kNotWeight) {
+      continue;
+    }
+
+    // Copy fields before this node as is and replace the node.
+    quantized->append(serialized, copied, ranges[i].offset - copied);
+    copied = ranges[i].offset + ranges[i].size;
+    if (options.precision == kWeightPrecisionHalf) {
+      quantized->append(QuantizeHalf(node.name, value->tensor, stats));
+    } else {
+      quantized->append(QuantizeInt8(
+          node.name, value->tensor, options.per_channel ? axis : kPerTensor,
+          stats));
+    }
+    stats->n_quantized++;
+    stats->float_bytes += value->tensor.values.size() * 4;
+  }
+  quantized->append(serialized, copied, std::string::npos);
+
+  return true;
+}
+
+bool QuantizeGraphFile(const std::string& input_filename,
+                       const std::string& output_filename,
+                       const QuantizeOptions& options, QuantizeStats* stats) {
+  std::ifstream ifs(input_filename.c_str(), std::ios::binary);
+  if (!ifs) {
+    std::cerr << "Failed to open graph file : " << input_filename << std::endl;
+    return false;
+  }
+  std::stringstream ss;
+  ss << ifs.rdbuf();
+
+  std::string quantized;
+  if (!QuantizeGraph(ss.str(), options, &quantized, stats)) {
+    std::cerr << "Failed to quantize graph : " << input_filename << std::endl;
+    return false;
+  }
+
+  std::ofstream ofs(output_filename.c_str(), std::ios::binary);
+  if (!ofs) {
+    std::cerr << "Failed to open file to write : " << output_filename
+              << std::endl;
+    return false;
+  }
+  ofs.write(quantized.data(), std::streamsize(quantized.size()));
+  if (!ofs) {
+    std::cerr << "Failed to write graph : " << output_filename << std::endl;
+    return false;
+  }
+  return true;
+}
+
+} // namespace prnet
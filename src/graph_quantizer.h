@@ -0,0 +1,59 @@
+#ifndef PRNET_INFER_GRAPH_QUANTIZER_H_
+#define PRNET_INFER_GRAPH_QUANTIZER_H_
+
+#include <cstddef>
+#include <string>
+
+namespace prnet {
+
+///
+/// Storage precision of convolution weights.
+///
+enum WeightPrecision {
+  kWeightPrecisionHalf,  // IEEE 754 half(2 bytes/weight)
+  kWeightPrecisionInt8   // 8-bit affine quantization(1 byte/weight)
+};
+
+struct QuantizeOptions {
+  WeightPrecision precision = kWeightPrecisionInt8;
+
+  // Use a range per output channel for int8. Otherwise one range per tensor.
+  bool per_channel = true;
+
+  // Constants smaller than this are kept in float(biases, batch norm params).
+  size_t min_elements = 1024;
+};
+
+struct QuantizeStats {
+  size_t n_quantized = 0;      // The number of quantized weight tensors
+  size_t float_bytes = 0;      // Size of those weights in float
+  size_t quantized_bytes = 0;  // Size of those weights after quantization
+  float max_abs_error = 0.0f;  // Max rounding error of a weight
+};
+
+///
+/// Rewrite frozen GraphDef so that convolution weights are stored in reduced
+/// precision.
+///
+/// Each weight `Const` node `<w>` feeding Conv2D, _FusedConv2D,
+/// Conv2DBackpropInput or MatMul(directly or through Identity) is replaced
+/// with a subgraph that dequantizes it to float at run time:
+///
+///   int8 : Const(uint8) `<w>/quantized` -> Cast -> Mul(`<w>/scale`)
+///          -> Add(`<w>/min`) named `<w>`
+///   half : Const(half) `<w>/half` -> Cast named `<w>`
+///
+/// Consumers still see float `<w>`, so the graph runs on stock TensorFlow
+/// and on NativePredictor. Other nodes are copied byte by byte.
+///
+bool QuantizeGraph(const std::string& serialized,
+                   const QuantizeOptions& options, std::string* quantized,
+                   QuantizeStats* stats);
+
+bool QuantizeGraphFile(const std::string& input_filename,
+                       const std::string& output_filename,
+                       const QuantizeOptions& options, QuantizeStats* stats);
+
+} // namespace prnet
+
+#endif // PRNET_INFER_GRAPH_QUANTIZER_H_
@@ -33,16 +33,15 @@ THE SOFTWARE.
 
 #include "render.h"
 
-#include <atomic>
 #include <chrono>  // C++11
 #include <sstream>
-#include <thread>  // C++11
 #include <vector>
 
 #include <iostream>
 
 #include "matrix.h"
 #include "nanort.h"
+#include "thread_pool.h"
 
 #include "trackball.h"
 
@@ -244,13 +243,13 @@ bool Renderer::BuildBVH() {
   auto t_start = std::chrono::system_clock::now();
 
   nanort::TriangleMesh<float> triangle_mesh(
-      mesh_.vertices.data(), mesh_.faces.data(), sizeof(float) * 3);
+      mesh_->vertices.data(), mesh_->faces.data(), sizeof(float) * 3);
   nanort::TriangleSAHPred<float> triangle_pred(
-      mesh_.vertices.data(), mesh_.faces.data(), sizeof(float) * 3);
+      mesh_->vertices.data(), mesh_->faces.data(), sizeof(float) * 3);
 
-  printf("num_triangles = %lu\n", mesh_.faces.size() / 3);
+  printf("num_triangles = %lu\n", mesh_->faces.size() / 3);
 
-  bool ret = gAccel.Build(uint32_t(mesh_.faces.size() / 3), triangle_mesh, triangle_pred,
+  bool ret = gAccel.Build(uint32_t(mesh_->faces.size() / 3), triangle_mesh, triangle_pred,
                           build_options);
   assert(ret);
 
@@ -279,6 +278,12 @@ bool Renderer::Render(RenderBuffer* buffer, float quat[4],
     return false;
   }
 
+  // Hold references to the mesh and the image for the pass. Render() reads
+  // them and the BVH without locking, so SetMesh()/SetImage()/BuildBVH() must
+  // not run concurrently with it(ui.cc serializes them with a mutex).
+  const std::shared_ptr<const prnet::Mesh> mesh = mesh_;
+  const std::shared_ptr<const prnet::Image<float>> image = image_;
+
   int width = config.width;
   int height = config.height;
 
@@ -292,172 +297,160 @@ bool Renderer::Render(RenderBuffer* buffer, float quat[4],
                    height);
 
 
-  std::vector<std::thread> workers;
-  std::atomic<int> i(0);
-
-  uint32_t num_threads = std::max(1U, std::thread::hardware_concurrency());
-
-  // Initialize RNG.
-
-  for (uint64_t t = 0; t < uint64_t(num_threads); t++) {
-    workers.emplace_back(std::thread([&, t]() {
+  // Rows are rendered on the shared thread pool. RNG is seeded per row so
+  // that the result does not depend on scheduling.
+  prnet::ParallelFor(size_t(config.height), [&](size_t y_begin, size_t y_end) {
+    for (size_t row = y_begin; row < y_end; row++) {
+      const int y = int(row);
       pcg32_state_t rng;
       pcg32_srandom(&rng, static_cast<unsigned long long>(config.pass),
-                    t);  // seed = combination of render pass + thread no.
-
-      int y = 0;
-      while ((y = i++) < config.height) {
-
-        for (int x = 0; x < config.width; x++) {
-          nanort::Ray<float> ray;
-          ray.org[0] = origin[0];
-          ray.org[1] = origin[1];
-          ray.org[2] = origin[2];
-
-          float u0 = pcg32_random(&rng);
-          float u1 = pcg32_random(&rng);
+                    row);  // seed = combination of render pass + row.
+
+      for (int x = 0; x < config.width; x++) {
+        nanort::Ray<float> ray;
+        ray.org[0] = origin[0];
+        ray.org[1] = origin[1];
+        ray.org[2] = origin[2];
+
+        float u0 = pcg32_random(&rng);
+        float u1 = pcg32_random(&rng);
+
+        float3 dir;
+        // dir = corner + (float(x) + u0) * u +
+        //      (float(config.height - y - 1) + u1) * v;
+        dir = corner + (float(x) + u0) * u + (float(y) + u1) * v;
+        dir = vnormalize(dir);
+        ray.dir[0] = dir[0];
+        ray.dir[1] = dir[1];
+        ray.dir[2] = dir[2];
+
+        float kFar = 1.0e+30f;
+        ray.min_t = 0.0f;
+        ray.max_t = kFar;
+
+        size_t pidx = size_t(y * config.width + x);
+
+        // clear pixel
+        {
+          buffer->rgba[4 * pidx + 0] = 0.0f;
+          buffer->rgba[4 * pidx + 1] = 0.0f;
+          buffer->rgba[4 * pidx + 2] = 0.0f;
+          buffer->rgba[4 * pidx + 3] = 0.0f;
+
+          buffer->normal[4 * pidx + 0] = 0.0f;
+          buffer->normal[4 * pidx + 1] = 0.0f;
+          buffer->normal[4 * pidx + 2] = 0.0f;
+          buffer->normal[4 * pidx + 3] = 0.0f;
+          buffer->position[4 * pidx + 0] = 0.0f;
+          buffer->position[4 * pidx + 1] = 0.0f;
+          buffer->position[4 * pidx + 2] = 0.0f;
+          buffer->position[4 * pidx + 3] = 0.0f;
+          buffer->depth[4 * pidx + 0] = 1000.0f;
+          buffer->depth[4 * pidx + 1] = 1000.0f;
+          buffer->depth[4 * pidx + 2] = 1000.0f;
+          buffer->depth[4 * pidx + 3] = 1000.0f;
+          buffer->texcoord[4 * pidx + 0] = 0.0f;
+          buffer->texcoord[4 * pidx + 1] = 0.0f;
+          buffer->texcoord[4 * pidx + 2] = 0.0f;
+          buffer->texcoord[4 * pidx + 3] = 0.0f;
+          buffer->diffuse[4 * pidx + 0] = 0.0f;
+          buffer->diffuse[4 * pidx + 1] = 0.0f;
+          buffer->diffuse[4 * pidx + 2] = 0.0f;
+          buffer->diffuse[4 * pidx + 3] = 0.0f;
+        }
 
-          float3 dir;
-          // dir = corner + (float(x) + u0) * u +
-          //      (float(config.height - y - 1) + u1) * v;
-          dir = corner + (float(x) + u0) * u + (float(y) + u1) * v;
-          dir = vnormalize(dir);
-          ray.dir[0] = dir[0];
-          ray.dir[1] = dir[1];
-          ray.dir[2] = dir[2];
+        nanort::TriangleIntersector<> triangle_intersector(
+            mesh->vertices.data(), mesh->faces.data(), sizeof(float) * 3);
+        nanort::TriangleIntersection<float> isect;
+        bool hit = gAccel.Traverse(ray, triangle_intersector, &isect);
+        if (hit) {
+          float3 p;
+          p[0] = ray.org[0] + isect.t * ray.dir[0];
+          p[1] = ray.org[1] + isect.t * ray.dir[1];
+          p[2] = ray.org[2] + isect.t * ray.dir[2];
 
-          float kFar = 1.0e+30f;
-          ray.min_t = 0.0f;
-          ray.max_t = kFar;
+          buffer->position[4 * pidx + 0] = p.x();
+          buffer->position[4 * pidx + 1] = p.y();
+          buffer->position[4 * pidx + 2] = p.z();
+          buffer->position[4 * pidx + 3] = 1.0f;
 
-          size_t pidx = size_t(y * config.width + x);
+          unsigned int prim_id = isect.prim_id;
 
-          // clear pixel
+          float3 N;
           {
-            buffer->rgba[4 * pidx + 0] = 0.0f;
-            buffer->rgba[4 * pidx + 1] = 0.0f;
-            buffer->rgba[4 * pidx + 2] = 0.0f;
-            buffer->rgba[4 * pidx + 3] = 0.0f;
-
-            buffer->normal[4 * pidx + 0] = 0.0f;
-            buffer->normal[4 * pidx + 1] = 0.0f;
-            buffer->normal[4 * pidx + 2] = 0.0f;
-            buffer->normal[4 * pidx + 3] = 0.0f;
-            buffer->position[4 * pidx + 0] = 0.0f;
-            buffer->position[4 * pidx + 1] = 0.0f;
-            buffer->position[4 * pidx + 2] = 0.0f;
-            buffer->position[4 * pidx + 3] = 0.0f;
-            buffer->depth[4 * pidx + 0] = 1000.0f;
-            buffer->depth[4 * pidx + 1] = 1000.0f;
-            buffer->depth[4 * pidx + 2] = 1000.0f;
-            buffer->depth[4 * pidx + 3] = 1000.0f;
-            buffer->texcoord[4 * pidx + 0] = 0.0f;
-            buffer->texcoord[4 * pidx + 1] = 0.0f;
-            buffer->texcoord[4 * pidx + 2] = 0.0f;
-            buffer->texcoord[4 * pidx + 3] = 0.0f;
-            buffer->diffuse[4 * pidx + 0] = 0.0f;
-            buffer->diffuse[4 * pidx + 1] = 0.0f;
-            buffer->diffuse[4 * pidx + 2] = 0.0f;
-            buffer->diffuse[4 * pidx + 3] = 0.0f;
+            unsigned int f0, f1, f2;
+            f0 = mesh->faces[3 * prim_id + 0];
+            f1 = mesh->faces[3 * prim_id + 1];
+            f2 = mesh->faces[3 * prim_id + 2];
+
+            float3 v0, v1, v2;
+            v0[0] = mesh->vertices[3 * f0 + 0];
+            v0[1] = mesh->vertices[3 * f0 + 1];
+            v0[2] = mesh->vertices[3 * f0 + 2];
+            v1[0] = mesh->vertices[3 * f1 + 0];
+            v1[1] = mesh->vertices[3 * f1 + 1];
+            v1[2] = mesh->vertices[3 * f1 + 2];
+            v2[0] = mesh->vertices[3 * f2 + 0];
+            v2[1] = mesh->vertices[3 * f2 + 1];
+            v2[2] = mesh->vertices[3 * f2 + 2];
+            CalcNormal(N, v0, v1, v2);
           }
 
-          nanort::TriangleIntersector<> triangle_intersector(
-              mesh_.vertices.data(), mesh_.faces.data(), sizeof(float) * 3);
-          nanort::TriangleIntersection<float> isect;
-          bool hit = gAccel.Traverse(ray, triangle_intersector, &isect);
-          if (hit) {
-            float3 p;
-            p[0] = ray.org[0] + isect.t * ray.dir[0];
-            p[1] = ray.org[1] + isect.t * ray.dir[1];
-            p[2] = ray.org[2] + isect.t * ray.dir[2];
-
-            buffer->position[4 * pidx + 0] = p.x();
-            buffer->position[4 * pidx + 1] = p.y();
-            buffer->position[4 * pidx + 2] = p.z();
-            buffer->position[4 * pidx + 3] = 1.0f;
-
-            unsigned int prim_id = isect.prim_id;
-
-            float3 N;
-            {
-              unsigned int f0, f1, f2;
-              f0 = mesh_.faces[3 * prim_id + 0];
-              f1 = mesh_.faces[3 * prim_id + 1];
-              f2 = mesh_.faces[3 * prim_id + 2];
-
-              float3 v0, v1, v2;
-              v0[0] = mesh_.vertices[3 * f0 + 0];
-              v0[1] = mesh_.vertices[3 * f0 + 1];
-              v0[2] = mesh_.vertices[3 * f0 + 2];
-              v1[0] = mesh_.vertices[3 * f1 + 0];
-              v1[1] = mesh_.vertices[3 * f1 + 1];
-              v1[2] = mesh_.vertices[3 * f1 + 2];
-              v2[0] = mesh_.vertices[3 * f2 + 0];
-              v2[1] = mesh_.vertices[3 * f2 + 1];
-              v2[2] = mesh_.vertices[3 * f2 + 2];
-              CalcNormal(N, v0, v1, v2);
-            }
-
-            buffer->normal[4 * pidx + 0] = 0.5f * N[0] + 0.5f;
-            buffer->normal[4 * pidx + 1] = 0.5f * N[1] + 0.5f;
-            buffer->normal[4 * pidx + 2] = 0.5f * N[2] + 0.5f;
-            buffer->normal[4 * pidx + 3] = 1.0f;
-
-            buffer->depth[4 * pidx + 0] = isect.t;
-            buffer->depth[4 * pidx + 1] = isect.t;
-            buffer->depth[4 * pidx + 2] = isect.t;
-            buffer->depth[4 * pidx + 3] = 1.0f;
-
-            float3 UV;
-            if (mesh_.uvs.size() > 0) {
-              float3 uv0, uv1, uv2;
-              uint32_t v0, v1, v2;
-              v0 = mesh_.faces[3 * prim_id + 0];
-              v1 = mesh_.faces[3 * prim_id + 1];
-              v2 = mesh_.faces[3 * prim_id + 2];
-
-              uv0[0] = mesh_.uvs[2 * v0 + 0];
-              uv0[1] = mesh_.uvs[2 * v0 + 1];
-              uv1[0] = mesh_.uvs[2 * v1 + 0];
-              uv1[1] = mesh_.uvs[2 * v1 + 1];
-              uv2[0] = mesh_.uvs[2 * v2 + 0];
-              uv2[1] = mesh_.uvs[2 * v2 + 1];
-
-              UV = Lerp3(uv0, uv1, uv2, isect.u, isect.v);
-
-              buffer->texcoord[4 * pidx + 0] = UV[0];
-              buffer->texcoord[4 * pidx + 1] = UV[1];
-              buffer->texcoord[4 * pidx + 2] = 0.0f;
-              buffer->texcoord[4 * pidx + 3] = 1.0f;
-            }
-
-            // Fetch texture
-            float tex_col[3];
-            // add global texture offset
-            FetchTexture(image_, UV[0] + config.uv_offset[0], UV[1] + config.uv_offset[1], tex_col);
-
-            // Use texture as diffuse color.
-            buffer->diffuse[4 * pidx + 0] = tex_col[0];
-            buffer->diffuse[4 * pidx + 1] = tex_col[1];
-            buffer->diffuse[4 * pidx + 2] = tex_col[2];
-            buffer->diffuse[4 * pidx + 3] = 1.0f;
-
-            // Simple shading
-            float NdotV = fabsf(vdot(N, dir));
-
-            buffer->rgba[4 * pidx + 0] = NdotV * tex_col[0];
-            buffer->rgba[4 * pidx + 1] = NdotV * tex_col[1];
-            buffer->rgba[4 * pidx + 2] = NdotV * tex_col[2];
-            buffer->rgba[4 * pidx + 3] = 1.0f;
+          buffer->normal[4 * pidx + 0] = 0.5f * N[0] + 0.5f;
+          buffer->normal[4 * pidx + 1] = 0.5f * N[1] + 0.5f;
+          buffer->normal[4 * pidx + 2] = 0.5f * N[2] + 0.5f;
+          buffer->normal[4 * pidx + 3] = 1.0f;
+
+          buffer->depth[4 * pidx + 0] = isect.t;
+          buffer->depth[4 * pidx + 1] = isect.t;
+          buffer->depth[4 * pidx + 2] = isect.t;
+          buffer->depth[4 * pidx + 3] = 1.0f;
+
+          float3 UV;
+          if (mesh->uvs.size() > 0) {
+            float3 uv0, uv1, uv2;
+            uint32_t v0, v1, v2;
+            v0 = mesh->faces[3 * prim_id + 0];
+            v1 = mesh->faces[3 * prim_id + 1];
+            v2 = mesh->faces[3 * prim_id + 2];
+
+            uv0[0] = mesh->uvs[2 * v0 + 0];
+            uv0[1] = mesh->uvs[2 * v0 + 1];
+            uv1[0] = mesh->uvs[2 * v1 + 0];
+            uv1[1] = mesh->uvs[2 * v1 + 1];
+            uv2[0] = mesh->uvs[2 * v2 + 0];
+            uv2[1] = mesh->uvs[2 * v2 + 1];
+
+            UV = Lerp3(uv0, uv1, uv2, isect.u, isect.v);
+
+            buffer->texcoord[4 * pidx + 0] = UV[0];
+            buffer->texcoord[4 * pidx + 1] = UV[1];
+            buffer->texcoord[4 * pidx + 2] = 0.0f;
+            buffer->texcoord[4 * pidx + 3] = 1.0f;
           }
+
+          // Fetch texture
+          float tex_col[3];
+          // add global texture offset
+          FetchTexture(*image, UV[0] + config.uv_offset[0], UV[1] + config.uv_offset[1], tex_col);
+
+          // Use texture as diffuse color.
+          buffer->diffuse[4 * pidx + 0] = tex_col[0];
+          buffer->diffuse[4 * pidx + 1] = tex_col[1];
+          buffer->diffuse[4 * pidx + 2] = tex_col[2];
+          buffer->diffuse[4 * pidx + 3] = 1.0f;
+
+          // Simple shading
+          float NdotV = fabsf(vdot(N, dir));
+
+          buffer->rgba[4 * pidx + 0] = NdotV * tex_col[0];
+          buffer->rgba[4 * pidx + 1] = NdotV * tex_col[1];
+          buffer->rgba[4 * pidx + 2] = NdotV * tex_col[2];
+          buffer->rgba[4 * pidx + 3] = 1.0f;
         }
       }
-    }));
-  }
-
-  for (auto& t : workers) {
-    t.join();
-  }
+    }
+  });
 
   return true;
 };
@@ -1,6 +1,8 @@
 #ifndef EXAMPLE_RENDER_H_
 #define EXAMPLE_RENDER_H_
 
+#include <memory>
+
 #include "render-config.h"
 #include "render-buffer.h"
 #include "mesh.h"
@@ -10,19 +12,20 @@ namespace example {
 
 class Renderer {
  public:
-  Renderer() {}
+  Renderer()
+      : mesh_(std::make_shared<prnet::Mesh>()),
+        image_(std::make_shared<prnet::Image<float>>()) {}
   ~Renderer() {}
 
-  /// Set mesh
-  void SetMesh(const prnet::Mesh &mesh) {
-    mesh_.vertices = mesh.vertices;
-    mesh_.faces = mesh.faces;
-    mesh_.uvs = mesh.uvs;
+  /// Set mesh. The mesh is shared(not copied), so switching meshes is cheap.
+  /// Not thread-safe with Render().
+  void SetMesh(std::shared_ptr<const prnet::Mesh> mesh) {
+    mesh_ = std::move(mesh);
   }
 
-  /// Set Image
-  void SetImage(const prnet::Image<float> &image) {
-    image_ = image;
+  /// Set Image. The image is shared(not copied).
+  void SetImage(std::shared_ptr<const prnet::Image<float>> image) {
+    image_ = std::move(image);
   }
  
   /// Builds BVH
@@ -33,8 +36,8 @@ class Renderer {
               const RenderConfig& config);
 
  private:
-  prnet::Mesh mesh_;
-  prnet::Image<float> image_;
+  std::shared_ptr<const prnet::Mesh> mesh_;
+  std::shared_ptr<const prnet::Image<float>> image_;
 };
 };
 
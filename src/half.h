@@ -0,0 +1,78 @@
+#ifndef PRNET_INFER_HALF_H_
+#define PRNET_INFER_HALF_H_
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace prnet {
+
+///
+/// IEEE 754 half(2 bytes). Storage type of `Image<Half>`, convert with
+/// image_convert.h or HalfToFloat()/FloatToHalf().
+///
+struct Half {
+  uint16_t bits;
+};
+
+///
+/// Convert IEEE 754 half(e.g. DT_HALF element) to float.
+///
+inline float HalfToFloat(uint16_t h) {
+  const uint32_t sign = uint32_t(h & 0x8000) << 16;
+  uint32_t exponent = (h >> 10) & 0x1f;
+  uint32_t mantissa = h & 0x3ff;
+  uint32_t bits;
+  if (exponent == 0) {
+    if (mantissa == 0) {
+      bits = sign;
+      float f;
+      std::memcpy(&f, &bits, 4);
+      return f;
+    }
+    // Subnormal
+    while ((mantissa & 0x400) == 0) {
+      mantissa <<= 1;
+      exponent--;
+    }
+    exponent++;
+    mantissa &= 0x3ff;
+  } else if (exponent == 0x1f) {
+    bits = sign | 0x7f800000 | (mantissa << 13);
+    float f;
+    std::memcpy(&f, &bits, 4);
+    return f;
+  }
+  bits = sign | ((exponent + (127 - 15)) << 23) | (mantissa << 13);
+  float f;
+  std::memcpy(&f, &bits, 4);
+  return f;
+}
+
+///
+/// Convert float to IEEE 754 half(round to nearest even).
+///
+inline uint16_t FloatToHalf(float f) {
+  uint32_t bits;
+  std::memcpy(&bits, &f, 4);
+  const uint32_t sign = (bits >> 16) & 0x8000;
+  const uint32_t abs_bits = bits & 0x7fffffff;
+  if (abs_bits >= 0x7f800000) {  // Inf or NaN
+    return uint16_t(sign | 0x7c00 | ((abs_bits > 0x7f800000) ? 0x200 : 0));
+  }
+  if (abs_bits >= 0x477ff000) {  // Rounds to a value larger than 65504
+    return uint16_t(sign | 0x7c00);
+  }
+  if (abs_bits < 0x38800000) {  // Subnormal half(< 2^-14)
+    float abs_f;
+    std::memcpy(&abs_f, &abs_bits, 4);
+    return uint16_t(sign | uint32_t(std::nearbyint(abs_f * 16777216.0f)));
+  }
+  // Rebias exponent(127 -> 15) and round mantissa to 10 bits.
+  const uint32_t rounded = abs_bits + 0xfff + ((abs_bits >> 13) & 1);
+  return uint16_t(sign | ((rounded - 0x38000000) >> 13));
+}
+
+} // namespace prnet
+
+#endif // PRNET_INFER_HALF_H_
@@ -1,57 +1,193 @@
 #ifndef IMAGE_180602
 #define IMAGE_180602
 
-#include <atomic>
-#include <thread>
+#include <algorithm>
+#include <cstdint>
 #include <memory>
+#include <type_traits>
 #include <vector>
 #include <functional>
 
-namespace prnet {
-
-#ifdef __clang__
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wglobal-constructors"
-#endif
+#include "thread_pool.h"
 
-const static uint32_t DEFAULT_HW_CONCURRENCY =
-  std::max(1U, std::thread::hardware_concurrency());
+namespace prnet {
 
-#ifdef __clang__
-#pragma clang diagnostic pop
-#endif
+template <typename T>
+class ImageView;
 
 template <typename T>
 class Image {
 public:
   Image() {}
+  Image(const Image& rhs);
+  Image(Image&& rhs) noexcept;
+  Image& operator=(const Image& rhs);
+  Image& operator=(Image&& rhs) noexcept;
 
+  /// Allocate image. Existing storage is reused when the size is the same.
   void create(size_t w, size_t h, size_t c);
   void create(size_t w, size_t h, size_t c, const T* d);
 
+  ///
+  /// Use externally allocated memory(e.g. TensorFlow tensor) as image
+  /// storage without copy. `storage` must hold `w * h * c` elements.
+  /// Copying an Image always makes a deep copy into its own memory.
+  ///
+  void create(size_t w, size_t h, size_t c,
+              const std::shared_ptr<T>& ext_storage);
+
   size_t getWidth() const { return width; }
   size_t getHeight() const { return height; }
   size_t getChannels() const { return channels; }
-  const T* getData() const { return data.data(); }
-  T* getData() { return data.data(); }
+  const T* getData() const { return storage ? storage.get() : data.data(); }
+  T* getData() { return storage ? storage.get() : data.data(); }
 
   const T& fetch(size_t x, size_t y, size_t c = 0) const;
   T& fetch(size_t x, size_t y, size_t c = 0);
 
+  ///
+  /// View of the whole image(no copy). See ImageView.
+  ///
+  ImageView<T> view();
+  ImageView<const T> view() const;
+
+  ///
+  /// Call `func(y_begin, y_end, data, stride)` for ranges of rows on the
+  /// global thread pool(thread_pool.h). `data` points to the first element
+  /// of row `y_begin` and rows are `stride` elements apart. Rows are split
+  /// among at most `n_threads` threads(0 = all threads of the pool, 1 =
+  /// calling thread only).
+  /// `func` is called directly(no std::function), so the loop over a row can
+  /// be inlined and vectorized.
+  ///
+  template <typename F>
+  void foreach_rows(const F& func, uint32_t n_threads = 0);
+  template <typename F>
+  void foreach_rows(const F& func, uint32_t n_threads = 0) const;
+
+  ///
+  /// Call `func(y, row)` for each row. `row` points to `width * channels`
+  /// elements.
+  ///
+  template <typename F>
+  void foreach_row(const F& func, uint32_t n_threads = 0);
+  template <typename F>
+  void foreach_row(const F& func, uint32_t n_threads = 0) const;
+
+  ///
+  /// Call `func` for each pixel(or each pixel and channel). Per element
+  /// std::function call; prefer foreach_row() in hot paths.
+  ///
   void foreach(const std::function<void(int x, int y ,T* v)> &func,
-               uint32_t n_threads = DEFAULT_HW_CONCURRENCY);
+               uint32_t n_threads = 0);
   void foreach(const std::function<void(int x, int y, const T* v)> &func,
-               uint32_t n_threads = DEFAULT_HW_CONCURRENCY) const;
+               uint32_t n_threads = 0) const;
   void foreach(const std::function<void(int x, int y , int c, T& v)> &func,
-               uint32_t n_threads = DEFAULT_HW_CONCURRENCY);
+               uint32_t n_threads = 0);
   void foreach(const std::function<void(int x, int y, int c, const T& v)> &func,
-               uint32_t n_threads = DEFAULT_HW_CONCURRENCY) const;
+               uint32_t n_threads = 0) const;
 
 private:
   size_t width = 0;
   size_t height = 0;
   size_t channels = 0;
   std::vector<T> data;
+  std::shared_ptr<T> storage;  // external storage
+};
+
+///
+/// Non-owning view of an image in existing memory(Image, decoded stb buffer,
+/// TensorFlow tensor, mmapped file, ...). Element (x, y, c) is at
+/// `getData()[y * row_stride + x * pixel_stride + c * channel_stride]`,
+/// strides in elements. `T` is const for a read-only view.
+/// roi() references a sub-rectangle of the same memory without copy.
+/// The memory must outlive the view.
+///
+template <typename T>
+class ImageView {
+public:
+  typedef typename std::remove_const<T>::type value_type;
+
+  ImageView() {}
+
+  ///
+  /// Interleaved pixels(`c` elements per pixel). `row_stride` 0 = `w * c`.
+  ///
+  ImageView(T* d, size_t w, size_t h, size_t c, size_t row_stride = 0);
+  ImageView(T* d, size_t w, size_t h, size_t c, size_t row_stride,
+            size_t pixel_stride, size_t channel_stride);
+
+  ///
+  /// View of the whole image. Implicit, so that an Image can be passed where
+  /// a view is expected.
+  ///
+  ImageView(Image<value_type>& img);
+  template <typename U, typename = typename std::enable_if<
+                            std::is_same<const U, T>::value>::type>
+  ImageView(const Image<U>& img);
+
+  ///
+  /// Read-only view from a mutable one.
+  ///
+  template <typename U, typename = typename std::enable_if<
+                            std::is_same<const U, T>::value>::type>
+  ImageView(const ImageView<U>& v);
+
+  size_t getWidth() const { return width; }
+  size_t getHeight() const { return height; }
+  size_t getChannels() const { return channels; }
+  size_t getRowStride() const { return row_stride; }
+  size_t getPixelStride() const { return pixel_stride; }
+  size_t getChannelStride() const { return channel_stride; }
+  T* getData() const { return data; }
+
+  ///
+  /// Pixels are `channels` consecutive elements(e.g. RGBRGB...). Rows may
+  /// have padding.
+  ///
+  bool isInterleaved() const {
+    return (channel_stride == 1) && (pixel_stride == channels);
+  }
+
+  ///
+  /// Same layout as Image(interleaved, no row padding).
+  ///
+  bool isPacked() const {
+    return isInterleaved() && (row_stride == width * channels);
+  }
+
+  T* row(size_t y) const { return data + y * row_stride; }
+  T& fetch(size_t x, size_t y, size_t c = 0) const {
+    return data[y * row_stride + x * pixel_stride + c * channel_stride];
+  }
+
+  ///
+  /// Sub-rectangle [x, x + w) x [y, y + h) of this view(no copy).
+  ///
+  ImageView roi(size_t x, size_t y, size_t w, size_t h) const;
+
+  ///
+  /// Deep copy into a packed image, or into a view of the same size(e.g. an
+  /// input tensor).
+  ///
+  void copyTo(Image<value_type>* img) const;
+  void copyTo(const ImageView<value_type>& dst) const;
+
+  ///
+  /// Call `func(y, row)` for each row on the global thread pool. `row` is
+  /// row(y), so elements follow the strides of this view.
+  ///
+  template <typename F>
+  void foreach_row(const F& func, uint32_t n_threads = 0) const;
+
+private:
+  T* data = nullptr;
+  size_t width = 0;
+  size_t height = 0;
+  size_t channels = 0;
+  size_t row_stride = 0;
+  size_t pixel_stride = 0;
+  size_t channel_stride = 0;
 };
 
 #include "image_impl.h"
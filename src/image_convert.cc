@@ -0,0 +1,379 @@
+#include "image_convert.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+// SIMD kernels are compiled with target attribute and selected at runtime, so
+// that the binary also runs on CPUs without AVX2/F16C.
+#define PRNET_IMAGE_HAS_AVX2_KERNEL 1
+#include <immintrin.h>
+#endif
+
+namespace prnet {
+
+namespace {
+
+typedef void (*NormalizeU8Kernel)(const uint8_t* src, float* dst, size_t n);
+typedef void (*LookupU8Kernel)(const uint8_t* src, const float* lut,
+                               float* dst, size_t n);
+typedef void (*FloatToU8Kernel)(const float* src, float scale, uint8_t* dst,
+                                size_t n);
+typedef void (*FloatToHalfKernel)(const float* src, Half* dst, size_t n);
+typedef void (*HalfToFloatKernel)(const Half* src, float* dst, size_t n);
+
+// 8-bit level of `v`: clamp(pow(v, gamma) * scale, 0, 255) truncated.
+uint8_t GammaLevel(float v, float scale, float gamma) {
+  const float x = std::pow(v, gamma) * scale;
+  return static_cast<uint8_t>(std::max(std::min(255.0f, x), 0.0f));
+}
+
+uint32_t FloatBits(float v) {
+  uint32_t bits;
+  std::memcpy(&bits, &v, 4);
+  return bits;
+}
+
+//
+// Table for float -> 8-bit with gamma(GammaLevel() without pow()).
+//
+// thresholds[k] is the smallest non-negative float whose level is k or
+// more(k = 1..255, NaN when no such value). Levels are monotonic in v for
+// gamma > 0, so the level of v is the number of thresholds <= v.
+//
+// Values in [thresholds[1], thresholds[255]) are bucketed by their bit
+// pattern(= relative precision, so that dark values have as many buckets as
+// bright values), `levels` has the level at the start of each bucket and a
+// few threshold compares give the exact level.
+//
+struct GammaTable {
+  static const size_t kMaxBuckets = 4096;
+
+  float thresholds[257];  // [0]: not used, [256]: NaN(sentinel)
+  uint32_t min_bits = 0;  // bits of thresholds[1]
+  uint32_t max_bits = 0;  // bits of thresholds[255], or larger than +Inf
+  uint32_t shift = 0;     // bucket = (bits - min_bits) >> shift
+  uint32_t n_buckets = 0;
+  int32_t levels[kMaxBuckets];
+
+  GammaTable(float scale, float gamma);
+};
+
+GammaTable::GammaTable(float scale, float gamma) {
+  // Search each threshold over the bit patterns of non-negative floats,
+  // whose integer order is the same as the float order.
+  const uint32_t kInfBits = 0x7f800000;
+  const float kNaN = std::numeric_limits<float>::quiet_NaN();
+  thresholds[0] = 0.0f;
+  uint32_t first = 0;
+  for (size_t k = 1; k < 256; k++) {
+    uint32_t last = kInfBits + 1;
+    while (first < last) {
+      const uint32_t mid = first + (last - first) / 2;
+      float v;
+      std::memcpy(&v, &mid, 4);
+      if (size_t(GammaLevel(v, scale, gamma)) >= k) {
+        last = mid;
+      } else {
+        first = mid + 1;
+      }
+    }
+    if (first > kInfBits) {
+      std::fill(thresholds + k, thresholds + 256, kNaN);
+      break;
+    }
+    std::memcpy(&thresholds[k], &first, 4);
+  }
+  thresholds[256] = kNaN;
+
+  if (std::isnan(thresholds[1])) {
+    return;  // Always 0.
+  }
+  min_bits = FloatBits(thresholds[1]);
+  max_bits = std::isnan(thresholds[255]) ? kInfBits + 1
+                                         : FloatBits(thresholds[255]);
+  const uint32_t range = std::min(max_bits, kInfBits) - min_bits;
+  while ((range >> shift) >= kMaxBuckets) {
+    shift++;
+  }
+  n_buckets = (range >> shift) + 1;
+  int32_t k = 0;
+  for (uint32_t b = 0; b < n_buckets; b++) {
+    const uint32_t bits = min_bits + (b << shift);
+    while (!(FloatBits(thresholds[k + 1]) > bits)) {
+      k++;
+    }
+    levels[b] = k;
+  }
+}
+
+void NormalizeU8Generic(const uint8_t* src, float* dst, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    dst[i] = float(src[i]) / 255.0f;
+  }
+}
+
+void LookupU8Generic(const uint8_t* src, const float* lut, float* dst,
+                     size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    dst[i] = lut[src[i]];
+  }
+}
+
+void FloatToU8Generic(const float* src, float scale, uint8_t* dst, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    const float v = std::max(std::min(255.0f, src[i] * scale), 0.0f);
+    dst[i] = static_cast<uint8_t>(v);
+  }
+}
+
+// No SIMD variant: gathering from the tables with AVX2 was slower than this
+// loop(a bucket lookup and mostly one compare per element).
+void GammaU8(const float* src, const GammaTable& table, uint8_t* dst,
+             size_t n) {
+  const float* t = table.thresholds;
+  for (size_t i = 0; i < n; i++) {
+    const float v = src[i];
+    const uint32_t bits = FloatBits(v);
+    int32_t k = 0;  // negative, NaN or level 0
+    if (v >= t[1]) {
+      if (bits >= table.max_bits) {
+        k = 255;
+      } else {
+        k = table.levels[(bits - table.min_bits) >> table.shift];
+        while (v >= t[k + 1]) {  // stops at t[256](NaN)
+          k++;
+        }
+      }
+    }
+    dst[i] = static_cast<uint8_t>(k);
+  }
+}
+
+void FloatToHalfGeneric(const float* src, Half* dst, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    dst[i].bits = FloatToHalf(src[i]);
+  }
+}
+
+void HalfToFloatGeneric(const Half* src, float* dst, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    dst[i] = HalfToFloat(src[i].bits);
+  }
+}
+
+#ifdef PRNET_IMAGE_HAS_AVX2_KERNEL
+__attribute__((target("avx2")))
+void NormalizeU8Avx2(const uint8_t* src, float* dst, size_t n) {
+  const __m256 s = _mm256_set1_ps(255.0f);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m128i b =
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i));
+    const __m256 v = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(b));
+    _mm256_storeu_ps(dst + i, _mm256_div_ps(v, s));
+  }
+  NormalizeU8Generic(src + i, dst + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void LookupU8Avx2(const uint8_t* src, const float* lut, float* dst,
+                  size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m128i b =
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i));
+    _mm256_storeu_ps(dst + i,
+                     _mm256_i32gather_ps(lut, _mm256_cvtepu8_epi32(b), 4));
+  }
+  LookupU8Generic(src + i, lut, dst + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void FloatToU8Avx2(const float* src, float scale, uint8_t* dst, size_t n) {
+  const __m256 s = _mm256_set1_ps(scale);
+  const __m256 lo = _mm256_setzero_ps();
+  const __m256 hi = _mm256_set1_ps(255.0f);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 v = _mm256_mul_ps(_mm256_loadu_ps(src + i), s);
+    // min_ps returns the second operand for NaN, same as std::min(255, v).
+    v = _mm256_max_ps(_mm256_min_ps(v, hi), lo);
+    const __m256i d = _mm256_cvttps_epi32(v);
+    const __m128i w = _mm_packus_epi32(_mm256_castsi256_si128(d),
+                                       _mm256_extracti128_si256(d, 1));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i),
+                     _mm_packus_epi16(w, w));
+  }
+  FloatToU8Generic(src + i, scale, dst + i, n - i);
+}
+
+__attribute__((target("avx2,f16c")))
+void FloatToHalfF16c(const float* src, Half* dst, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i),
+                                      _MM_FROUND_TO_NEAREST_INT);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), h);
+  }
+  FloatToHalfGeneric(src + i, dst + i, n - i);
+}
+
+__attribute__((target("avx2,f16c")))
+void HalfToFloatF16c(const Half* src, float* dst, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m128i h =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(h));
+  }
+  HalfToFloatGeneric(src + i, dst + i, n - i);
+}
+
+bool CpuHasAvx2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+
+bool CpuHasF16c() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c");
+}
+#endif
+
+struct ConvertKernels {
+  NormalizeU8Kernel normalize_u8 = NormalizeU8Generic;
+  LookupU8Kernel lookup_u8 = LookupU8Generic;
+  FloatToU8Kernel float_to_u8 = FloatToU8Generic;
+  FloatToHalfKernel float_to_half = FloatToHalfGeneric;
+  HalfToFloatKernel half_to_float = HalfToFloatGeneric;
+
+  ConvertKernels() {
+#ifdef PRNET_IMAGE_HAS_AVX2_KERNEL
+    if (CpuHasAvx2()) {
+      normalize_u8 = NormalizeU8Avx2;
+      lookup_u8 = LookupU8Avx2;
+      float_to_u8 = FloatToU8Avx2;
+    }
+    if (CpuHasF16c()) {
+      float_to_half = FloatToHalfF16c;
+      half_to_float = HalfToFloatF16c;
+    }
+#endif
+  }
+};
+
+const ConvertKernels& GetConvertKernels() {
+  static const ConvertKernels kernels;
+  return kernels;
+}
+
+// gamma == 1(no -Wfloat-equal). pow(v, 1) is skipped since it returns v.
+bool IsLinearGamma(float gamma) {
+  return !(gamma < 1.0f) && !(gamma > 1.0f);
+}
+
+// Convert `src` into `dst` of the same size row by row. Kernels take
+// interleaved rows, so other layouts are packed first.
+template <typename S, typename D, typename F>
+void ConvertRows(const ImageView<const S>& src, Image<D>* dst,
+                 const F& convert_row) {
+  if (!src.isInterleaved()) {
+    Image<S> packed;
+    src.copyTo(&packed);
+    ConvertRows(ImageView<const S>(packed), dst, convert_row);
+    return;
+  }
+  dst->create(src.getWidth(), src.getHeight(), src.getChannels());
+  const size_t row_size = src.getWidth() * src.getChannels();
+  D* dst_data = dst->getData();
+  src.foreach_row([&](size_t y, const S* row) {
+    convert_row(row, dst_data + y * row_size, row_size);
+  });
+}
+
+} // anonymous namespace
+
+void MakeGammaTable(float gamma, float* table) {
+  for (size_t i = 0; i < 256; i++) {
+    table[i] = std::pow(float(i) / 255.0f, gamma);
+  }
+}
+
+void ConvertImage(const ImageView<const uint8_t>& src, Image<float>* dst,
+                  float gamma) {
+  const ConvertKernels& kernels = GetConvertKernels();
+  if (IsLinearGamma(gamma)) {
+    ConvertRows(src, dst, [&](const uint8_t* s, float* d, size_t n) {
+      kernels.normalize_u8(s, d, n);
+    });
+    return;
+  }
+
+  float lut[256];
+  MakeGammaTable(gamma, lut);
+  ConvertRows(src, dst, [&](const uint8_t* s, float* d, size_t n) {
+    kernels.lookup_u8(s, lut, d, n);
+  });
+}
+
+void ConvertImage(const ImageView<const float>& src, Image<uint8_t>* dst,
+                  float scale, float gamma) {
+  const ConvertKernels& kernels = GetConvertKernels();
+  if (IsLinearGamma(gamma)) {
+    ConvertRows(src, dst, [&](const float* s, uint8_t* d, size_t n) {
+      kernels.float_to_u8(s, scale, d, n);
+    });
+    return;
+  }
+
+  const GammaTable table(scale, gamma);
+  ConvertRows(src, dst, [&](const float* s, uint8_t* d, size_t n) {
+    GammaU8(s, table, d, n);
+  });
+}
+
+void ConvertImage(const ImageView<const uint8_t>& src, Image<uint8_t>* dst,
+                  float gamma) {
+  uint8_t lut[256];
+  for (size_t i = 0; i < 256; i++) {
+    lut[i] = GammaLevel(float(i) / 255.0f, 255.0f, gamma);
+  }
+  ConvertRows(src, dst, [&](const uint8_t* s, uint8_t* d, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+      d[i] = lut[s[i]];
+    }
+  });
+}
+
+void ConvertImage(const ImageView<const uint8_t>& src, Image<Half>* dst,
+                  float gamma) {
+  Half lut[256];
+  for (size_t i = 0; i < 256; i++) {
+    lut[i].bits = FloatToHalf(std::pow(float(i) / 255.0f, gamma));
+  }
+  ConvertRows(src, dst, [&](const uint8_t* s, Half* d, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+      d[i] = lut[s[i]];
+    }
+  });
+}
+
+void ConvertImage(const ImageView<const float>& src, Image<Half>* dst) {
+  const ConvertKernels& kernels = GetConvertKernels();
+  ConvertRows(src, dst, [&](const float* s, Half* d, size_t n) {
+    kernels.float_to_half(s, d, n);
+  });
+}
+
+void ConvertImage(const ImageView<const Half>& src, Image<float>* dst) {
+  const ConvertKernels& kernels = GetConvertKernels();
+  ConvertRows(src, dst, [&](const Half* s, float* d, size_t n) {
+    kernels.half_to_float(s, d, n);
+  });
+}
+
+} // namespace prnet
@@ -0,0 +1,69 @@
+#ifndef PRNET_INFER_IMAGE_CONVERT_H_
+#define PRNET_INFER_IMAGE_CONVERT_H_
+
+#include <cstdint>
+
+#include "half.h"
+#include "image.h"
+
+namespace prnet {
+
+///
+/// Element type conversions between `Image<uint8_t>`, `Image<float>` and
+/// `Image<Half>`. Images are stored as 8-bit or half where precision is not
+/// needed(decoded frames, texture, debug images) and converted to float at
+/// the network boundary.
+///
+/// The source may be a view(e.g. a sub-rectangle) and the result is a packed
+/// image. Rows are converted in parallel on the global thread pool, with
+/// AVX2/F16C kernels selected at runtime where available. SIMD kernels give
+/// the same result as the scalar code(except NaN payloads of half).
+///
+/// Gamma is applied with tables instead of per element pow(): a 256-entry
+/// table for 8-bit sources, and for float to 8-bit a table of the 255 level
+/// thresholds indexed by up to 4096 buckets of float bits. Results are the
+/// same as with pow().
+///
+
+///
+/// Table of pow(i / 255, gamma) for the 256 8-bit values, i.e. the values
+/// ConvertImage(uint8 -> float) produces. For decoding texels on the fly.
+///
+void MakeGammaTable(float gamma, float* table);
+
+///
+/// dst = pow(src / 255, gamma). e.g. 8-bit sRGB to linear: gamma = 2.2.
+///
+void ConvertImage(const ImageView<const uint8_t>& src, Image<float>* dst,
+                  float gamma = 1.0f);
+
+///
+/// dst = clamp(pow(src, gamma) * scale, 0, 255), truncated toward zero.
+/// e.g. linear to 8-bit display: gamma = 1 / 2.2.
+/// With gamma != 1(gamma > 0), negative and NaN values map to 0.
+///
+void ConvertImage(const ImageView<const float>& src, Image<uint8_t>* dst,
+                  float scale = 255.0f, float gamma = 1.0f);
+
+///
+/// dst = clamp(pow(src / 255, gamma) * 255, 0, 255), truncated toward zero.
+/// e.g. 8-bit linear to 8-bit display: gamma = 1 / 2.2.
+///
+void ConvertImage(const ImageView<const uint8_t>& src, Image<uint8_t>* dst,
+                  float gamma);
+
+///
+/// dst = half(pow(src / 255, gamma)).
+///
+void ConvertImage(const ImageView<const uint8_t>& src, Image<Half>* dst,
+                  float gamma = 1.0f);
+
+///
+/// float <-> half(round to nearest even).
+///
+void ConvertImage(const ImageView<const float>& src, Image<Half>* dst);
+void ConvertImage(const ImageView<const Half>& src, Image<float>* dst);
+
+} // namespace prnet
+
+#endif // PRNET_INFER_IMAGE_CONVERT_H_
@@ -1,5 +1,51 @@
+template <typename T>
+Image<T>::Image(const Image& rhs)
+    : width(rhs.width), height(rhs.height), channels(rhs.channels) {
+  data.assign(rhs.getData(), rhs.getData() + width * height * channels);
+}
+
+template <typename T>
+Image<T>::Image(Image&& rhs) noexcept
+    : width(rhs.width),
+      height(rhs.height),
+      channels(rhs.channels),
+      data(std::move(rhs.data)),
+      storage(std::move(rhs.storage)) {
+  rhs.width = rhs.height = rhs.channels = 0;
+}
+
+template <typename T>
+Image<T>& Image<T>::operator=(const Image& rhs) {
+  if (this != &rhs) {
+    width = rhs.width;
+    height = rhs.height;
+    channels = rhs.channels;
+    storage.reset();
+    data.assign(rhs.getData(), rhs.getData() + width * height * channels);
+  }
+  return (*this);
+}
+
+template <typename T>
+Image<T>& Image<T>::operator=(Image&& rhs) noexcept {
+  if (this != &rhs) {
+    width = rhs.width;
+    height = rhs.height;
+    channels = rhs.channels;
+    data = std::move(rhs.data);
+    storage = std::move(rhs.storage);
+    rhs.width = rhs.height = rhs.channels = 0;
+  }
+  return (*this);
+}
+
 template <typename T>
 void Image<T>::create(size_t w, size_t h, size_t c) {
+  if (storage && (w == width) && (h == height) && (c == channels)) {
+    // Keep using external storage.
+    return;
+  }
+  storage.reset();
   width = w;
   height = h;
   channels = c;
@@ -9,102 +55,196 @@ void Image<T>::create(size_t w, size_t h, size_t c) {
 template <typename T>
 void Image<T>::create(size_t w, size_t h, size_t c, const T* d) {
   create(w, h, c);
-  std::copy(data.begin(), data.end(), d);
+  std::copy(d, d + w * h * c, getData());
+}
+
+template <typename T>
+void Image<T>::create(size_t w, size_t h, size_t c,
+                      const std::shared_ptr<T>& ext_storage) {
+  width = w;
+  height = h;
+  channels = c;
+  storage = ext_storage;
+  data.clear();
+  data.shrink_to_fit();
 }
 
 template <typename T>
 const T& Image<T>::fetch(size_t x, size_t y, size_t c) const {
-  return data[(y * width + x) * channels + c];
+  return getData()[(y * width + x) * channels + c];
 }
 
 template <typename T>
 T& Image<T>::fetch(size_t x, size_t y, size_t c) {
-  return data[(y * width + x) * channels + c];
+  return getData()[(y * width + x) * channels + c];
+}
+
+template <typename T>
+ImageView<T> Image<T>::view() {
+  return ImageView<T>(getData(), width, height, channels);
+}
+
+template <typename T>
+ImageView<const T> Image<T>::view() const {
+  return ImageView<const T>(getData(), width, height, channels);
+}
+
+template <typename T>
+template <typename F>
+void Image<T>::foreach_rows(const F& func, uint32_t n_threads) {
+  T* ptr = getData();
+  const size_t stride = width * channels;
+  ParallelFor(height, [&](size_t y_begin, size_t y_end) {
+    func(y_begin, y_end, ptr + y_begin * stride, stride);
+  }, 0, n_threads);
+}
+
+template <typename T>
+template <typename F>
+void Image<T>::foreach_rows(const F& func, uint32_t n_threads) const {
+  const T* ptr = getData();
+  const size_t stride = width * channels;
+  ParallelFor(height, [&](size_t y_begin, size_t y_end) {
+    func(y_begin, y_end, ptr + y_begin * stride, stride);
+  }, 0, n_threads);
+}
+
+template <typename T>
+template <typename F>
+void Image<T>::foreach_row(const F& func, uint32_t n_threads) {
+  foreach_rows([&](size_t y_begin, size_t y_end, T* data, size_t stride) {
+    for (size_t y = y_begin; y < y_end; y++) {
+      func(y, data + (y - y_begin) * stride);
+    }
+  }, n_threads);
+}
+
+template <typename T>
+template <typename F>
+void Image<T>::foreach_row(const F& func, uint32_t n_threads) const {
+  foreach_rows([&](size_t y_begin, size_t y_end, const T* data,
+                   size_t stride) {
+    for (size_t y = y_begin; y < y_end; y++) {
+      func(y, data + (y - y_begin) * stride);
+    }
+  }, n_threads);
 }
 
 template <typename T>
 void Image<T>::foreach(const std::function<void(int, int, T*)> &func,
                        uint32_t n_threads) {
-  std::vector<std::thread> workers;
-  std::atomic<int> i(0);
-  for (uint32_t t = 0; t < n_threads; t++) {
-    workers.emplace_back(std::thread([&, t]() {
-      (void)t;
-      size_t y = 0;
-      while ((y = size_t(i++)) < height) {
-        for (size_t x = 0; x < width; x++) {
-          func(int(x), int(y), &data[(y * width + x) * channels]);
-        }
-      }
-    }));
-  }
-  for (auto& t : workers) {
-    t.join();
-  }
+  foreach_row([&](size_t y, T* row) {
+    for (size_t x = 0; x < width; x++) {
+      func(int(x), int(y), &row[x * channels]);
+    }
+  }, n_threads);
 }
 
 template <typename T>
 void Image<T>::foreach(const std::function<void(int, int, const T*)> &func,
                        uint32_t n_threads) const {
-  std::vector<std::thread> workers;
-  std::atomic<int> i(0);
-  for (uint32_t t = 0; t < n_threads; t++) {
-    workers.emplace_back(std::thread([&, t]() {
-      (void)t;
-      size_t y = 0;
-      while ((y = size_t(i++)) < height) {
-        for (size_t x = 0; x < width; x++) {
-          func(int(x), int(y), &data[(y * width + x) * channels]);
-        }
-      }
-    }));
-  }
-  for (auto& t : workers) {
-    t.join();
-  }
+  foreach_row([&](size_t y, const T* row) {
+    for (size_t x = 0; x < width; x++) {
+      func(int(x), int(y), &row[x * channels]);
+    }
+  }, n_threads);
 }
 
 template <typename T>
 void Image<T>::foreach(const std::function<void(int, int, int, T&)> &func,
                        uint32_t n_threads) {
-  std::vector<std::thread> workers;
-  std::atomic<int> i(0);
-  for (uint32_t t = 0; t < n_threads; t++) {
-    workers.emplace_back(std::thread([&, t]() {
-      (void)t;
-      size_t y = 0;
-      while ((y = size_t(i++)) < height) {
-        for (size_t x = 0; x < width; x++) {
-          for (size_t c = 0; c < channels; c++) {
-            func(int(x), int(y), int(c), data[(y * width + x) * channels + c]);
-          }
-        }
+  foreach_row([&](size_t y, T* row) {
+    for (size_t x = 0; x < width; x++) {
+      for (size_t c = 0; c < channels; c++) {
+        func(int(x), int(y), int(c), row[x * channels + c]);
       }
-    }));
-  }
-  for (auto& t : workers) {
-    t.join();
-  }
+    }
+  }, n_threads);
 }
 
 template <typename T>
 void Image<T>::foreach(const std::function<void(int, int, int, const T&)> &func,
                        uint32_t n_threads) const {
-  std::vector<std::thread> workers;
-  std::atomic<int> i(0);
-  for (uint32_t t = 0; t < n_threads; t++) {
-    workers.emplace_back(std::thread([&, t]() {
-      size_t y = 0;
-      while ((y = i++) < height) {
-        for (size_t x = 0; x < width; x++) {
-          for (int c = 0; c < channels; c++) {
-            func(int(x), int(y), int(c), data[(y * width + x) * channels + c]);
-          }
-        }
+  foreach_row([&](size_t y, const T* row) {
+    for (size_t x = 0; x < width; x++) {
+      for (size_t c = 0; c < channels; c++) {
+        func(int(x), int(y), int(c), row[x * channels + c]);
       }
-    }));
-  }
-  for (auto& t : workers) {
-    t.join();
-  }
+    }
+  }, n_threads);
+}
+
+template <typename T>
+ImageView<T>::ImageView(T* d, size_t w, size_t h, size_t c,
+                        size_t _row_stride)
+    : ImageView(d, w, h, c, (_row_stride > 0) ? _row_stride : w * c, c, 1) {}
+
+template <typename T>
+ImageView<T>::ImageView(T* d, size_t w, size_t h, size_t c,
+                        size_t _row_stride, size_t _pixel_stride,
+                        size_t _channel_stride)
+    : data(d),
+      width(w),
+      height(h),
+      channels(c),
+      row_stride(_row_stride),
+      pixel_stride(_pixel_stride),
+      channel_stride(_channel_stride) {}
+
+template <typename T>
+ImageView<T>::ImageView(Image<value_type>& img)
+    : ImageView(img.getData(), img.getWidth(), img.getHeight(),
+                img.getChannels()) {}
+
+template <typename T>
+template <typename U, typename>
+ImageView<T>::ImageView(const Image<U>& img)
+    : ImageView(img.getData(), img.getWidth(), img.getHeight(),
+                img.getChannels()) {}
+
+template <typename T>
+template <typename U, typename>
+ImageView<T>::ImageView(const ImageView<U>& v)
+    : ImageView(v.getData(), v.getWidth(), v.getHeight(), v.getChannels(),
+                v.getRowStride(), v.getPixelStride(), v.getChannelStride()) {}
+
+template <typename T>
+ImageView<T> ImageView<T>::roi(size_t x, size_t y, size_t w,
+                               size_t h) const {
+  return ImageView(data + y * row_stride + x * pixel_stride, w, h, channels,
+                   row_stride, pixel_stride, channel_stride);
+}
+
+template <typename T>
+void ImageView<T>::copyTo(Image<value_type>* img) const {
+  img->create(width, height, channels);
+  copyTo(img->view());
+}
+
+template <typename T>
+void ImageView<T>::copyTo(const ImageView<value_type>& dst) const {
+  const bool interleaved = isInterleaved() && dst.isInterleaved();
+  foreach_row([&](size_t y, const T* src) {
+    value_type* dst_row = dst.row(y);
+    if (interleaved) {
+      std::copy_n(src, width * channels, dst_row);
+      return;
+    }
+    for (size_t x = 0; x < width; x++) {
+      for (size_t c = 0; c < channels; c++) {
+        dst_row[x * dst.getPixelStride() + c * dst.getChannelStride()] =
+            src[x * pixel_stride + c * channel_stride];
+      }
+    }
+  });
+}
+
+template <typename T>
+template <typename F>
+void ImageView<T>::foreach_row(const F& func, uint32_t n_threads) const {
+  ParallelFor(height, [&](size_t y_begin, size_t y_end) {
+    for (size_t y = y_begin; y < y_end; y++) {
+      func(y, row(y));
+    }
+  }, 0, n_threads);
 }
@@ -19,26 +19,48 @@
 #include "ui.h"
 #endif
 
+#include "batch_scheduler.h"
 #include "face_cropper.h"
-#include "tf_predictor.h"
+#include "predictor.h"
 #include "face-data.h"
 #include "mesh.h"
 #include "face_frontalizer.h"
-
+#include "image_convert.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
 #include <chrono>
 #include <fstream>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <sstream>
+#include <string>
+#include <thread>
 
-using namespace prnet;
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <direct.h>
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
 
-template <typename T>
-inline T clamp(T f, T fmin, T fmax) {
-  return std::max(std::min(fmax, f), fmin);
-}
+using namespace prnet;
 
-static bool LoadImage(const std::string &filename, Image<float> &image) {
-  // Load image
+// Load an image file as 8-bit sRGB(no color conversion). The decoded buffer
+// is used as the image storage without copy.
+static bool LoadFrame(const std::string &filename, Image<uint8_t> &frame) {
   int width, height, channels;
   unsigned char *data = stbi_load(filename.c_str(), &width, &height, &channels,
                                   /* required channels */ 3);
@@ -47,44 +69,49 @@ static bool LoadImage(const std::string &filename, Image<float> &image) {
     return false;
   }
 
-  // Cast
-  image.create(size_t(width), size_t(height), size_t(channels));
-  image.foreach ([&](int x, int y, int c, float &v) {
-    v = static_cast<float>(data[(y * width + x) * channels + c]) / 255.f;
-    // TODO(LTE): Do we really need degamma?
-    v = std::pow(v, 2.2f);
-  });
-
-  // Free
-  stbi_image_free(data);
+  frame.create(size_t(width), size_t(height), 3,
+               std::shared_ptr<uint8_t>(data, stbi_image_free));
 
   return true;
 }
 
-static bool SaveImage(const std::string &filename, Image<float> &image, const float scale = 1.0f) {
-  const size_t height = image.getHeight();
-  const size_t width = image.getWidth();
-  const size_t channels = image.getChannels();
+static bool SaveImage(const std::string &filename,
+                      const ImageView<const uint8_t> &image) {
+  // stb_image_write takes packed pixels.
+  Image<uint8_t> packed;
+  const uint8_t *data = image.getData();
+  if (!image.isPacked()) {
+    image.copyTo(&packed);
+    data = packed.getData();
+  }
+  stbi_write_jpg(filename.c_str(), int(image.getWidth()),
+                 int(image.getHeight()), int(image.getChannels()), data, 0);
 
-  // Cast
-  std::vector<unsigned char> data(height * width * channels);
-  image.foreach ([&](int x, int y, int c, float &v) {
-    data[(size_t(y) * width + size_t(x)) * size_t(channels) + size_t(c)] =
-        static_cast<unsigned char>(clamp(scale * v * 255.f, 0.0f, 255.0f));
-  });
+  return true;
+}
 
-  // Save
-  stbi_write_jpg(filename.c_str(), int(width), int(height), int(channels),
-                 &data.at(0), 0);
+static bool SaveImage(const std::string &filename,
+                      const ImageView<const float> &image,
+                      const float scale = 1.0f) {
+  Image<uint8_t> data;
+  ConvertImage(image, &data, scale * 255.0f);
+  return SaveImage(filename, data);
+}
 
-  return true;
+// Save 8-bit sRGB `image` in linear space. `linear` is the conversion buffer.
+static bool SaveLinearImage(const std::string &filename,
+                            const ImageView<const uint8_t> &image,
+                            Image<uint8_t> *linear) {
+  ConvertImage(image, linear, 2.2f);  // sRGB -> linear
+  return SaveImage(filename, *linear);
 }
 
 // --------------------------------
 
 // Create texture map from 3D position map
-static bool CreateTexture(const Image<float> &image, const Image<float> &posmap,
-                          Image<float> *texture) {
+static bool CreateTexture(const ImageView<const uint8_t> &image,
+                          const ImageView<const float> &posmap,
+                          Image<uint8_t> *texture) {
   if (image.getWidth() != 256) {
     std::cerr << "Invalid width for Image. width must be 256 but has "
               << image.getWidth() << std::endl;
@@ -130,9 +157,8 @@ static bool CreateTexture(const Image<float> &image, const Image<float> &posmap,
   for (size_t y = 0; y < height; y++) {
     for (size_t x = 0; x < width; x++) {
       // Look up 2D position from 3D position map.
-      float vx = posmap.getData()[3 * (y * width + x) + 0];
-      float vy = posmap.getData()[3 * (y * width + x) + 1];
-      // float b = image.getData()[3 * (y * width + x) + 2];
+      float vx = posmap.fetch(x, y, 0);
+      float vy = posmap.fetch(x, y, 1);
 
       // Fetch corresponding texel color
       // No filtering(nearest neighbor point sampling)
@@ -141,16 +167,16 @@ static bool CreateTexture(const Image<float> &image, const Image<float> &posmap,
 
       if ((px < 0) || (py < 0) || (px >= int(width)) || (py >= int(height))) {
         // out-of-bounds
-        texture->getData()[3 * (y * width + x) + 0] = 0.0f;
-        texture->getData()[3 * (y * width + x) + 1] = 0.0f;
-        texture->getData()[3 * (y * width + x) + 2] = 0.0f;
+        texture->getData()[3 * (y * width + x) + 0] = 0;
+        texture->getData()[3 * (y * width + x) + 1] = 0;
+        texture->getData()[3 * (y * width + x) + 2] = 0;
       } else {
         texture->getData()[3 * (y * width + x) + 0] =
-            image.getData()[3 * (size_t(py) * width + size_t(px)) + 0];
+            image.fetch(size_t(px), size_t(py), 0);
         texture->getData()[3 * (y * width + x) + 1] =
-            image.getData()[3 * (size_t(py) * width + size_t(px)) + 1];
+            image.fetch(size_t(px), size_t(py), 1);
         texture->getData()[3 * (y * width + x) + 2] =
-            image.getData()[3 * (size_t(py) * width + size_t(px)) + 2];
+            image.fetch(size_t(px), size_t(py), 2);
       }
     }
   }
@@ -158,9 +184,11 @@ static bool CreateTexture(const Image<float> &image, const Image<float> &posmap,
   return true;
 }
 
-// Convert 3D position map(Image) to mesh using FaceData.
-static bool ConvertToMesh(const Image<float> &image, const FaceData &face_data,
+// Convert vertices gathered from 3D position map to mesh using FaceData.
+// `geometry->vertices` are moved to `mesh`(buffers are swapped).
+static bool ConvertToMesh(FaceGeometry *geometry, const FaceData &face_data,
                           Mesh *mesh) {
+  const Image<float> &image = geometry->pos_img;
   if (image.getWidth() != 256) {
     std::cerr << "Invalid width for Image. width must be 256 but has "
               << image.getWidth() << std::endl;
@@ -173,9 +201,10 @@ static bool ConvertToMesh(const Image<float> &image, const FaceData &face_data,
     return false;
   }
 
-  if (image.getChannels() != 3) {
-    std::cerr << "Invalid channels for Image. channels must be 3 but has "
-              << image.getChannels() << std::endl;
+  if (geometry->vertices.size() != 3 * face_data.face_indices.size()) {
+    std::cerr << "Invalid number of vertices. " << face_data.face_indices.size()
+              << " expected but has " << geometry->vertices.size() / 3
+              << std::endl;
     return false;
   }
 
@@ -192,22 +221,13 @@ static bool ConvertToMesh(const Image<float> &image, const FaceData &face_data,
   float bmin[3];
   float bmax[3];
 
-  // Look up vertex position from 3D position map(256x256x3)
-  mesh->vertices.clear();
+  // Vertex positions are already looked up from 3D position map(256x256x3)
+  std::swap(mesh->vertices, geometry->vertices);
   mesh->uvs.clear();
   for (size_t i = 0; i < face_data.face_indices.size(); i++) {
-    size_t idx = face_data.face_indices[i];
-
-    uint32_t px = uint32_t(idx % image.getWidth());
-    uint32_t py = uint32_t(idx / image.getHeight());
-
-    float x = image.getData()[3 * (py * image.getWidth() + px) + 0];
-    float y = image.getData()[3 * (py * image.getWidth() + px) + 1];
-    float z = image.getData()[3 * (py * image.getWidth() + px) + 2];
-
-    mesh->vertices.push_back(x);
-    mesh->vertices.push_back(y);
-    mesh->vertices.push_back(z);
+    float x = mesh->vertices[3 * i + 0];
+    float y = mesh->vertices[3 * i + 1];
+    float z = mesh->vertices[3 * i + 2];
 
     if (i == 0) {
       bmin[0] = bmax[0] = x;
@@ -260,24 +280,27 @@ static bool ConvertToMesh(const Image<float> &image, const FaceData &face_data,
                 << std::endl;
       exit(-1);
     }
-    mesh->faces.push_back(idx);
   }
+  mesh->faces.assign(face_data.triangles.begin(), face_data.triangles.end());
 
   return true;
 }
 
-// Save as wavefront .obj mesh
-static bool SaveAsWObj(const std::string &filename, prnet::Mesh &mesh) {
+// Save as wavefront .obj mesh. `vertices` replaces `mesh.vertices`(e.g.
+// frontalized vertices), uvs and faces are taken from `mesh`.
+static bool SaveAsWObj(const std::string &filename,
+                       const std::vector<float> &vertices,
+                       const prnet::Mesh &mesh) {
   std::ofstream ofs(filename);
   if (!ofs) {
     std::cerr << "Failed to open file to write : " << filename << std::endl;
     return false;
   }
 
-  for (size_t i = 0; i < mesh.vertices.size() / 3; i++) {
-    ofs << "v " << 255.0f * mesh.vertices[3 * i + 0] << " "
-        << 255.0f * mesh.vertices[3 * i + 1] << " "
-        << 255.0f * mesh.vertices[3 * i + 2] << std::endl;
+  for (size_t i = 0; i < vertices.size() / 3; i++) {
+    ofs << "v " << 255.0f * vertices[3 * i + 0] << " "
+        << 255.0f * vertices[3 * i + 1] << " "
+        << 255.0f * vertices[3 * i + 2] << std::endl;
   }
 
   for (size_t i = 0; i < mesh.uvs.size() / 2; i++) {
@@ -301,58 +324,891 @@ static bool SaveAsWObj(const std::string &filename, prnet::Mesh &mesh) {
   return true;
 }
 
-// Restore position coordinate.
-static void RemapPosition(Image<float> *pos_img, const float scale,
-                          const float shift_x, const float shift_y) {
+static bool SaveAsWObj(const std::string &filename, const prnet::Mesh &mesh) {
+  return SaveAsWObj(filename, mesh.vertices, mesh);
+}
+
+// Draw landmarks into `img` in place.
+static void DrawLandmark(const std::vector<float> &keypoints,
+                         const ImageView<uint8_t> &img, float radius = 1.f) {
+  const size_t n_pt = keypoints.size() / 3;
+  const int ksize = int(std::ceil(radius));
+  for (size_t i = 0; i < n_pt; i++) {
+    const int x = int(keypoints[3 * i + 0]);
+    const int y = int(keypoints[3 * i + 1]);
+    // Draw circle
+    for (int rx = -ksize; rx <= ksize; rx++) {
+      for (int ry = -ksize; ry <= ksize; ry++) {
+        if (radius < float(rx * rx + ry * ry)) {
+            continue;
+        }
+        const int px = x + rx;
+        const int py = y + ry;
+        if ((px < 0) || (py < 0) || (px >= int(img.getWidth())) ||
+            (py >= int(img.getHeight()))) {
+          continue;
+        }
+
+        img.fetch(size_t(px), size_t(py), 0) = 0;
+        img.fetch(size_t(px), size_t(py), 1) = 255;
+        img.fetch(size_t(px), size_t(py), 2) = 0;
+      }
+    }
+  }
+}
+
+
+// --------------------------------
+
+static std::string JoinPath(const std::string &dir,
+                            const std::string &filename) {
+  if (dir.empty()) {
+    return filename;
+  }
+
+  const char last_char = *dir.rbegin();
+  if ((last_char == '/') || (last_char == '\\')) {
+    return dir + filename;
+  }
+  return dir + "/" + filename;
+}
+
+// {"a", "b"} -> "a, b"
+static std::string JoinStrings(const std::vector<std::string> &strs) {
+  std::string joined;
+  for (size_t i = 0; i < strs.size(); i++) {
+    joined += (i > 0) ? ", " + strs[i] : strs[i];
+  }
+  return joined;
+}
+
+// "/path/to/image.jpg" -> "image.jpg"
+static std::string GetBaseName(const std::string &filename) {
+  const size_t sep = filename.find_last_of("/\\");
+  return (sep == std::string::npos) ? filename : filename.substr(sep + 1);
+}
+
+// "/path/to/image.jpg" -> "image"
+static std::string GetBaseNameWithoutExt(const std::string &filename) {
+  std::string basename = GetBaseName(filename);
+  const size_t dot = basename.find_last_of('.');
+  if ((dot != std::string::npos) && (dot > 0)) {
+    basename = basename.substr(0, dot);
+  }
+  return basename;
+}
+
+static bool HasImageExtension(const std::string &filename) {
+  const size_t dot = filename.find_last_of('.');
+  if (dot == std::string::npos) {
+    return false;
+  }
+  std::string ext = filename.substr(dot + 1);
+  std::transform(ext.begin(), ext.end(), ext.begin(),
+                 [](char c) { return char(std::tolower(c)); });
+  return (ext == "jpg") || (ext == "jpeg") || (ext == "png") ||
+         (ext == "bmp") || (ext == "tga");
+}
+
+// Read image filenames from a text file(one filename per line).
+static bool ListImagesInFile(const std::string &list_filename,
+                             std::vector<std::string> *filenames) {
+  std::ifstream ifs(list_filename);
+  if (!ifs) {
+    std::cerr << "Failed to open input list : " << list_filename << std::endl;
+    return false;
+  }
+
+  std::string line;
+  while (std::getline(ifs, line)) {
+    // Trim trailing whitespace(e.g. '\r' in CRLF files)
+    while (!line.empty() && std::isspace(static_cast<unsigned char>(*line.rbegin()))) {
+      line.erase(line.size() - 1);
+    }
+    if (line.empty() || (line[0] == '#')) {
+      continue;
+    }
+    filenames->push_back(line);
+  }
+
+  return true;
+}
+
+// List image files in a directory(non-recursive). Sorted by filename.
+static bool ListImagesInDir(const std::string &dirname,
+                            std::vector<std::string> *filenames) {
+  std::vector<std::string> names;
+#ifdef _WIN32
+  WIN32_FIND_DATAA find_data;
+  HANDLE handle = FindFirstFileA(JoinPath(dirname, "*").c_str(), &find_data);
+  if (handle == INVALID_HANDLE_VALUE) {
+    std::cerr << "Failed to open input directory : " << dirname << std::endl;
+    return false;
+  }
+  do {
+    if (!(find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+      names.push_back(find_data.cFileName);
+    }
+  } while (FindNextFileA(handle, &find_data));
+  FindClose(handle);
+#else
+  DIR *dir = opendir(dirname.c_str());
+  if (!dir) {
+    std::cerr << "Failed to open input directory : " << dirname << std::endl;
+    return false;
+  }
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    names.push_back(entry->d_name);
+  }
+  closedir(dir);
+#endif
+
+  std::sort(names.begin(), names.end());
+  for (size_t i = 0; i < names.size(); i++) {
+    if (HasImageExtension(names[i])) {
+      filenames->push_back(JoinPath(dirname, names[i]));
+    }
+  }
+
+  return true;
+}
+
+static bool MakeDirectory(const std::string &dirname) {
+#ifdef _WIN32
+  if (_mkdir(dirname.c_str()) == 0) {
+    return true;
+  }
+#else
+  if (mkdir(dirname.c_str(), 0755) == 0) {
+    return true;
+  }
+#endif
+  if (errno == EEXIST) {
+    return true;
+  }
+  std::cerr << "Failed to create output directory : " << dirname << std::endl;
+  return false;
+}
+
+// Output filenames for an input image. Empty filename = do not write.
+struct OutputFilenames {
+  std::string cropped;
+  std::string texture;
+  std::string mesh;
+  std::string landmarks;
+  std::string front_mesh;
+};
+
+// Width and height of cropped face image(network input).
+static const size_t kCropSize = 256;
+
+// Cropped face, remap parameters and network output of a face region.
+// `region` is cropped by the predictor with --in-graph-preprocess.
+struct CroppedFace {
+  Image<float> cropped_img;
+  Image<uint8_t> color_img;  // sRGB, 8-bit, dlib only. See KeepColor()
+  CropRegion region;
+  bool dlib_ret = false;
+  FaceGeometry geometry;
+};
+
+// Input frame and the faces found in it. `faces` keeps the buffers of faces
+// across images, only the first `n_faces` are valid.
+struct FaceImage {
+  Image<uint8_t> frame;  // moved out by ProcessFaces() for center crop
+  std::vector<CropRegion> regions;  // regions of the `n_faces` faces
+  std::vector<CroppedFace> faces;
+  size_t n_faces = 0;
+};
+
+// Intermediate results kept for visualization.
+struct PipelineResult {
+  Mesh mesh;
+  // Frontalized `mesh.vertices`(faces and uvs are the same as `mesh`). Empty
+  // when frontalization is not supported.
+  std::vector<float> front_vertices;
+  // 8-bit sRGB, only kept for the GUI(see ProcessFaces()). Texture and
+  // landmarks are written in linear space.
+  Image<uint8_t> color_img;
+  Image<uint8_t> texture;
+  Image<uint8_t> dbg_lmk_image;
+  Image<uint8_t> linear_img;  // Conversion buffer of SaveLinearImage()
+};
+
+//
+// Buffers of a worker reused across images(like the activation arena of the
+// native engine). Images and vectors keep their capacity, so that the
+// per-image pipeline does not allocate them once their sizes reach steady
+// state. Image decoding, file output and BatchScheduler still allocate.
+//
+struct WorkerArena {
+  FaceImage image;
+  PipelineResult result;
+
+  // ProcessBatch()
+  std::vector<FaceImage> images;
+  std::vector<OutputFilenames> outputs;
+
+  // Batched network evaluation of faces
+  std::vector<CroppedFace *> batch_faces;
+  std::vector<CropRegion> batch_regions;
+  std::vector<Image<float>> cropped_imgs;
+  std::vector<Image<float>> pos_imgs;
+  std::vector<std::future<Image<float>>> pending;  // BatchScheduler
+};
+
+// Output filenames of the `index`-th face of an image. The first face keeps
+// the filenames of the image and others get "_face<index>" before the
+// extension(e.g. "output.obj", "output_face1.obj").
+static OutputFilenames GetFaceOutputFilenames(const OutputFilenames &output,
+                                              size_t index) {
+  if (index == 0) {
+    return output;
+  }
+  const std::string suffix = "_face" + std::to_string(index);
+  auto append = [&suffix](const std::string &filename) -> std::string {
+    if (filename.empty()) {
+      return filename;
+    }
+    const size_t sep = filename.find_last_of("/\\");
+    const size_t dot = filename.find_last_of('.');
+    if ((dot == std::string::npos) ||
+        ((sep != std::string::npos) && (dot < sep))) {
+      return filename + suffix;
+    }
+    return filename.substr(0, dot) + suffix + filename.substr(dot);
+  };
+
+  OutputFilenames face_output;
+  face_output.cropped = append(output.cropped);
+  face_output.texture = append(output.texture);
+  face_output.mesh = append(output.mesh);
+  face_output.landmarks = append(output.landmarks);
+  face_output.front_mesh = append(output.front_mesh);
+  return face_output;
+}
+
+// Keep the cropped image as the color image for texture and landmarks of a
+// dlib face, as 8-bit sRGB. Linear 8-bit would lose dark tones, linear values
+// are decoded from it with a table where needed. Center crop uses the input
+// frame itself(see ProcessFaces()), so nothing is kept.
+static void KeepColor(CroppedFace *face) {
+  if (face->dlib_ret) {
+    ConvertImage(face->cropped_img, &face->color_img, 255.0f,
+                 1.0f / 2.2f);  // linear -> sRGB
+  }
+}
+
+// Load an image file and detect up to `max_faces`(0 = all) face regions
+// without cropping. When no face is detected, the image center is used.
+static bool LoadFaceRegions(const std::string &image_filename,
+                            FaceCropper &cropper, size_t max_faces,
+                            FaceImage *image) {
+  std::cout << "Loading image \"" << image_filename << "\"" << std::endl;
+
+  if (!LoadFrame(image_filename, image->frame)) {
+    return false;
+  }
+
+  std::vector<CropRegion> &regions = image->regions;
+  const bool dlib_ret = cropper.detect_dlib(image->frame, &regions);
+  if (!dlib_ret) {
+#ifdef USE_DLIB
+    std::cout << "Failed to detect face " << std::endl;
+#else
+    std::cout << "Crop image at the image center " << std::endl;
+#endif
+    regions.resize(1);
+    cropper.center_region(image->frame.getWidth(), image->frame.getHeight(),
+                          &regions[0]);
+  } else if (regions.size() > 1) {
+    std::cout << "Detected " << regions.size() << " faces" << std::endl;
+  }
+
+  const size_t n = (max_faces > 0) ? std::min(max_faces, regions.size())
+                                   : regions.size();
+  if (image->faces.size() < n) {
+    image->faces.resize(n);
+  }
+  regions.resize(n);
+  for (size_t i = 0; i < n; i++) {
+    image->faces[i].region = regions[i];
+    image->faces[i].dlib_ret = dlib_ret;
+  }
+  image->n_faces = n;
+
+  return true;
+}
+
+// Keep the color image of the `index`-th face after cropping, and save the
+// cropped image when requested.
+static void KeepCroppedFace(const OutputFilenames &output, size_t index,
+                            CroppedFace *face) {
+  KeepColor(face);
+  if (!output.cropped.empty()) {
+    SaveImage(GetFaceOutputFilenames(output, index).cropped,
+              face->cropped_img);
+  }
+}
+
+// Load an image file and crop its face regions(see LoadFaceRegions()).
+static bool LoadAndCropFaces(const std::string &image_filename,
+                             const OutputFilenames &output,
+                             FaceCropper &cropper, size_t max_faces,
+                             FaceImage *image) {
+  if (!LoadFaceRegions(image_filename, cropper, max_faces, image)) {
+    return false;
+  }
+
+  for (size_t i = 0; i < image->n_faces; i++) {
+    CroppedFace &face = image->faces[i];
+    // Crop Image. The 8-bit frame is converted to linear color space while
+    // sampling, directly into the network input.
+    // TODO(LTE): Do we really need degamma?
+    CropImage(image->frame, face.region, kCropSize, kCropSize,
+              &face.cropped_img, 2.2f);  // sRGB -> linear
+    KeepCroppedFace(output, i, &face);
+  }
+
+  return true;
+}
+
+// Crop all face regions of `image->frame` with one preprocess() call(a
+// single Session::Run with in-graph preprocessing).
+static bool PreprocessFaces(Predictor &predictor, const OutputFilenames &output,
+                            FaceImage *image, WorkerArena *arena) {
+  std::vector<Image<float>> &cropped_imgs = arena->cropped_imgs;
+  if (!predictor.preprocess(image->frame, image->regions, &cropped_imgs)) {
+    std::cerr << "Failed to preprocess image." << std::endl;
+    return false;
+  }
+  for (size_t i = 0; i < image->n_faces; i++) {
+    CroppedFace &face = image->faces[i];
+    std::swap(face.cropped_img, cropped_imgs[i]);
+    KeepCroppedFace(output, i, &face);
+  }
+  return true;
+}
+
+// Maps network output to the coordinates of the color image used for texture
+// and landmarks(cropped image for dlib, input image for center crop).
+static PositionRemap GetPositionRemap(const CroppedFace &face) {
+  // kMaxPos comes from `MaxPos` of PosPrediction class in PRNet repo.
+  const float kMaxPos = float(kCropSize) * 1.1f;
+  PositionRemap remap;
+  remap.scale = kMaxPos;
+  if (!face.dlib_ret) {
+    remap.scale = face.region.scale * kMaxPos;
+    remap.shift_x = face.region.shift_x;
+    remap.shift_y = face.region.shift_y;
+  }
+  return remap;
+}
+
+// Crop, predict and postprocess the face region of `frame` at once.
+static bool PredictFace(Predictor &predictor, const OutputFilenames &output,
+                        const Image<uint8_t> &frame, CroppedFace *face) {
+  if (!predictor.predict_frame(frame, face->region, &face->cropped_img,
+                               GetPositionRemap(*face), &face->geometry)) {
+    return false;
+  }
+  KeepColor(face);
+  if (!output.cropped.empty()) {
+    SaveImage(output.cropped, face->cropped_img);
+  }
+  return true;
+}
+
+// Evaluate cropped images of faces[start, end) with a single batched network
+// evaluation into `geometry.pos_img` of the faces(not postprocessed).
+// Cropped images are moved to the network input(buffers are swapped).
+static bool PredictBatch(Predictor &predictor,
+                         const std::vector<CroppedFace *> &faces,
+                         size_t start, size_t end, WorkerArena *arena) {
+  const size_t n = end - start;
+  std::vector<Image<float>> &cropped_imgs = arena->cropped_imgs;
+  cropped_imgs.resize(n);
+  for (size_t i = 0; i < n; i++) {
+    std::swap(cropped_imgs[i], faces[start + i]->cropped_img);
+  }
+
+  std::vector<Image<float>> &pos_imgs = arena->pos_imgs;
+  if (!predictor.predict(cropped_imgs, pos_imgs)) {
+    std::cerr << "Failed to run network." << std::endl;
+    return false;
+  }
+  for (size_t i = 0; i < n; i++) {
+    std::swap(faces[start + i]->geometry.pos_img, pos_imgs[i]);
+  }
+  return true;
+}
+
+// Postprocess network output of the faces of `image`.
+static bool PostprocessFaces(Predictor &predictor, FaceImage *image) {
+  bool ok = true;
+  for (size_t i = 0; i < image->n_faces; i++) {
+    CroppedFace &face = image->faces[i];
+    ok = predictor.postprocess(GetPositionRemap(face), &face.geometry) && ok;
+  }
+  return ok;
+}
+
+//
+// Network evaluation and postprocessing of the faces of `image`. A single
+// face is evaluated with predict_geometry()(predict_frame() with
+// `in_graph_preprocess`), and faces of a group photo with batched predict()
+// of up to `batch_size` faces(batched predict_frame() with
+// `in_graph_preprocess`, cropping and predicting in one run).
+//
+static bool PredictFaces(Predictor &predictor, const OutputFilenames &output,
+                         bool in_graph_preprocess, size_t batch_size,
+                         FaceImage *image, WorkerArena *arena) {
+  if (image->n_faces == 1) {
+    CroppedFace &face = image->faces[0];
+    if (in_graph_preprocess) {
+      return PredictFace(predictor, output, image->frame, &face);
+    }
+    return predictor.predict_geometry(face.cropped_img,
+                                      GetPositionRemap(face), &face.geometry);
+  }
+
+  if (in_graph_preprocess) {
+    std::vector<CropRegion> &regions = arena->batch_regions;
+    for (size_t i = 0; i < image->n_faces; i += batch_size) {
+      const size_t end = std::min(i + batch_size, image->n_faces);
+      regions.assign(image->regions.begin() + long(i),
+                     image->regions.begin() + long(end));
+      if (!predictor.predict_frame(image->frame, regions, &arena->cropped_imgs,
+                                   &arena->pos_imgs)) {
+        std::cerr << "Failed to run network." << std::endl;
+        return false;
+      }
+      for (size_t j = i; j < end; j++) {
+        CroppedFace &face = image->faces[j];
+        std::swap(face.cropped_img, arena->cropped_imgs[j - i]);
+        std::swap(face.geometry.pos_img, arena->pos_imgs[j - i]);
+        KeepCroppedFace(output, j, &face);
+      }
+    }
+    return PostprocessFaces(predictor, image);
+  }
+
+  std::vector<CroppedFace *> &faces = arena->batch_faces;
+  faces.clear();
+  for (size_t i = 0; i < image->n_faces; i++) {
+    faces.push_back(&image->faces[i]);
+  }
+  for (size_t i = 0; i < faces.size(); i += batch_size) {
+    const size_t end = std::min(i + batch_size, faces.size());
+    if (!PredictBatch(predictor, faces, i, end, arena)) {
+      return false;
+    }
+  }
+  return PostprocessFaces(predictor, image);
+}
+
+// Texture -> mesh -> landmarks -> frontalization from the postprocessed
+// network output(see Predictor::postprocess()).
+// `color_img`(8-bit sRGB) is moved to `result`(buffers are swapped). With
+// `keep_color`, it is kept as `result->color_img` and landmarks are drawn
+// into a copy. Otherwise landmarks are drawn into it directly.
+static bool ProcessPosition(CroppedFace *face, Image<uint8_t> *color_img,
+                            const OutputFilenames &output,
+                            const FaceData &face_data, bool keep_color,
+                            PipelineResult *result) {
+  FaceGeometry *geometry = &face->geometry;
+
+  bool has_texture =
+      CreateTexture(*color_img, geometry->pos_img, &result->texture);
+  if (has_texture && !output.texture.empty()) {
+    SaveLinearImage(output.texture, result->texture, &result->linear_img);
+  }
+
+  // Create mesh
+  if (!ConvertToMesh(geometry, face_data, &result->mesh)) {
+    std::cerr << "failed to convert result image to mesh." << std::endl;
+    return false;
+  }
+
+  if (!output.mesh.empty()) {
+    SaveAsWObj(output.mesh, result->mesh);
+  }
+
+  // Draw landmarks
+  if (keep_color) {
+    std::swap(result->color_img, *color_img);
+    result->dbg_lmk_image = result->color_img;  // copy
+  } else {
+    std::swap(result->dbg_lmk_image, *color_img);
+  }
+  DrawLandmark(geometry->keypoints, result->dbg_lmk_image);
+  if (!output.landmarks.empty()) {
+    SaveLinearImage(output.landmarks, result->dbg_lmk_image,
+                    &result->linear_img);
+  }
+
+  // Frontizlization. Without support, the input mesh is written as is.
+  if (!FrontalizeFaceMesh(result->mesh, face_data, &result->front_vertices)) {
+    result->front_vertices.clear();
+  }
+  if (!output.front_mesh.empty()) {
+    SaveAsWObj(output.front_mesh,
+               result->front_vertices.empty() ? result->mesh.vertices
+                                              : result->front_vertices,
+               result->mesh);
+  }
+
+  return true;
+}
+
+// ProcessPosition() of all faces of `image`, writing one set of outputs per
+// face(see GetFaceOutputFilenames()). `result` holds the first face on
+// return(`keep_color` keeps its color image, e.g. for the GUI).
+// A face cropped at the image center samples its texture from the frame, so
+// the frame is moved to the result instead of copied. It is the only face of
+// the image then; other faces sharing it(not the last one processed) get a
+// copy.
+static bool ProcessFaces(FaceImage *image, const OutputFilenames &output,
+                         const FaceData &face_data, bool keep_color,
+                         PipelineResult *result) {
+  bool ok = true;
+  for (size_t i = image->n_faces; i-- > 0;) {
+    CroppedFace &face = image->faces[i];
+    Image<uint8_t> *color_img = &face.color_img;
+    if (!face.dlib_ret && (i == 0)) {
+      color_img = &image->frame;
+    } else if (!face.dlib_ret) {
+      ImageView<const uint8_t>(image->frame).copyTo(color_img);
+    }
+    ok = ProcessPosition(&face, color_img, GetFaceOutputFilenames(output, i),
+                         face_data, keep_color, result) &&
+         ok;
+  }
+  return ok;
+}
+
+//
+// Output path prefix(`<output-dir>/<basename>`) of each input image. Images
+// whose basenames without extension collide("a.jpg" and "a.png", or
+// "x/a.jpg" and "y/a.jpg") keep the extension("a.jpg"), and get the index in
+// the input list appended("a.jpg_3") if that still collides. Otherwise they
+// would overwrite each other's outputs(or be written by two workers at once).
+//
+static std::vector<std::string> GetBatchOutputPrefixes(
+    const std::string &output_dirname,
+    const std::vector<std::string> &image_filenames) {
+  std::vector<std::string> names(image_filenames.size());
+  std::map<std::string, size_t> counts;
+  for (size_t i = 0; i < image_filenames.size(); i++) {
+    names[i] = GetBaseNameWithoutExt(image_filenames[i]);
+    counts[names[i]]++;
+  }
+  std::map<std::string, size_t> full_counts;
+  for (size_t i = 0; i < image_filenames.size(); i++) {
+    if (counts[names[i]] > 1) {
+      names[i] = GetBaseName(image_filenames[i]);
+    }
+    full_counts[names[i]]++;
+  }
+
+  std::vector<std::string> prefixes(image_filenames.size());
+  for (size_t i = 0; i < image_filenames.size(); i++) {
+    if (full_counts[names[i]] > 1) {
+      names[i] += "_" + std::to_string(i);
+    }
+    if (names[i] != GetBaseNameWithoutExt(image_filenames[i])) {
+      std::cout << "Outputs of \"" << image_filenames[i] << "\" are named \""
+                << names[i] << "\" to avoid a name collision" << std::endl;
+    }
+    prefixes[i] = JoinPath(output_dirname, names[i]);
+  }
+  return prefixes;
+}
+
+// Output filenames of an image from its prefix(see GetBatchOutputPrefixes()).
+static OutputFilenames GetBatchOutputFilenames(const std::string &prefix) {
+  OutputFilenames output;
+  output.texture = prefix + "_texture.jpg";
+  output.mesh = prefix + ".obj";
+  output.landmarks = prefix + "_landmarks.jpg";
+  output.front_mesh = prefix + "_front.obj";
 
-  size_t n = pos_img->getWidth() * pos_img->getHeight();
+  return output;
+}
 
-  // // DBG
-  //  for (size_t i = 0; i < 10; i++) {
-  //   float x = pos_img->getData()[3 * i + 0];
-  //   float y = pos_img->getData()[3 * i + 1];
-  //   float z = pos_img->getData()[3 * i + 2];
-  // 
-  //   std::cout << "Org [" << i << "] = " << x << ", " << y << ", " << z <<
-  //   std::endl;
-  // }
+//
+// Process images[start, end) with batched network evaluations of their faces,
+// up to `batch_size` faces per evaluation. Returns the number of images failed
+// to process.
+//
+static size_t ProcessBatch(const std::vector<std::string> &image_filenames,
+                           size_t start, size_t end,
+                           const std::vector<std::string> &output_prefixes,
+                           FaceCropper &cropper, Predictor &predictor,
+                           const FaceData &face_data, size_t max_faces,
+                           size_t batch_size, bool in_graph_preprocess,
+                           WorkerArena *arena) {
+  size_t n_failed = 0;
+
+  std::vector<FaceImage> &images = arena->images;
+  std::vector<OutputFilenames> &outputs = arena->outputs;
+  if (images.size() < end - start) {
+    images.resize(end - start);
+    outputs.resize(end - start);
+  }
+  std::vector<CroppedFace *> &faces = arena->batch_faces;
+  faces.clear();
+  size_t n = 0;  // images loaded
+  for (size_t i = start; i < end; i++) {
+    outputs[n] = GetBatchOutputFilenames(output_prefixes[i]);
+    FaceImage &image = images[n];
+    const bool loaded =
+        in_graph_preprocess
+            ? (LoadFaceRegions(image_filenames[i], cropper, max_faces,
+                               &image) &&
+               PreprocessFaces(predictor, outputs[n], &image, arena))
+            : LoadAndCropFaces(image_filenames[i], outputs[n], cropper,
+                               max_faces, &image);
+    if (!loaded) {
+      std::cerr << "Failed to process " << image_filenames[i] << std::endl;
+      n_failed++;
+      continue;
+    }
+    for (size_t f = 0; f < image.n_faces; f++) {
+      faces.push_back(&image.faces[f]);
+    }
+    n++;
+  }
+
+  if (n == 0) {
+    return n_failed;
+  }
+
+  for (size_t i = 0; i < faces.size(); i += batch_size) {
+    const size_t faces_end = std::min(i + batch_size, faces.size());
+    std::cout << "Start running network(batch size " << (faces_end - i)
+              << ")... " << std::endl << std::flush;
+    auto startT = std::chrono::system_clock::now();
+    if (!PredictBatch(predictor, faces, i, faces_end, arena)) {
+      return n_failed + n;
+    }
+    auto endT = std::chrono::system_clock::now();
+    std::chrono::duration<double, std::milli> ms = endT - startT;
+    std::cout << "Ran network. elapsed = " << ms.count() << " [ms] "
+              << std::endl;
+  }
 
   for (size_t i = 0; i < n; i++) {
-    float x = pos_img->getData()[3 * i + 0];
-    float y = pos_img->getData()[3 * i + 1];
-    float z = pos_img->getData()[3 * i + 2];
+    if (!PostprocessFaces(predictor, &images[i]) ||
+        !ProcessFaces(&images[i], outputs[i], face_data, false,
+                      &arena->result)) {
+      n_failed++;
+    }
+  }
+
+  return n_failed;
+}
 
-    pos_img->getData()[3 * i + 0] = x * scale + shift_x;
-    pos_img->getData()[3 * i + 1] = y * scale + shift_y;
-    pos_img->getData()[3 * i + 2] = z * scale; // TODO(LTE): Do we need z offset?
+// Network evaluation and postprocessing of the faces of an image used by a
+// worker thread. Input is `cropped_img` of the faces, or `image->frame` with
+// --in-graph-preprocess.
+typedef std::function<bool(size_t worker_id, FaceImage *image,
+                           WorkerArena *arena)>
+    PredictFunction;
+
+// Allocate network input buffer for a worker thread.
+typedef std::function<void(size_t worker_id, Image<float> *cropped_img)>
+    AllocateInputFunction;
+
+//
+// Process images with `n_jobs` worker threads. Each worker crops the faces of
+// its image and evaluates them with `predict_fn`. Returns the number of images
+// failed to process. `allocate_fn` is optional and allocates the input of the
+// first face. With `in_graph_preprocess`, workers only detect the face regions
+// and `predict_fn` crops them. `min_face_size` is for the face detector of
+// each worker(see FaceCropper).
+//
+static size_t ProcessConcurrently(
+    const std::vector<std::string> &image_filenames,
+    const std::vector<std::string> &output_prefixes,
+    const PredictFunction &predict_fn,
+    const AllocateInputFunction &allocate_fn, const FaceData &face_data,
+    size_t n_jobs, size_t max_faces, size_t min_face_size,
+    bool in_graph_preprocess) {
+  std::atomic<size_t> next_index(0);
+  std::atomic<size_t> n_failed(0);
+
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < n_jobs; t++) {
+    workers.emplace_back(std::thread([&, t]() {
+      // dlib detector is not shared between threads.
+      FaceCropper cropper(min_face_size);
+      WorkerArena arena;
+      FaceImage &image = arena.image;
+
+      size_t i = 0;
+      while ((i = next_index++) < image_filenames.size()) {
+        OutputFilenames output = GetBatchOutputFilenames(output_prefixes[i]);
+        bool loaded = false;
+        if (in_graph_preprocess) {
+          loaded = LoadFaceRegions(image_filenames[i], cropper, max_faces,
+                                   &image);
+        } else {
+          if (allocate_fn) {
+            if (image.faces.empty()) {
+              image.faces.resize(1);
+            }
+            allocate_fn(t, &image.faces[0].cropped_img);
+          }
+          loaded = LoadAndCropFaces(image_filenames[i], output, cropper,
+                                    max_faces, &image);
+        }
+        if (!loaded) {
+          std::cerr << "Failed to process " << image_filenames[i] << std::endl;
+          n_failed++;
+          continue;
+        }
+
+        if (!predict_fn(t, &image, &arena)) {
+          std::cerr << "Failed to run network for " << image_filenames[i]
+                    << std::endl;
+          n_failed++;
+          continue;
+        }
+
+        if (!ProcessFaces(&image, output, face_data, false, &arena.result)) {
+          n_failed++;
+        }
+      }
+    }));
   }
+  for (auto &t : workers) {
+    t.join();
+  }
+
+  return n_failed;
 }
 
-static void DrawLandmark(const Image<float> &cropped_img,
-                         const Image<float> &pos_img,
-                         const FaceData& face_data,
-                         Image<float> *out_img, float radius = 1.f) {
-  *out_img = cropped_img;  // copy
+// Errors of a graph against the reference graph, in pixels of the cropped
+// image.
+struct ValidationError {
+  double pos_max = 0.0;  // posmap(x, y, z)
+  double pos_sum = 0.0;
+  size_t pos_count = 0;
+  double lmk_max = 0.0;  // 68 landmarks(distance in x-y plane)
+  double lmk_sum = 0.0;
+  size_t lmk_count = 0;
+
+  void add(const ValidationError &e) {
+    pos_max = std::max(pos_max, e.pos_max);
+    pos_sum += e.pos_sum;
+    pos_count += e.pos_count;
+    lmk_max = std::max(lmk_max, e.lmk_max);
+    lmk_sum += e.lmk_sum;
+    lmk_count += e.lmk_count;
+  }
+
+  double pos_mean() const { return pos_count ? pos_sum / double(pos_count) : 0.0; }
+  double lmk_mean() const { return lmk_count ? lmk_sum / double(lmk_count) : 0.0; }
+};
+
+static ValidationError ComputePositionError(const Image<float> &ref_pos_img,
+                                            const Image<float> &pos_img,
+                                            const FaceData &face_data) {
+  // Same scale as ProcessPosition(without crop remapping).
+  const double kMaxPos = double(ref_pos_img.getWidth()) * 1.1;
+
+  ValidationError err;
+  const size_t n = ref_pos_img.getWidth() * ref_pos_img.getHeight() *
+                   ref_pos_img.getChannels();
+  const float *ref = ref_pos_img.getData();
+  const float *val = pos_img.getData();
+  for (size_t i = 0; i < n; i++) {
+    const double d = std::fabs(double(ref[i]) - double(val[i])) * kMaxPos;
+    err.pos_max = std::max(err.pos_max, d);
+    err.pos_sum += d;
+  }
+  err.pos_count = n;
+
   const size_t n_pt = face_data.uv_kpt_indices.size() / 2;
-  const int ksize = int(std::ceil(radius));
   for (size_t i = 0; i < n_pt; i++) {
     const uint32_t x_idx = face_data.uv_kpt_indices[i];
     const uint32_t y_idx = face_data.uv_kpt_indices[i + n_pt];
-    const int x = int(pos_img.fetch(x_idx, y_idx, 0));
-    const int y = int(pos_img.fetch(x_idx, y_idx, 1));
-    // Draw circle
-    for (int rx = -ksize; rx <= ksize; rx++) {
-      for (int ry = -ksize; ry <= ksize; ry++) {
-        if (radius < float(rx * rx + ry * ry)) {
-            continue;
-        }
-        
-        out_img->fetch(size_t(x + rx), size_t(y + ry), 0) = 0;
-        out_img->fetch(size_t(x + rx), size_t(y + ry), 1) = 255;
-        out_img->fetch(size_t(x + rx), size_t(y + ry), 2) = 0;
-      }
+    const double dx = double(ref_pos_img.fetch(x_idx, y_idx, 0)) -
+                      double(pos_img.fetch(x_idx, y_idx, 0));
+    const double dy = double(ref_pos_img.fetch(x_idx, y_idx, 1)) -
+                      double(pos_img.fetch(x_idx, y_idx, 1));
+    const double d = std::sqrt(dx * dx + dy * dy) * kMaxPos;
+    err.lmk_max = std::max(err.lmk_max, d);
+    err.lmk_sum += d;
+  }
+  err.lmk_count = n_pt;
+
+  return err;
+}
+
+//
+// Compare posmaps and landmarks of `predictor`(e.g. quantized graph) against
+// `ref_predictor`(FP32 graph) on the input images. Returns false when an image
+// fails or the mean landmark error exceeds `max_landmark_error`(<= 0 = no
+// limit).
+//
+static bool ValidatePredictor(const std::vector<std::string> &image_filenames,
+                              FaceCropper &cropper, Predictor &ref_predictor,
+                              Predictor &predictor, const FaceData &face_data,
+                              double max_landmark_error) {
+  ValidationError total;
+  size_t n_failed = 0;
+  for (size_t i = 0; i < image_filenames.size(); i++) {
+    // The first face of each image.
+    FaceImage image;
+    if (!LoadAndCropFaces(image_filenames[i], OutputFilenames(), cropper, 1,
+                          &image)) {
+      n_failed++;
+      continue;
+    }
+    const CroppedFace &face = image.faces[0];
+    Image<float> ref_pos_img;
+    Image<float> pos_img;
+    if (!ref_predictor.predict(face.cropped_img, ref_pos_img) ||
+        !predictor.predict(face.cropped_img, pos_img)) {
+      std::cerr << "Failed to run network for " << image_filenames[i]
+                << std::endl;
+      n_failed++;
+      continue;
+    }
+    if ((pos_img.getWidth() != ref_pos_img.getWidth()) ||
+        (pos_img.getHeight() != ref_pos_img.getHeight()) ||
+        (pos_img.getChannels() != ref_pos_img.getChannels())) {
+      std::cerr << "Output shape mismatch for " << image_filenames[i]
+                << std::endl;
+      n_failed++;
+      continue;
     }
+
+    const ValidationError err =
+        ComputePositionError(ref_pos_img, pos_img, face_data);
+    std::cout << image_filenames[i] << " : posmap max/mean = " << err.pos_max
+              << "/" << err.pos_mean() << ", landmark max/mean = "
+              << err.lmk_max << "/" << err.lmk_mean() << " [px]" << std::endl;
+    total.add(err);
   }
+
+  std::cout << "Validated " << (image_filenames.size() - n_failed) << "/"
+            << image_filenames.size() << " images(errors in pixels of "
+            << kCropSize << "x" << kCropSize << " crop)" << std::endl;
+  std::cout << "  posmap   max/mean = " << total.pos_max << "/"
+            << total.pos_mean() << std::endl;
+  std::cout << "  landmark max/mean = " << total.lmk_max << "/"
+            << total.lmk_mean() << std::endl;
+
+  if ((max_landmark_error > 0.0) && (total.lmk_mean() > max_landmark_error)) {
+    std::cerr << "Mean landmark error exceeds " << max_landmark_error
+              << " [px]" << std::endl;
+    return false;
+  }
+  return n_failed == 0;
 }
 
 // --------------------------------
@@ -365,18 +1221,77 @@ int main(int argc, char **argv) {
   cxxopts::Options options("prnet-infer", "PRNet infererence in C++");
   options.add_options()("i,image", "Input image file",
                         cxxopts::value<std::string>())(
+      "input-list", "Text file listing input image files(one per line)",
+      cxxopts::value<std::string>())(
+      "input-dir", "Directory containing input image files",
+      cxxopts::value<std::string>())(
+      "o,output-dir", "Output directory for --input-list/--input-dir",
+      cxxopts::value<std::string>()->default_value("."))(
+      "batch-size", "The max number of faces evaluated at once in batch mode",
+      cxxopts::value<int>()->default_value("1"))(
+      "max-faces",
+      "Max number of faces processed per image(0 = all detected faces)",
+      cxxopts::value<int>()->default_value("0"))(
+      "min-face-size",
+      "Smallest face in pixels found by dlib(values below 80 are clamped to "
+      "80). The detector runs on the image downscaled by floor(N / 80)",
+      cxxopts::value<int>()->default_value("80"))(
+      "j,jobs", "The number of worker threads in batch mode",
+      cxxopts::value<int>()->default_value("1"))(
+      "threads",
+      "Threads shared by image processing and native engine(0 = # of cores)",
+      cxxopts::value<int>()->default_value("0"))(
+      "batch-deadline",
+      "Max queueing delay in [ms] before a partial batch is evaluated(--jobs > 1)",
+      cxxopts::value<double>()->default_value("5"))(
+      "profile",
+      "TensorFlow threading preset. \"latency\" or \"throughput\"",
+      cxxopts::value<std::string>())(
+      "intra-op-threads", "The number of TensorFlow intra-op threads",
+      cxxopts::value<int>())(
+      "inter-op-threads", "The number of TensorFlow inter-op threads",
+      cxxopts::value<int>())(
+      "per-session-threads", "Use per-session TensorFlow thread pools")(
+      "global-pool", "Share one inter-op thread pool among all sessions")(
+      "optimize-graph",
+      "Optimize graph at load time(fold constants and batch norms)")(
+      "memmapped", "Graph file is in TensorFlow memmapped format")(
+      "in-graph-preprocess",
+      "Feed 8-bit frames and crop/resize face in the graph(CropAndResize)")(
+      "in-graph-postprocess",
+      "Remap posmap and gather mesh vertices/landmarks in the graph")(
+      "backend", "Network backend(" + JoinStrings(GetPredictorBackends()) + ")",
+      cxxopts::value<std::string>()->default_value(GetPredictorBackends()[0]))(
+      "synthetic-latency",
+      "Fake network time per image in [ms] for synthetic backend",
+      cxxopts::value<double>()->default_value("0"))(
+      "validate-graph",
+      "Compare posmaps and landmarks of this graph(e.g. quantized) against --graph",
+      cxxopts::value<std::string>())(
+      "max-landmark-error",
+      "Fail --validate-graph when mean landmark error exceeds this value[px]",
+      cxxopts::value<double>()->default_value("0"))(
       "g,graph", "Input freezed graph file", cxxopts::value<std::string>())(
       "d,data", "Data folder of PRNet repo", cxxopts::value<std::string>());
 
   auto result = options.parse(argc, argv);
 
-  if (!result.count("image")) {
-    std::cerr << "Please specify input image with -i or --image option."
+  // Before any image processing, which creates the shared thread pool.
+  SetNumThreads(size_t(std::max(0, result["threads"].as<int>())));
+
+  const bool batch_mode = result.count("input-list") || result.count("input-dir");
+
+  if (!result.count("image") && !batch_mode) {
+    std::cerr << "Please specify input image with -i or --image option"
+              << "(or --input-list/--input-dir for batch processing)."
               << std::endl;
     return -1;
   }
 
-  if (!result.count("graph")) {
+  // AOT backend has the graph compiled in. Synthetic backend has no graph.
+  const std::string backend = result["backend"].as<std::string>();
+  const bool use_graph = (backend != "aot") && (backend != "synthetic");
+  if (use_graph && !result.count("graph")) {
     std::cerr << "Please specify freezed graph with -g or --graph option."
               << std::endl;
     return -1;
@@ -389,15 +1304,86 @@ int main(int argc, char **argv) {
     return -1;
   }
 
-  std::string image_filename = result["image"].as<std::string>();
-  std::string graph_filename = result["graph"].as<std::string>();
+  std::string graph_filename;
+  if (result.count("graph")) {
+    graph_filename = result["graph"].as<std::string>();
+  }
   std::string data_dirname = result["data"].as<std::string>();
 
-  // Load image
-  std::cout << "Loading image \"" << image_filename << "\"" << std::endl;
+  std::vector<std::string> image_filenames;
+  if (result.count("image")) {
+    image_filenames.push_back(result["image"].as<std::string>());
+  }
+  if (result.count("input-list")) {
+    if (!ListImagesInFile(result["input-list"].as<std::string>(),
+                          &image_filenames)) {
+      return -1;
+    }
+  }
+  if (result.count("input-dir")) {
+    if (!ListImagesInDir(result["input-dir"].as<std::string>(),
+                         &image_filenames)) {
+      return -1;
+    }
+  }
 
-  Image<float> inp_img;
-  if (!LoadImage(image_filename, inp_img)) {
+  std::string output_dirname = result["output-dir"].as<std::string>();
+  const size_t batch_size = size_t(std::max(1, result["batch-size"].as<int>()));
+  const size_t n_jobs = size_t(std::max(1, result["jobs"].as<int>()));
+  const size_t max_faces = size_t(std::max(0, result["max-faces"].as<int>()));
+  size_t min_face_size =
+      size_t(std::max(1, result["min-face-size"].as<int>()));
+  if (min_face_size < FaceCropper::kDetectorFaceSize) {
+    // The detector is not run on an upscaled image.
+    std::cerr << "--min-face-size is clamped to "
+              << FaceCropper::kDetectorFaceSize << "(dlib finds faces of "
+              << FaceCropper::kDetectorFaceSize << " pixels and larger)."
+              << std::endl;
+    min_face_size = FaceCropper::kDetectorFaceSize;
+  }
+  const double batch_deadline_ms = result["batch-deadline"].as<double>();
+
+  // Preset first, then individual options override it.
+  SessionConfig session_config;
+  std::string profile;
+  if (result.count("profile")) {
+    profile = result["profile"].as<std::string>();
+    if (!GetSessionConfigPreset(profile, &session_config)) {
+      return -1;
+    }
+  }
+  if (result.count("intra-op-threads")) {
+    session_config.intra_op_threads = result["intra-op-threads"].as<int>();
+  }
+  if (result.count("inter-op-threads")) {
+    session_config.inter_op_threads = result["inter-op-threads"].as<int>();
+  }
+  if (result.count("per-session-threads")) {
+    session_config.use_per_session_threads = true;
+  }
+  if (result.count("global-pool")) {
+    session_config.use_global_pool = true;
+  }
+  if (session_config.use_per_session_threads &&
+      session_config.use_global_pool) {
+    std::cerr << "--per-session-threads(or --profile throughput) and "
+                 "--global-pool cannot be used together."
+              << std::endl;
+    return -1;
+  }
+  if (result.count("optimize-graph")) {
+    session_config.optimize_graph = true;
+  }
+  if (result.count("memmapped")) {
+    session_config.use_memmapped_graph = true;
+  }
+  if (result.count("in-graph-preprocess")) {
+    session_config.in_graph_preprocess = true;
+  }
+  if (result.count("in-graph-postprocess")) {
+    session_config.in_graph_postprocess = true;
+  }
+  if (batch_mode && !MakeDirectory(output_dirname)) {
     return -1;
   }
 
@@ -407,84 +1393,215 @@ int main(int argc, char **argv) {
     return -1;
   }
 
-  // Crop Image.
-  Image<float> cropped_img;
-  FaceCropper cropper;
-  float crop_scale = 1.f, crop_shift_x = 0.f, crop_shift_y = 0.f;
-  bool dlib_ret = cropper.crop_dlib(inp_img, cropped_img, &crop_scale,
-                                    &crop_shift_x, &crop_shift_y);
-  if (!dlib_ret) {
-#ifdef USE_DLIB
-    std::cout << "Failed to detect face " << std::endl;
-#else
-    std::cout << "Crop image at the image center " << std::endl;
-#endif
-    // Crop center
-    cropper.crop_center(inp_img, cropped_img, &crop_scale, &crop_shift_x,
-                        &crop_shift_y);
-  }
-  SaveImage("dbg_cropped_img.jpg", cropped_img);
-
-  // Predict
-  TensorflowPredictor tf_predictor;
-  tf_predictor.init(argc, argv);
-  std::cout << "Initialized" << std::endl;
-  tf_predictor.load(graph_filename, "Placeholder",
-                    "resfcn256/Conv2d_transpose_16/Sigmoid");
-  std::cout << "Loaded model" << std::endl;
-  Image<float> pos_img;
-
-  std::cout << "Start running network... " << std::endl << std::flush;
-  auto startT = std::chrono::system_clock::now();
-  tf_predictor.predict(cropped_img, pos_img);
-  auto endT = std::chrono::system_clock::now();
-  std::chrono::duration<double, std::milli> ms = endT - startT;
-  std::cout << "Ran network. elapsed = " << ms.count() << " [ms] " << std::endl;
-
-  // kMaxPos comes from `MaxPos` of PosPrediction class in PRNet repo.
-  const float kMaxPos = pos_img.getWidth() * 1.1f;
-  if (dlib_ret) {
-    RemapPosition(&pos_img, kMaxPos, 0.0f, 0.0f);
-  } else {
-    //std::cout << "crop_scale = " << crop_scale << std::endl;
-    //std::cout << "crop_shift = " << crop_shift_x << ", " << crop_shift_y << std::endl;
-    RemapPosition(&pos_img, crop_scale * kMaxPos, crop_shift_x, crop_shift_y);
-  }
-
-  Image<float> color_img = dlib_ret ? cropped_img : inp_img;
-
-  Image<float> texture;
-  bool has_texture = CreateTexture(color_img, pos_img, &texture);
-  if (has_texture) {
-    SaveImage("texture.jpg", texture); // in linear space.
+  // Face detector and network are set up once and reused for all images.
+  FaceCropper cropper(min_face_size);
+
+  // "throughput" profile runs a single-threaded session per worker thread.
+  // Otherwise worker threads share one session.
+  const size_t n_sessions =
+      (batch_mode && (profile == "throughput")) ? n_jobs : 1;
+  PredictorOptions predictor_options;
+  predictor_options.face_data = &face_data;
+  predictor_options.synthetic_latency_ms =
+      result["synthetic-latency"].as<double>();
+  std::vector<std::unique_ptr<Predictor>> predictors;
+  for (size_t i = 0; i < n_sessions; i++) {
+    predictors.emplace_back(CreatePredictor(backend, predictor_options));
+    if (!predictors[i]) {
+      return -1;
+    }
+    if (i == 0) {
+      predictors[i]->init(argc, argv);
+      std::cout << "Initialized" << std::endl;
+    }
+    if (!predictors[i]->load(graph_filename, "Placeholder",
+                             "resfcn256/Conv2d_transpose_16/Sigmoid",
+                             session_config)) {
+      std::cerr << "Failed to load model : " << graph_filename << std::endl;
+      return -1;
+    }
   }
-
-  // Create mesh
-  Mesh mesh;
-  if (!ConvertToMesh(pos_img, face_data, &mesh)) {
-    std::cerr << "failed to convert result image to mesh." << std::endl;
-    return -1;
+  std::cout << "Loaded model(" << n_sessions << " session(s), " << backend
+            << " backend)" << std::endl;
+  Predictor &predictor = *predictors[0];
+
+  if (result.count("validate-graph")) {
+    if (!use_graph) {
+      std::cerr << "--validate-graph is not supported by " << backend
+                << " backend." << std::endl;
+      return -1;
+    }
+    const std::string validate_filename =
+        result["validate-graph"].as<std::string>();
+    std::unique_ptr<Predictor> val_predictor =
+        CreatePredictor(backend, predictor_options);
+    if (!val_predictor->load(validate_filename, "Placeholder",
+                             "resfcn256/Conv2d_transpose_16/Sigmoid",
+                             session_config)) {
+      std::cerr << "Failed to load model : " << validate_filename << std::endl;
+      return -1;
+    }
+    return ValidatePredictor(image_filenames, cropper, predictor,
+                             *val_predictor, face_data,
+                             result["max-landmark-error"].as<double>())
+               ? 0
+               : -1;
   }
 
-  SaveAsWObj("output.obj", mesh);
+  if (!batch_mode) {
+    OutputFilenames output;
+    output.cropped = "dbg_cropped_img.jpg";
+    output.texture = "texture.jpg";
+    output.mesh = "output.obj";
+    output.landmarks = "landmarks.jpg";
+    output.front_mesh = "output_front.obj";
+
+    WorkerArena arena;
+    FaceImage &image = arena.image;
+    if (session_config.in_graph_preprocess) {
+      if (!LoadFaceRegions(image_filenames[0], cropper, max_faces, &image)) {
+        return -1;
+      }
+    } else {
+      // Crop the first face directly into the input tensor.
+      image.faces.resize(1);
+      predictor.allocate_input(kCropSize, kCropSize, 3,
+                               &image.faces[0].cropped_img);
+      if (!LoadAndCropFaces(image_filenames[0], output, cropper, max_faces,
+                            &image)) {
+        return -1;
+      }
+    }
 
-  // Draw landmarks
-  Image<float> dbg_lmk_image;
-  DrawLandmark(color_img, pos_img, face_data, &dbg_lmk_image);
-  SaveImage("landmarks.jpg", dbg_lmk_image);
+    // Predict
+    std::cout << "Start running network... " << std::endl << std::flush;
+    auto startT = std::chrono::system_clock::now();
+    if (!PredictFaces(predictor, output, session_config.in_graph_preprocess,
+                      batch_size, &image, &arena)) {
+      return -1;
+    }
+    auto endT = std::chrono::system_clock::now();
+    std::chrono::duration<double, std::milli> ms = endT - startT;
+    std::cout << "Ran network. elapsed = " << ms.count() << " [ms] " << std::endl;
 
-  // Frontizlization
-  Mesh front_mesh = mesh;  // copy
-  FrontalizeFaceMesh(&front_mesh, face_data);
-  SaveAsWObj("output_front.obj", front_mesh);
+    // GUI shows the first face.
+#ifdef USE_GUI
+    const bool keep_color = true;
+#else
+    const bool keep_color = false;
+#endif
+    PipelineResult &pipeline_result = arena.result;
+    if (!ProcessFaces(&image, output, face_data, keep_color,
+                      &pipeline_result)) {
+      return -1;
+    }
 
 #ifdef USE_GUI
-  std::vector<Image<float>> debug_images = {dbg_lmk_image};
-  bool ret = RunUI(mesh, front_mesh, color_img, debug_images);
-  if (!ret) {
-    std::cerr << "failed to run GUI." << std::endl;
-  }
+    // Meshes and the color image are shared with the renderer.
+    std::shared_ptr<Image<float>> color_img = std::make_shared<Image<float>>();
+    std::vector<Image<uint8_t>> debug_images(1);
+    ConvertImage(pipeline_result.color_img, color_img.get(),
+                 2.2f);  // sRGB -> linear
+    std::swap(debug_images[0], pipeline_result.dbg_lmk_image);
+    std::shared_ptr<const Mesh> mesh =
+        std::make_shared<Mesh>(std::move(pipeline_result.mesh));
+    std::shared_ptr<const Mesh> front_mesh = mesh;
+    if (!pipeline_result.front_vertices.empty()) {
+      std::shared_ptr<Mesh> m = std::make_shared<Mesh>();
+      m->vertices = std::move(pipeline_result.front_vertices);
+      m->faces = mesh->faces;
+      m->uvs = mesh->uvs;
+      front_mesh = m;
+    }
+    bool ret = RunUI(mesh, front_mesh, color_img, debug_images);
+    if (!ret) {
+      std::cerr << "failed to run GUI." << std::endl;
+    }
 #endif
 
-  return 0;
+    return 0;
+  }
+
+  // Batch mode: write results as `<output-dir>/<basename>{.obj,_front.obj,...}`
+  std::cout << "Processing " << image_filenames.size() << " images" << std::endl;
+  const std::vector<std::string> output_prefixes =
+      GetBatchOutputPrefixes(output_dirname, image_filenames);
+
+  size_t n_failed = 0;
+  auto batch_startT = std::chrono::system_clock::now();
+  if (n_sessions > 1) {
+    PredictFunction predict_fn = [&](size_t worker_id, FaceImage *image,
+                                     WorkerArena *arena) {
+      return PredictFaces(*predictors[worker_id], OutputFilenames(),
+                          session_config.in_graph_preprocess, batch_size,
+                          image, arena);
+    };
+    // Crop directly into the input tensor of each session.
+    AllocateInputFunction allocate_fn = [&](size_t worker_id,
+                                            Image<float> *cropped_img) {
+      predictors[worker_id]->allocate_input(kCropSize, kCropSize, 3,
+                                            cropped_img);
+    };
+    n_failed = ProcessConcurrently(image_filenames, output_prefixes,
+                                   predict_fn, allocate_fn, face_data, n_jobs,
+                                   max_faces, min_face_size,
+                                   session_config.in_graph_preprocess);
+  } else if (n_jobs > 1) {
+    BatchScheduler scheduler(predictor, batch_size, batch_deadline_ms);
+    PredictFunction predict_fn = [&](size_t worker_id, FaceImage *image,
+                                     WorkerArena *arena) {
+      (void)worker_id;
+      // Crop in the graph, then batch the network evaluation.
+      if (session_config.in_graph_preprocess &&
+          !PreprocessFaces(predictor, OutputFilenames(), image, arena)) {
+        return false;
+      }
+      // All faces of the image are queued before waiting, so that they go
+      // into the same batch. Crops are moved to the queue(not copied).
+      // Network output of a batch is postprocessed on the host.
+      std::vector<std::future<Image<float>>> &pending = arena->pending;
+      for (size_t i = 0; i < image->n_faces; i++) {
+        pending.push_back(
+            scheduler.submit(std::move(image->faces[i].cropped_img)));
+      }
+      bool ok = true;
+      for (size_t i = 0; i < image->n_faces; i++) {
+        CroppedFace &face = image->faces[i];
+        face.geometry.pos_img = pending[i].get();
+        ok = (face.geometry.pos_img.getWidth() > 0) &&
+             predictor.postprocess(GetPositionRemap(face), &face.geometry) &&
+             ok;
+      }
+      pending.clear();
+      return ok;
+    };
+    n_failed = ProcessConcurrently(image_filenames, output_prefixes,
+                                   predict_fn, AllocateInputFunction(),
+                                   face_data, n_jobs, max_faces, min_face_size,
+                                   session_config.in_graph_preprocess);
+
+    BatchScheduler::Statistics stats = scheduler.statistics();
+    std::cout << "Batches: " << stats.num_batches
+              << ", mean batch size: " << stats.mean_batch_size
+              << ", queueing delay p50/p99/max: " << stats.p50_queue_ms << "/"
+              << stats.p99_queue_ms << "/" << stats.max_queue_ms << " [ms]"
+              << std::endl;
+  } else {
+    WorkerArena arena;
+    for (size_t i = 0; i < image_filenames.size(); i += batch_size) {
+      const size_t end = std::min(i + batch_size, image_filenames.size());
+      n_failed += ProcessBatch(image_filenames, i, end, output_prefixes,
+                               cropper, predictor, face_data, max_faces,
+                               batch_size, session_config.in_graph_preprocess,
+                               &arena);
+    }
+  }
+  auto batch_endT = std::chrono::system_clock::now();
+  std::chrono::duration<double, std::milli> batch_ms = batch_endT - batch_startT;
+
+  std::cout << "Processed " << (image_filenames.size() - n_failed) << "/"
+            << image_filenames.size() << " images. elapsed = "
+            << batch_ms.count() << " [ms]" << std::endl;
+
+  return (n_failed == 0) ? 0 : -1;
 }
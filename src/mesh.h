@@ -13,18 +13,11 @@ class Mesh
 {
   public:
     Mesh() {}
-    Mesh(const Mesh &rhs) {
-      vertices = rhs.vertices;
-      faces = rhs.faces;
-      uvs = rhs.uvs;
-    }
-    Mesh &operator=(const Mesh &rhs) {
-      vertices = rhs.vertices;
-      faces = rhs.faces;
-      uvs = rhs.uvs;
-
-      return (*this);
-    }
+    Mesh(const Mesh &rhs) = default;
+    Mesh &operator=(const Mesh &rhs) = default;
+    // Moves take over the buffers(no copy), also in std::vector<Mesh>.
+    Mesh(Mesh &&rhs) noexcept = default;
+    Mesh &operator=(Mesh &&rhs) noexcept = default;
     ~Mesh() {}
 
   std::vector<float> vertices;
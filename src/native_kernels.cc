@@ -0,0 +1,210 @@
+#include "native_kernels.h"
+
+#include <algorithm>
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+// AVX2 kernel is compiled with target attribute and selected at runtime, so
+// that the binary also runs on CPUs without AVX2.
+#define PRNET_NATIVE_HAS_AVX2_KERNEL 1
+#include <immintrin.h>
+#endif
+
+namespace prnet {
+namespace native {
+
+namespace {
+
+// Rows of the register tile.
+const size_t kGemmTileRows = 6;
+
+// K block size. A[6 x kc] and B[kc x 16] stay in L1.
+const size_t kGemmBlockK = 256;
+
+typedef void (*GemmKernel)(size_t k, const float* a, size_t lda,
+                           const float* b, float* c, size_t ldc,
+                           bool accumulate);
+
+// C[R x 16] (+)= A[R x k] * B[k x 16]
+template <size_t R>
+void GemmKernelGeneric(size_t k, const float* a, size_t lda, const float* b,
+                       float* c, size_t ldc, bool accumulate) {
+  float acc[R][kGemmPanelWidth];
+  for (size_t r = 0; r < R; r++) {
+    for (size_t j = 0; j < kGemmPanelWidth; j++) {
+      acc[r][j] = accumulate ? c[r * ldc + j] : 0.0f;
+    }
+  }
+  for (size_t p = 0; p < k; p++) {
+    const float* bp = b + p * kGemmPanelWidth;
+    for (size_t r = 0; r < R; r++) {
+      const float av = a[r * lda + p];
+      for (size_t j = 0; j < kGemmPanelWidth; j++) {
+        acc[r][j] += av * bp[j];
+      }
+    }
+  }
+  for (size_t r = 0; r < R; r++) {
+    for (size_t j = 0; j < kGemmPanelWidth; j++) {
+      c[r * ldc + j] = acc[r][j];
+    }
+  }
+}
+
+#ifdef PRNET_NATIVE_HAS_AVX2_KERNEL
+// Accumulators are spelled out so that they stay in registers(12 of 16 ymm).
+// Rows >= R are removed at compile time.
+template <size_t R>
+__attribute__((target("avx2,fma")))
+void GemmKernelAvx2(size_t k, const float* a, size_t lda, const float* b,
+                    float* c, size_t ldc, bool accumulate) {
+  __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+  __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+  __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+  __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+  __m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+  __m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+
+#define PRNET_GEMM_ROW(r, op)                                                  \
+  if (R > r) {                                                                 \
+    op(r, c##r##0, c##r##1);                                                   \
+  }
+#define PRNET_GEMM_LOAD(r, v0, v1)                                             \
+  v0 = _mm256_loadu_ps(c + r * ldc);                                           \
+  v1 = _mm256_loadu_ps(c + r * ldc + 8);
+#define PRNET_GEMM_FMA(r, v0, v1)                                              \
+  {                                                                            \
+    const __m256 av = _mm256_broadcast_ss(a + r * lda + p);                    \
+    v0 = _mm256_fmadd_ps(av, b0, v0);                                          \
+    v1 = _mm256_fmadd_ps(av, b1, v1);                                          \
+  }
+#define PRNET_GEMM_STORE(r, v0, v1)                                            \
+  _mm256_storeu_ps(c + r * ldc, v0);                                           \
+  _mm256_storeu_ps(c + r * ldc + 8, v1);
+#define PRNET_GEMM_ROWS(op)                                                    \
+  PRNET_GEMM_ROW(0, op)                                                        \
+  PRNET_GEMM_ROW(1, op)                                                        \
+  PRNET_GEMM_ROW(2, op)                                                        \
+  PRNET_GEMM_ROW(3, op)                                                        \
+  PRNET_GEMM_ROW(4, op)                                                        \
+  PRNET_GEMM_ROW(5, op)
+
+  if (accumulate) {
+    PRNET_GEMM_ROWS(PRNET_GEMM_LOAD)
+  }
+  for (size_t p = 0; p < k; p++) {
+    const __m256 b0 = _mm256_loadu_ps(b + p * kGemmPanelWidth);
+    const __m256 b1 = _mm256_loadu_ps(b + p * kGemmPanelWidth + 8);
+    PRNET_GEMM_ROWS(PRNET_GEMM_FMA)
+  }
+  PRNET_GEMM_ROWS(PRNET_GEMM_STORE)
+
+#undef PRNET_GEMM_ROWS
+#undef PRNET_GEMM_STORE
+#undef PRNET_GEMM_FMA
+#undef PRNET_GEMM_LOAD
+#undef PRNET_GEMM_ROW
+}
+
+bool CpuHasAvx2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+#endif
+
+struct GemmKernels {
+  GemmKernel kernels[kGemmTileRows + 1];  // indexed by the number of rows
+  const char* name;
+
+  GemmKernels() {
+    if (!selectAvx2()) {
+      selectGeneric();
+    }
+  }
+
+  bool selectAvx2() {
+#ifdef PRNET_NATIVE_HAS_AVX2_KERNEL
+    if (CpuHasAvx2()) {
+      kernels[0] = nullptr;
+      kernels[1] = GemmKernelAvx2<1>;
+      kernels[2] = GemmKernelAvx2<2>;
+      kernels[3] = GemmKernelAvx2<3>;
+      kernels[4] = GemmKernelAvx2<4>;
+      kernels[5] = GemmKernelAvx2<5>;
+      kernels[6] = GemmKernelAvx2<6>;
+      name = "avx2";
+      return true;
+    }
+#endif
+    return false;
+  }
+
+  void selectGeneric() {
+    kernels[0] = nullptr;
+    kernels[1] = GemmKernelGeneric<1>;
+    kernels[2] = GemmKernelGeneric<2>;
+    kernels[3] = GemmKernelGeneric<3>;
+    kernels[4] = GemmKernelGeneric<4>;
+    kernels[5] = GemmKernelGeneric<5>;
+    kernels[6] = GemmKernelGeneric<6>;
+    name = "generic";
+  }
+};
+
+GemmKernels& GetGemmKernels() {
+  static GemmKernels kernels;
+  return kernels;
+}
+
+} // anonymous namespace
+
+void PackGemmB(const float* b, size_t k, size_t n, std::vector<float>* packed) {
+  const size_t n_panels = GemmNumPanels(n);
+  packed->assign(n_panels * k * kGemmPanelWidth, 0.0f);
+  for (size_t p = 0; p < n_panels; p++) {
+    float* dst = packed->data() + p * k * kGemmPanelWidth;
+    const size_t j0 = p * kGemmPanelWidth;
+    const size_t nj = std::min(kGemmPanelWidth, n - j0);
+    for (size_t i = 0; i < k; i++) {
+      std::copy(b + i * n + j0, b + i * n + j0 + nj,
+                dst + i * kGemmPanelWidth);
+    }
+  }
+}
+
+void Gemm(size_t m, size_t k, const float* a, size_t lda,
+          const float* packed_b, size_t panel_begin, size_t panel_end,
+          float* c, size_t ldc) {
+  const GemmKernels& kernels = GetGemmKernels();
+  for (size_t k0 = 0; k0 < k; k0 += kGemmBlockK) {
+    const size_t kc = std::min(kGemmBlockK, k - k0);
+    const bool accumulate = (k0 > 0);
+    for (size_t p = panel_begin; p < panel_end; p++) {
+      const float* bp =
+          packed_b + (p * k + k0) * kGemmPanelWidth;
+      float* cp = c + (p - panel_begin) * kGemmPanelWidth;
+      for (size_t i = 0; i < m; i += kGemmTileRows) {
+        const size_t rows = std::min(kGemmTileRows, m - i);
+        kernels.kernels[rows](kc, a + i * lda + k0, lda, bp, cp + i * ldc,
+                              ldc, accumulate);
+      }
+    }
+  }
+}
+
+const char* GemmKernelName() { return GetGemmKernels().name; }
+
+bool SelectGemmKernel(const std::string& name) {
+  GemmKernels& kernels = GetGemmKernels();
+  if (name == "generic") {
+    kernels.selectGeneric();
+    return true;
+  }
+  if (name == "avx2") {
+    return kernels.selectAvx2();
+  }
+  return false;
+}
+
+} // namespace native
+} // namespace prnet
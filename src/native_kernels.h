@@ -0,0 +1,52 @@
+#ifndef PRNET_INFER_NATIVE_KERNELS_H_
+#define PRNET_INFER_NATIVE_KERNELS_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace prnet {
+namespace native {
+
+///
+/// Width of a packed column panel of GEMM B matrix.
+///
+const size_t kGemmPanelWidth = 16;
+
+inline size_t GemmNumPanels(size_t n) {
+  return (n + kGemmPanelWidth - 1) / kGemmPanelWidth;
+}
+
+///
+/// Pack row-major B[k x n] into column panels of `kGemmPanelWidth`.
+/// Panel `p` holds B[0:k, p * 16 : p * 16 + 16] row by row at
+/// `packed[p * k * 16]`. Columns beyond `n` are zero filled.
+///
+void PackGemmB(const float* b, size_t k, size_t n, std::vector<float>* packed);
+
+///
+/// C[m x (panel_end - panel_begin) * 16] = A[m x k] * B[:, panels].
+/// `a` is row-major with stride `lda`, `c` is row-major with stride `ldc`.
+/// K dimension is cache-blocked and the inner kernel uses AVX2 + FMA when
+/// the CPU supports it.
+///
+void Gemm(size_t m, size_t k, const float* a, size_t lda,
+          const float* packed_b, size_t panel_begin, size_t panel_end,
+          float* c, size_t ldc);
+
+///
+/// Name of selected GEMM kernel("avx2" or "generic").
+///
+const char* GemmKernelName();
+
+///
+/// Force GEMM kernel("avx2" or "generic") for testing. Returns false when the
+/// kernel is unknown or not supported by the CPU. Must not be called while
+/// `Gemm` runs on another thread.
+///
+bool SelectGemmKernel(const std::string& name);
+
+} // namespace native
+} // namespace prnet
+
+#endif // PRNET_INFER_NATIVE_KERNELS_H_
@@ -0,0 +1,1367 @@
+#include "native_predictor.h"
+#include "graph_def_reader.h"
+#include "native_kernels.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <mutex>
+
+namespace prnet {
+
+namespace {
+
+using native::Gemm;
+using native::GemmNumPanels;
+using native::PackGemmB;
+using native::kGemmPanelWidth;
+
+// ----------------------------------------------------------------------------
+// Worker threads
+
+// Run f(task, thread_id) for task in [0, n_tasks) with at most `n_threads`
+// threads of the shared thread pool. `thread_id` < `n_threads`.
+template <typename F>
+void RunTasks(size_t n_threads, size_t n_tasks, const F& f) {
+  ThreadPool::global().parallel_for(
+      0, n_tasks, 1, n_threads,
+      [](void* ctx, size_t begin, size_t end, size_t thread_id) {
+        for (size_t task = begin; task < end; task++) {
+          (*static_cast<const F*>(ctx))(task, thread_id);
+        }
+      },
+      const_cast<F*>(&f));
+}
+
+// ----------------------------------------------------------------------------
+// Graph lowering
+
+enum Activation { kActNone, kActRelu, kActSigmoid };
+
+enum OpType { kOpInput, kOpConv, kOpAffine, kOpAdd, kOpActivation };
+
+struct ConvParams {
+  bool transpose = false;
+  size_t kernel_h = 0;
+  size_t kernel_w = 0;
+  size_t stride_h = 1;
+  size_t stride_w = 1;
+  bool same_padding = true;
+  size_t in_channels = 0;
+  size_t out_channels = 0;
+  // Conv2D         : [kernel_h][kernel_w][in_channels][out_channels]
+  // Conv2DTranspose: [kernel_h][kernel_w][out_channels][in_channels]
+  std::vector<float> filter;
+  std::vector<float> bias;  // empty = zero
+};
+
+struct Op {
+  OpType type = kOpInput;
+  std::vector<size_t> inputs;
+  size_t channels = 0;
+  ConvParams conv;
+  std::vector<float> scale;  // kOpAffine. Per channel.
+  std::vector<float> shift;
+  Activation act = kActNone;
+  size_t n_consumers = 0;
+};
+
+// Value of a graph node. Either a constant or an output of an op.
+struct Value {
+  bool is_const = false;
+  size_t index = 0;  // index of `consts` or `ops`
+};
+
+bool ParseTensorName(const std::string& input, std::string* node,
+                     int* output_index) {
+  if (!input.empty() && (input[0] == '^')) {
+    return false;  // control input
+  }
+  *output_index = 0;
+  const size_t pos = input.rfind(':');
+  if (pos == std::string::npos) {
+    *node = input;
+  } else {
+    *node = input.substr(0, pos);
+    *output_index = std::atoi(input.substr(pos + 1).c_str());
+  }
+  return true;
+}
+
+// Numpy style broadcasting of two constant tensors.
+template <typename F>
+bool BroadcastBinary(const GraphTensor& a, const GraphTensor& b, const F& f,
+                     GraphTensor* out) {
+  const size_t rank = std::max(a.shape.size(), b.shape.size());
+  std::vector<int64_t> sa(rank, 1);
+  std::vector<int64_t> sb(rank, 1);
+  std::copy(a.shape.begin(), a.shape.end(),
+            sa.begin() + long(rank - a.shape.size()));
+  std::copy(b.shape.begin(), b.shape.end(),
+            sb.begin() + long(rank - b.shape.size()));
+  out->dtype = a.dtype;
+  out->shape.resize(rank);
+  for (size_t i = 0; i < rank; i++) {
+    if ((sa[i] != sb[i]) && (sa[i] != 1) && (sb[i] != 1)) {
+      return false;
+    }
+    out->shape[i] = std::max(sa[i], sb[i]);
+  }
+
+  // Strides of `a` and `b` for each output dim(0 = broadcasted).
+  std::vector<size_t> stride_a(rank, 0);
+  std::vector<size_t> stride_b(rank, 0);
+  size_t step_a = 1;
+  size_t step_b = 1;
+  for (size_t i = rank; i-- > 0;) {
+    stride_a[i] = (sa[i] == 1) ? 0 : step_a;
+    stride_b[i] = (sb[i] == 1) ? 0 : step_b;
+    step_a *= size_t(sa[i]);
+    step_b *= size_t(sb[i]);
+  }
+
+  const size_t n = out->num_elements();
+  out->values.resize(n);
+  std::vector<size_t> index(rank, 0);
+  for (size_t i = 0; i < n; i++) {
+    size_t ia = 0;
+    size_t ib = 0;
+    for (size_t d = 0; d < rank; d++) {
+      ia += index[d] * stride_a[d];
+      ib += index[d] * stride_b[d];
+    }
+    out->values[i] = f(a.values[ia], b.values[ib]);
+    for (size_t d = rank; d-- > 0;) {
+      if (++index[d] < size_t(out->shape[d])) {
+        break;
+      }
+      index[d] = 0;
+    }
+  }
+  return true;
+}
+
+// Expand scalar or per-channel constant to `channels` elements.
+bool ChannelVector(const GraphTensor& t, size_t channels,
+                   std::vector<float>* v) {
+  const size_t n = t.num_elements();
+  if (n == 1) {
+    v->assign(channels, t.values[0]);
+    return true;
+  }
+  if ((n == channels) && !t.shape.empty() &&
+      (size_t(t.shape.back()) == channels)) {
+    *v = t.values;
+    return true;
+  }
+  return false;
+}
+
+bool GetStrides(const GraphNode& node, size_t* stride_h, size_t* stride_w) {
+  const GraphAttr* data_format = node.attr("data_format");
+  if (data_format && !data_format->s.empty() && (data_format->s != "NHWC")) {
+    std::cerr << node.name << ": Only NHWC is supported." << std::endl;
+    return false;
+  }
+  const GraphAttr* dilations = node.attr("dilations");
+  if (dilations) {
+    for (size_t i = 0; i < dilations->list_i.size(); i++) {
+      if (dilations->list_i[i] != 1) {
+        std::cerr << node.name << ": Dilation is not supported." << std::endl;
+        return false;
+      }
+    }
+  }
+  const GraphAttr* strides = node.attr("strides");
+  if (!strides || (strides->list_i.size() != 4) ||
+      (strides->list_i[0] != 1) || (strides->list_i[3] != 1)) {
+    std::cerr << node.name << ": Invalid strides." << std::endl;
+    return false;
+  }
+  *stride_h = size_t(strides->list_i[1]);
+  *stride_w = size_t(strides->list_i[2]);
+  return true;
+}
+
+bool GetPadding(const GraphNode& node, bool* same_padding) {
+  const GraphAttr* padding = node.attr("padding");
+  if (!padding || ((padding->s != "SAME") && (padding->s != "VALID"))) {
+    std::cerr << node.name << ": Unsupported padding." << std::endl;
+    return false;
+  }
+  *same_padding = (padding->s == "SAME");
+  return true;
+}
+
+//
+// Lowers the subgraph required to compute the output node into `ops`.
+// Nodes whose inputs are all constant are evaluated here.
+//
+class GraphLowering {
+public:
+  GraphLowering(const std::vector<GraphNode>& _nodes,
+                const std::string& _input_layer)
+      : nodes(_nodes), input_layer(_input_layer) {
+    for (size_t i = 0; i < nodes.size(); i++) {
+      node_index[nodes[i].name] = i;
+    }
+  }
+
+  bool lower(const std::string& output_layer, size_t* output_op) {
+    Value v;
+    if (!resolve(output_layer, &v)) {
+      return false;
+    }
+    if (v.is_const) {
+      std::cerr << "Output " << output_layer << " is constant." << std::endl;
+      return false;
+    }
+    *output_op = v.index;
+    return true;
+  }
+
+  std::vector<Op> ops;
+  std::vector<size_t> input_shape;  // [h, w, c] of placeholder. 0 = unknown
+
+private:
+  bool resolve(const std::string& tensor_name, Value* v) {
+    std::string name;
+    int output_index;
+    if (!ParseTensorName(tensor_name, &name, &output_index)) {
+      return false;
+    }
+    if (output_index != 0) {
+      std::cerr << "Output #" << output_index << " of " << name
+                << " is not supported." << std::endl;
+      return false;
+    }
+    std::map<std::string, Value>::const_iterator it = values.find(name);
+    if (it != values.end()) {
+      *v = it->second;
+      return true;
+    }
+    std::map<std::string, size_t>::const_iterator nit = node_index.find(name);
+    if (nit == node_index.end()) {
+      std::cerr << "Node not found : " << name << std::endl;
+      return false;
+    }
+    if (!lowerNode(nodes[nit->second], v)) {
+      std::cerr << "  while lowering " << name << std::endl;
+      return false;
+    }
+    values[name] = *v;
+    return true;
+  }
+
+  // Resolve data inputs(control inputs are ignored). Data input `skip` is
+  // not resolved and left as a default Value.
+  bool resolveInputs(const GraphNode& node, size_t n_required,
+                     std::vector<Value>* inputs, size_t skip = size_t(-1)) {
+    for (size_t i = 0; i < node.inputs.size(); i++) {
+      if (!node.inputs[i].empty() && (node.inputs[i][0] == '^')) {
+        continue;
+      }
+      Value v;
+      if ((inputs->size() != skip) && !resolve(node.inputs[i], &v)) {
+        return false;
+      }
+      inputs->push_back(v);
+    }
+    if (inputs->size() < n_required) {
+      std::cerr << node.name << ": Too few inputs." << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  Value addConst(const GraphTensor& t) {
+    consts.push_back(t);
+    Value v;
+    v.is_const = true;
+    v.index = consts.size() - 1;
+    return v;
+  }
+
+  Value addOp(const Op& op) {
+    for (size_t i = 0; i < op.inputs.size(); i++) {
+      ops[op.inputs[i]].n_consumers++;
+    }
+    ops.push_back(op);
+    Value v;
+    v.is_const = false;
+    v.index = ops.size() - 1;
+    return v;
+  }
+
+  bool lowerNode(const GraphNode& node, Value* v) {
+    const std::string& op = node.op;
+
+    if (op == "Const") {
+      const GraphAttr* value = node.attr("value");
+      if (!value || !value->has_tensor) {
+        std::cerr << node.name << ": No value." << std::endl;
+        return false;
+      }
+      *v = addConst(value->tensor);
+      return true;
+    }
+
+    if (op == "Placeholder") {
+      if (node.name != input_layer) {
+        std::cerr << "Unexpected placeholder : " << node.name << std::endl;
+        return false;
+      }
+      input_shape.assign(3, 0);
+      const GraphAttr* shape = node.attr("shape");
+      if (shape && (shape->shape.size() == 4)) {
+        for (size_t i = 0; i < 3; i++) {
+          input_shape[i] = size_t(std::max(int64_t(0), shape->shape[i + 1]));
+        }
+      }
+      if (input_shape[2] == 0) {
+        std::cerr << node.name << ": The number of channels must be known."
+                  << std::endl;
+        return false;
+      }
+      Op input;
+      input.type = kOpInput;
+      input.channels = input_shape[2];
+      *v = addOp(input);
+      return true;
+    }
+
+    std::vector<Value> inputs;
+    if ((op == "Identity") || (op == "StopGradient") || (op == "Snapshot")) {
+      if (!resolveInputs(node, 1, &inputs)) {
+        return false;
+      }
+      *v = inputs[0];
+      return true;
+    }
+
+    if (op == "Cast") {
+      // Dequantization of reduced precision weights(graph_quantizer.h).
+      // Values are already converted to float by the reader.
+      const GraphAttr* dst = node.attr("DstT");
+      if (dst && (dst->type != kGraphDataTypeFloat)) {
+        std::cerr << node.name << ": Cast to non-float type is not supported."
+                  << std::endl;
+        return false;
+      }
+      if (!resolveInputs(node, 1, &inputs)) {
+        return false;
+      }
+      if (inputs[0].is_const) {
+        GraphTensor t = consts[inputs[0].index];
+        t.dtype = kGraphDataTypeFloat;
+        *v = addConst(t);
+      } else {
+        *v = inputs[0];
+      }
+      return true;
+    }
+
+    if ((op == "Conv2D") || (op == "Conv2DBackpropInput") ||
+        (op == "_FusedConv2D")) {
+      return lowerConv(node, v);
+    }
+
+    if ((op == "FusedBatchNorm") || (op == "FusedBatchNormV2") ||
+        (op == "FusedBatchNormV3")) {
+      return lowerBatchNorm(node, v);
+    }
+
+    if ((op == "Relu") || (op == "Sigmoid") || (op == "Rsqrt") ||
+        (op == "Sqrt") || (op == "Reciprocal") || (op == "Neg") ||
+        (op == "Square")) {
+      if (!resolveInputs(node, 1, &inputs)) {
+        return false;
+      }
+      return lowerUnary(node, inputs[0], v);
+    }
+
+    if ((op == "Add") || (op == "AddV2") || (op == "BiasAdd") ||
+        (op == "Sub") || (op == "Mul") || (op == "RealDiv") ||
+        (op == "Maximum") || (op == "Minimum")) {
+      if (!resolveInputs(node, 2, &inputs)) {
+        return false;
+      }
+      return lowerBinary(node, inputs[0], inputs[1], v);
+    }
+
+    std::cerr << node.name << ": Unsupported op " << op << std::endl;
+    return false;
+  }
+
+  bool lowerUnary(const GraphNode& node, const Value& x, Value* v) {
+    const std::string& op = node.op;
+    if (x.is_const) {
+      GraphTensor t = consts[x.index];
+      for (size_t i = 0; i < t.values.size(); i++) {
+        const float a = t.values[i];
+        if (op == "Relu") {
+          t.values[i] = std::max(a, 0.0f);
+        } else if (op == "Sigmoid") {
+          t.values[i] = 1.0f / (1.0f + std::exp(-a));
+        } else if (op == "Rsqrt") {
+          t.values[i] = 1.0f / std::sqrt(a);
+        } else if (op == "Sqrt") {
+          t.values[i] = std::sqrt(a);
+        } else if (op == "Reciprocal") {
+          t.values[i] = 1.0f / a;
+        } else if (op == "Neg") {
+          t.values[i] = -a;
+        } else {  // Square
+          t.values[i] = a * a;
+        }
+      }
+      *v = addConst(t);
+      return true;
+    }
+
+    Op act;
+    act.type = kOpActivation;
+    act.inputs.push_back(x.index);
+    act.channels = ops[x.index].channels;
+    if (op == "Relu") {
+      act.act = kActRelu;
+    } else if (op == "Sigmoid") {
+      act.act = kActSigmoid;
+    } else {
+      std::cerr << node.name << ": " << op << " on activation is not supported."
+                << std::endl;
+      return false;
+    }
+    *v = addOp(act);
+    return true;
+  }
+
+  bool lowerBinary(const GraphNode& node, const Value& a, const Value& b,
+                   Value* v) {
+    const std::string& op = node.op;
+    if (a.is_const && b.is_const) {
+      GraphTensor t;
+      bool ok = false;
+      const GraphTensor& ta = consts[a.index];
+      const GraphTensor& tb = consts[b.index];
+      if ((op == "Add") || (op == "AddV2") || (op == "BiasAdd")) {
+        ok = BroadcastBinary(ta, tb, [](float x, float y) { return x + y; }, &t);
+      } else if (op == "Sub") {
+        ok = BroadcastBinary(ta, tb, [](float x, float y) { return x - y; }, &t);
+      } else if (op == "Mul") {
+        ok = BroadcastBinary(ta, tb, [](float x, float y) { return x * y; }, &t);
+      } else if (op == "RealDiv") {
+        ok = BroadcastBinary(ta, tb, [](float x, float y) { return x / y; }, &t);
+      } else if (op == "Maximum") {
+        ok = BroadcastBinary(ta, tb,
+                             [](float x, float y) { return std::max(x, y); }, &t);
+      } else {  // Minimum
+        ok = BroadcastBinary(ta, tb,
+                             [](float x, float y) { return std::min(x, y); }, &t);
+      }
+      if (!ok) {
+        std::cerr << node.name << ": Incompatible shapes." << std::endl;
+        return false;
+      }
+      *v = addConst(t);
+      return true;
+    }
+
+    if (!a.is_const && !b.is_const) {
+      if ((op != "Add") && (op != "AddV2")) {
+        std::cerr << node.name << ": " << op
+                  << " of two activations is not supported." << std::endl;
+        return false;
+      }
+      if (ops[a.index].channels != ops[b.index].channels) {
+        std::cerr << node.name << ": Channel mismatch." << std::endl;
+        return false;
+      }
+      Op add;
+      add.type = kOpAdd;
+      add.inputs.push_back(a.index);
+      add.inputs.push_back(b.index);
+      add.channels = ops[a.index].channels;
+      *v = addOp(add);
+      return true;
+    }
+
+    // Activation and constant : per-channel affine transform.
+    const Value& x = a.is_const ? b : a;
+    const GraphTensor& c = consts[a.is_const ? a.index : b.index];
+    Op affine;
+    affine.type = kOpAffine;
+    affine.inputs.push_back(x.index);
+    affine.channels = ops[x.index].channels;
+    std::vector<float> cv;
+    if (!ChannelVector(c, affine.channels, &cv)) {
+      std::cerr << node.name << ": Constant must be a scalar or per-channel."
+                << std::endl;
+      return false;
+    }
+    affine.scale.assign(affine.channels, 1.0f);
+    affine.shift.assign(affine.channels, 0.0f);
+    if ((op == "Add") || (op == "AddV2") || (op == "BiasAdd")) {
+      affine.shift = cv;
+    } else if (op == "Sub") {
+      for (size_t i = 0; i < cv.size(); i++) {
+        if (a.is_const) {  // c - x
+          affine.scale[i] = -1.0f;
+          affine.shift[i] = cv[i];
+        } else {
+          affine.shift[i] = -cv[i];
+        }
+      }
+    } else if (op == "Mul") {
+      affine.scale = cv;
+    } else if ((op == "RealDiv") && !a.is_const) {
+      for (size_t i = 0; i < cv.size(); i++) {
+        affine.scale[i] = 1.0f / cv[i];
+      }
+    } else {
+      std::cerr << node.name << ": " << op
+                << " of activation and constant is not supported." << std::endl;
+      return false;
+    }
+    *v = addOp(affine);
+    return true;
+  }
+
+  bool lowerBatchNorm(const GraphNode& node, Value* v) {
+    std::vector<Value> inputs;
+    if (!resolveInputs(node, 5, &inputs)) {
+      return false;
+    }
+    const GraphAttr* is_training = node.attr("is_training");
+    if (is_training && is_training->b) {
+      std::cerr << node.name << ": Training mode batch norm is not supported."
+                << std::endl;
+      return false;
+    }
+    if (inputs[0].is_const || !inputs[1].is_const || !inputs[2].is_const ||
+        !inputs[3].is_const || !inputs[4].is_const) {
+      std::cerr << node.name << ": Batch norm parameters must be constant."
+                << std::endl;
+      return false;
+    }
+    const GraphAttr* epsilon_attr = node.attr("epsilon");
+    const float epsilon = epsilon_attr ? epsilon_attr->f : 0.0001f;
+
+    Op affine;
+    affine.type = kOpAffine;
+    affine.inputs.push_back(inputs[0].index);
+    affine.channels = ops[inputs[0].index].channels;
+    std::vector<float> gamma, beta, mean, variance;
+    if (!ChannelVector(consts[inputs[1].index], affine.channels, &gamma) ||
+        !ChannelVector(consts[inputs[2].index], affine.channels, &beta) ||
+        !ChannelVector(consts[inputs[3].index], affine.channels, &mean) ||
+        !ChannelVector(consts[inputs[4].index], affine.channels, &variance)) {
+      std::cerr << node.name << ": Invalid batch norm parameters." << std::endl;
+      return false;
+    }
+    affine.scale.resize(affine.channels);
+    affine.shift.resize(affine.channels);
+    for (size_t i = 0; i < affine.channels; i++) {
+      affine.scale[i] = gamma[i] / std::sqrt(variance[i] + epsilon);
+      affine.shift[i] = beta[i] - mean[i] * affine.scale[i];
+    }
+    *v = addOp(affine);
+    return true;
+  }
+
+  bool lowerConv(const GraphNode& node, Value* v) {
+    Op conv;
+    conv.type = kOpConv;
+    ConvParams& params = conv.conv;
+    params.transpose = (node.op == "Conv2DBackpropInput");
+
+    // Conv2DBackpropInput(input_sizes, filter, out_backprop). `input_sizes`
+    // (usually computed from the dynamic batch size) is not evaluated. The
+    // output size is derived from the input size and padding.
+    std::vector<Value> inputs;
+    if (!resolveInputs(node, 2, &inputs,
+                       params.transpose ? 0 : size_t(-1))) {
+      return false;
+    }
+
+    const size_t x_index = params.transpose ? 2 : 0;
+    const size_t filter_index = 1;
+    if (inputs.size() <= x_index) {
+      std::cerr << node.name << ": Too few inputs." << std::endl;
+      return false;
+    }
+    const Value& x = inputs[x_index];
+    const Value& filter = inputs[filter_index];
+    if (x.is_const || !filter.is_const) {
+      std::cerr << node.name << ": Filter must be constant." << std::endl;
+      return false;
+    }
+
+    if (!GetStrides(node, &params.stride_h, &params.stride_w) ||
+        !GetPadding(node, &params.same_padding)) {
+      return false;
+    }
+
+    const GraphTensor& f = consts[filter.index];
+    if (f.shape.size() != 4) {
+      std::cerr << node.name << ": Filter must be 4D." << std::endl;
+      return false;
+    }
+    params.kernel_h = size_t(f.shape[0]);
+    params.kernel_w = size_t(f.shape[1]);
+    params.in_channels = size_t(f.shape[params.transpose ? 3 : 2]);
+    params.out_channels = size_t(f.shape[params.transpose ? 2 : 3]);
+    params.filter = f.values;
+    if (ops[x.index].channels != params.in_channels) {
+      std::cerr << node.name << ": Channel mismatch." << std::endl;
+      return false;
+    }
+
+    if (node.op == "_FusedConv2D") {
+      const GraphAttr* fused_ops = node.attr("fused_ops");
+      if (!fused_ops || fused_ops->list_s.empty() ||
+          (fused_ops->list_s[0] != "BiasAdd") || (inputs.size() < 3) ||
+          !inputs[2].is_const ||
+          !ChannelVector(consts[inputs[2].index], params.out_channels,
+                         &params.bias)) {
+        std::cerr << node.name << ": Unsupported fused ops." << std::endl;
+        return false;
+      }
+      for (size_t i = 1; i < fused_ops->list_s.size(); i++) {
+        if (fused_ops->list_s[i] == "Relu") {
+          conv.act = kActRelu;
+        } else {
+          std::cerr << node.name << ": Unsupported fused op "
+                    << fused_ops->list_s[i] << std::endl;
+          return false;
+        }
+      }
+    }
+
+    conv.inputs.push_back(x.index);
+    conv.channels = params.out_channels;
+
+    if (conv.act == kActNone) {
+      *v = addOp(conv);
+      return true;
+    }
+
+    // Fused activation becomes a separate op, which is fused again later.
+    const Activation act = conv.act;
+    conv.act = kActNone;
+    const Value conv_value = addOp(conv);
+    Op act_op;
+    act_op.type = kOpActivation;
+    act_op.act = act;
+    act_op.inputs.push_back(conv_value.index);
+    act_op.channels = conv.channels;
+    *v = addOp(act_op);
+    return true;
+  }
+
+  const std::vector<GraphNode>& nodes;
+  const std::string input_layer;
+  std::map<std::string, size_t> node_index;
+  std::map<std::string, Value> values;
+  std::vector<GraphTensor> consts;
+};
+
+// ----------------------------------------------------------------------------
+// Execution plan
+
+//
+// A part of convolution evaluated as a single GEMM shape.
+// Output pixel (out_y0 + i * out_step_y, out_x0 + j * out_step_x) for
+// i in [0, rows), j in [0, cols) reads input pixels
+// (i * in_step_y + tap_y[ty], j * in_step_x + tap_x[tx]).
+// Conv2D has one pass. Conv2DTranspose with stride s is decomposed into s * s
+// passes(one for each output phase), so no scatter is required.
+//
+struct ConvPass {
+  size_t out_y0 = 0;
+  size_t out_x0 = 0;
+  size_t out_step_y = 1;
+  size_t out_step_x = 1;
+  size_t rows = 0;
+  size_t cols = 0;
+  size_t in_step_y = 1;
+  size_t in_step_x = 1;
+  std::vector<int> tap_y;
+  std::vector<int> tap_x;
+  size_t k = 0;  // tap_y.size() * tap_x.size() * in_channels
+  bool direct = false;  // 1x1 conv. Input is used as GEMM A without im2col.
+  std::vector<float> packed_weights;
+};
+
+struct ConvTask {
+  size_t pass = 0;
+  size_t row_begin = 0;
+  size_t row_end = 0;
+  size_t panel_begin = 0;
+  size_t panel_end = 0;
+};
+
+//
+// Conv(or elementwise op) with fused epilogue:
+//   v = conv(input) + bias            (or v = input for elementwise layer)
+//   v = v + residual
+//   v = v * post_scale + post_shift
+//   output = act(v)
+//
+struct Layer {
+  bool is_conv = false;
+  ConvParams conv;
+  int input = -1;     // index of layer, -1 = network input
+  int residual = -1;  // index of layer, -1 = network input. See has_residual
+  bool has_residual = false;
+  std::vector<float> post_scale;  // empty = none
+  std::vector<float> post_shift;
+  Activation act = kActNone;
+  size_t channels = 0;
+
+  // Planned for the input size.
+  size_t height = 0;
+  size_t width = 0;
+  std::vector<ConvPass> passes;
+  std::vector<ConvTask> tasks;
+  size_t offset = 0;  // of output in the arena
+};
+
+// Target number of output pixels and channel panels of a task.
+const size_t kTaskPixels = 64;
+const size_t kTaskPanels = 4;
+
+size_t ConvOutputSize(size_t in, size_t kernel, size_t stride, bool same,
+                      bool transpose, size_t* pad) {
+  size_t out;
+  if (transpose) {
+    out = same ? in * stride : (in - 1) * stride + kernel;
+    // Padding of the corresponding forward conv(out -> in).
+    const size_t span = (in - 1) * stride + kernel;
+    *pad = same ? ((span > out) ? (span - out) / 2 : 0) : 0;
+  } else {
+    out = same ? (in + stride - 1) / stride : (in - kernel) / stride + 1;
+    const size_t span = (out - 1) * stride + kernel;
+    *pad = same ? ((span > in) ? (span - in) / 2 : 0) : 0;
+  }
+  return out;
+}
+
+// Taps of transposed conv contributing to output phase `phase`.
+void TransposeTaps(size_t phase, size_t kernel, size_t stride, size_t pad,
+                   std::vector<size_t>* kernel_indices, std::vector<int>* taps) {
+  for (size_t k = 0; k < kernel; k++) {
+    const int num = int(phase) + int(pad) - int(k);
+    if (((num % int(stride)) + int(stride)) % int(stride) == 0) {
+      kernel_indices->push_back(k);
+      taps->push_back(num / int(stride));
+    }
+  }
+}
+
+void PlanConv(const Layer& layer, size_t in_h, size_t in_w,
+              std::vector<ConvPass>* passes, size_t* out_h, size_t* out_w) {
+  const ConvParams& p = layer.conv;
+  size_t pad_h, pad_w;
+  *out_h = ConvOutputSize(in_h, p.kernel_h, p.stride_h, p.same_padding,
+                          p.transpose, &pad_h);
+  *out_w = ConvOutputSize(in_w, p.kernel_w, p.stride_w, p.same_padding,
+                          p.transpose, &pad_w);
+  const size_t ic = p.in_channels;
+  const size_t oc = p.out_channels;
+  passes->clear();
+
+  if (!p.transpose) {
+    ConvPass pass;
+    pass.rows = *out_h;
+    pass.cols = *out_w;
+    pass.in_step_y = p.stride_h;
+    pass.in_step_x = p.stride_w;
+    for (size_t k = 0; k < p.kernel_h; k++) {
+      pass.tap_y.push_back(int(k) - int(pad_h));
+    }
+    for (size_t k = 0; k < p.kernel_w; k++) {
+      pass.tap_x.push_back(int(k) - int(pad_w));
+    }
+    pass.k = p.kernel_h * p.kernel_w * ic;
+    pass.direct = (p.kernel_h == 1) && (p.kernel_w == 1) &&
+                  (p.stride_h == 1) && (p.stride_w == 1) && (pad_h == 0) &&
+                  (pad_w == 0);
+    // HWIO filter is already a row-major [k x oc] matrix.
+    PackGemmB(p.filter.data(), pass.k, oc, &pass.packed_weights);
+    passes->push_back(std::move(pass));
+    return;
+  }
+
+  std::vector<float> b;
+  for (size_t py = 0; py < p.stride_h; py++) {
+    for (size_t px = 0; px < p.stride_w; px++) {
+      ConvPass pass;
+      pass.out_y0 = py;
+      pass.out_x0 = px;
+      pass.out_step_y = p.stride_h;
+      pass.out_step_x = p.stride_w;
+      pass.rows = (py < *out_h) ? (*out_h - py + p.stride_h - 1) / p.stride_h : 0;
+      pass.cols = (px < *out_w) ? (*out_w - px + p.stride_w - 1) / p.stride_w : 0;
+      std::vector<size_t> ky, kx;
+      TransposeTaps(py, p.kernel_h, p.stride_h, pad_h, &ky, &pass.tap_y);
+      TransposeTaps(px, p.kernel_w, p.stride_w, pad_w, &kx, &pass.tap_x);
+      pass.k = ky.size() * kx.size() * ic;
+      // B[(ty, tx, ic)][oc] = filter[ky][kx][oc][ic]
+      b.assign(pass.k * oc, 0.0f);
+      for (size_t ty = 0; ty < ky.size(); ty++) {
+        for (size_t tx = 0; tx < kx.size(); tx++) {
+          for (size_t c = 0; c < ic; c++) {
+            const size_t row = (ty * kx.size() + tx) * ic + c;
+            for (size_t o = 0; o < oc; o++) {
+              b[row * oc + o] =
+                  p.filter[((ky[ty] * p.kernel_w + kx[tx]) * oc + o) * ic + c];
+            }
+          }
+        }
+      }
+      PackGemmB(b.data(), pass.k, oc, &pass.packed_weights);
+      passes->push_back(std::move(pass));
+    }
+  }
+}
+
+// Simple first-fit allocator of arena offsets(in floats).
+class ArenaPlanner {
+public:
+  size_t allocate(size_t size) {
+    for (std::map<size_t, size_t>::iterator it = free_blocks.begin();
+         it != free_blocks.end(); ++it) {
+      if (it->second >= size) {
+        const size_t offset = it->first;
+        const size_t remain = it->second - size;
+        free_blocks.erase(it);
+        if (remain > 0) {
+          free_blocks[offset + size] = remain;
+        }
+        return offset;
+      }
+    }
+    const size_t offset = total;
+    total += size;
+    return offset;
+  }
+
+  void release(size_t offset, size_t size) {
+    std::map<size_t, size_t>::iterator it =
+        free_blocks.insert(std::make_pair(offset, size)).first;
+    // Merge with the next block, then with the previous block.
+    std::map<size_t, size_t>::iterator next = std::next(it);
+    if ((next != free_blocks.end()) && (it->first + it->second == next->first)) {
+      it->second += next->second;
+      free_blocks.erase(next);
+    }
+    if (it != free_blocks.begin()) {
+      std::map<size_t, size_t>::iterator prev = std::prev(it);
+      if (prev->first + prev->second == it->first) {
+        prev->second += it->second;
+        free_blocks.erase(it);
+      }
+    }
+  }
+
+  size_t size() const { return total; }
+
+private:
+  std::map<size_t, size_t> free_blocks;  // offset -> size
+  size_t total = 0;
+};
+
+inline float Activate(Activation act, float v) {
+  if (act == kActRelu) {
+    return std::max(v, 0.0f);
+  } else if (act == kActSigmoid) {
+    return 1.0f / (1.0f + std::exp(-v));
+  }
+  return v;
+}
+
+// Apply epilogue to channels [c_begin, c_end) of a pixel.
+inline void Epilogue(const Layer& layer, const float* acc, const float* res,
+                     float* out, size_t c_begin, size_t c_end) {
+  const float* bias = layer.conv.bias.empty() ? nullptr : layer.conv.bias.data();
+  const bool post = !layer.post_scale.empty();
+  for (size_t c = c_begin; c < c_end; c++) {
+    float v = acc[c - c_begin];
+    if (bias) {
+      v += bias[c];
+    }
+    if (res) {
+      v += res[c];
+    }
+    if (post) {
+      v = v * layer.post_scale[c] + layer.post_shift[c];
+    }
+    out[c] = Activate(layer.act, v);
+  }
+}
+
+} // anonymous namespace
+
+class NativePredictor::Impl {
+public:
+  void init(int argc, char* argv[]) {
+    (void)argc;
+    (void)argv;
+  }
+
+  bool load(const std::string& graph_filename, const std::string& inp_layer,
+            const std::string& out_layer, const SessionConfig& config) {
+    if (config.use_memmapped_graph) {
+      std::cerr << "Memmapped graph is not supported by native engine."
+                << std::endl;
+      return false;
+    }
+
+    std::vector<GraphNode> nodes;
+    if (!ReadGraphDef(graph_filename, &nodes)) {
+      return false;
+    }
+
+    GraphLowering lowering(nodes, inp_layer);
+    size_t output_op;
+    if (!lowering.lower(out_layer, &output_op)) {
+      std::cerr << "Failed to lower graph to native engine." << std::endl;
+      return false;
+    }
+
+    std::lock_guard<std::mutex> guard(mutex);
+
+    if (!fuse(lowering.ops, output_op)) {
+      return false;
+    }
+    input_channels = lowering.input_shape[2];
+    planned_height = 0;
+    planned_width = 0;
+
+    // Shares the process-wide thread pool(--threads) with image processing.
+    const size_t pool_size = ThreadPool::global().size();
+    n_threads = (config.intra_op_threads > 0)
+                    ? std::min(size_t(config.intra_op_threads), pool_size)
+                    : pool_size;
+    scratch.resize(n_threads);
+
+    std::cout << "Native engine: " << layers.size() << " layers, "
+              << native::GemmKernelName() << " kernel, " << n_threads
+              << " thread(s)" << std::endl;
+
+    // Plan now when the input size is known, so the first prediction is fast.
+    if ((lowering.input_shape[0] > 0) && (lowering.input_shape[1] > 0)) {
+      plan(lowering.input_shape[0], lowering.input_shape[1]);
+    }
+    return true;
+  }
+
+  bool allocate_input(size_t width, size_t height, size_t channels,
+                      Image<float>* img) {
+    img->create(width, height, channels);
+    return true;
+  }
+
+  bool predict(const Image<float>& inp_img, Image<float>& out_img) {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (layers.empty()) {
+      std::cerr << "Model is not loaded." << std::endl;
+      return false;
+    }
+    if (inp_img.getChannels() != input_channels) {
+      std::cerr << "Input image must have " << input_channels
+                << " channels but got " << inp_img.getChannels() << std::endl;
+      return false;
+    }
+    if ((inp_img.getHeight() != planned_height) ||
+        (inp_img.getWidth() != planned_width)) {
+      plan(inp_img.getHeight(), inp_img.getWidth());
+    }
+
+    const Layer& last = layers.back();
+    out_img.create(last.width, last.height, last.channels);
+
+    for (size_t i = 0; i < layers.size(); i++) {
+      const Layer& layer = layers[i];
+      const float* in = buffer(layer.input, inp_img);
+      const float* res =
+          layer.has_residual ? buffer(layer.residual, inp_img) : nullptr;
+      float* out = (i + 1 == layers.size()) ? out_img.getData()
+                                            : arena.data() + layer.offset;
+      const size_t in_w = (layer.input < 0)
+                              ? inp_img.getWidth()
+                              : layers[size_t(layer.input)].width;
+      if (layer.is_conv) {
+        runConv(layer, in, in_w, res, out);
+      } else {
+        runElementwise(layer, in, res, out);
+      }
+    }
+    return true;
+  }
+
+  bool predict(const std::vector<Image<float>>& inp_imgs,
+               std::vector<Image<float>>& out_imgs) {
+    out_imgs.resize(inp_imgs.size());
+    for (size_t i = 0; i < inp_imgs.size(); i++) {
+      if (!predict(inp_imgs[i], out_imgs[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+private:
+  //
+  // Fuse ops into layers. Each layer starts from an op, then absorbs the
+  // following ops as long as the intermediate value has a single consumer:
+  //   affine after conv          -> folded into filter and bias
+  //   add of another value       -> residual
+  //   affine after residual      -> post_scale/post_shift
+  //   activation                 -> act
+  //
+  bool fuse(std::vector<Op>& ops, size_t output_op) {
+    layers.clear();
+    std::vector<bool> absorbed(ops.size(), false);
+
+    // Single consumer of each op(valid when n_consumers == 1).
+    std::vector<size_t> consumer(ops.size(), 0);
+    for (size_t i = 0; i < ops.size(); i++) {
+      for (size_t j = 0; j < ops[i].inputs.size(); j++) {
+        consumer[ops[i].inputs[j]] = i;
+      }
+    }
+
+    std::vector<Layer> unordered;
+    std::vector<size_t> input_op, residual_op, last_op;
+    for (size_t i = 0; i < ops.size(); i++) {
+      if (absorbed[i] || (ops[i].type == kOpInput)) {
+        continue;
+      }
+      Op& op = ops[i];
+      Layer layer;
+      layer.channels = op.channels;
+      size_t residual = 0;
+      if (op.type == kOpConv) {
+        layer.is_conv = true;
+        layer.conv = std::move(op.conv);
+      } else if (op.type == kOpAdd) {
+        residual = op.inputs[1];
+        layer.has_residual = true;
+      } else if (op.type == kOpAffine) {
+        layer.post_scale = op.scale;
+        layer.post_shift = op.shift;
+      } else {
+        layer.act = op.act;
+      }
+      absorbed[i] = true;
+
+      size_t last = i;
+      while ((ops[last].n_consumers == 1) && (last != output_op) &&
+             (layer.act == kActNone)) {
+        const size_t next = consumer[last];
+        const Op& c = ops[next];
+        if (absorbed[next]) {
+          break;
+        }
+        if (c.type == kOpAffine) {
+          if (layer.is_conv && !layer.has_residual && layer.post_scale.empty()) {
+            foldAffine(c.scale, c.shift, &layer.conv);
+          } else if (layer.post_scale.empty()) {
+            layer.post_scale = c.scale;
+            layer.post_shift = c.shift;
+          } else {
+            for (size_t k = 0; k < layer.channels; k++) {
+              layer.post_scale[k] *= c.scale[k];
+              layer.post_shift[k] = layer.post_shift[k] * c.scale[k] + c.shift[k];
+            }
+          }
+        } else if (c.type == kOpAdd) {
+          // The other operand is the output of another layer, since its only
+          // path to this add is absorbed here.
+          const size_t other = (c.inputs[0] == last) ? c.inputs[1] : c.inputs[0];
+          if (layer.has_residual || !layer.post_scale.empty() || (other == last)) {
+            break;
+          }
+          residual = other;
+          layer.has_residual = true;
+        } else if (c.type == kOpActivation) {
+          layer.act = c.act;
+        } else {
+          break;
+        }
+        absorbed[next] = true;
+        last = next;
+      }
+
+      input_op.push_back(op.inputs[0]);
+      residual_op.push_back(residual);
+      last_op.push_back(last);
+      unordered.push_back(std::move(layer));
+    }
+
+    // Layer producing the value of each op. -1 = network input.
+    std::vector<int> layer_of_op(ops.size(), -1);
+    for (size_t i = 0; i < unordered.size(); i++) {
+      layer_of_op[last_op[i]] = int(i);
+    }
+    if (layer_of_op[output_op] < 0) {
+      std::cerr << "Graph has no layer to evaluate." << std::endl;
+      return false;
+    }
+
+    // Emit layers in the order of their last op, which is a topological order.
+    std::vector<size_t> order(unordered.size());
+    for (size_t i = 0; i < order.size(); i++) {
+      order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&last_op](size_t a, size_t b) {
+      return last_op[a] < last_op[b];
+    });
+    std::vector<int> new_index(unordered.size());
+    for (size_t i = 0; i < order.size(); i++) {
+      new_index[order[i]] = int(i);
+    }
+    for (size_t i = 0; i < order.size(); i++) {
+      const size_t l = order[i];
+      Layer& layer = unordered[l];
+      const size_t value_ops[2] = {input_op[l], residual_op[l]};
+      int* value_layers[2] = {&layer.input, &layer.residual};
+      for (size_t v = 0; v < (layer.has_residual ? 2U : 1U); v++) {
+        const size_t o = value_ops[v];
+        if ((ops[o].type != kOpInput) && (layer_of_op[o] < 0)) {
+          std::cerr << "Internal error: value is not materialized." << std::endl;
+          layers.clear();
+          return false;
+        }
+        *value_layers[v] =
+            (layer_of_op[o] < 0) ? -1 : new_index[size_t(layer_of_op[o])];
+      }
+      layers.push_back(std::move(layer));
+    }
+    if (new_index[size_t(layer_of_op[output_op])] + 1 != int(layers.size())) {
+      std::cerr << "Output must be the last layer." << std::endl;
+      layers.clear();
+      return false;
+    }
+    return true;
+  }
+
+  static void foldAffine(const std::vector<float>& scale,
+                         const std::vector<float>& shift, ConvParams* conv) {
+    const size_t oc = conv->out_channels;
+    const size_t ic = conv->in_channels;
+    for (size_t i = 0; i < conv->filter.size(); i++) {
+      const size_t o = conv->transpose ? (i / ic) % oc : i % oc;
+      conv->filter[i] *= scale[o];
+    }
+    if (conv->bias.empty()) {
+      conv->bias.assign(oc, 0.0f);
+    }
+    for (size_t o = 0; o < oc; o++) {
+      conv->bias[o] = conv->bias[o] * scale[o] + shift[o];
+    }
+  }
+
+  // Compute layer shapes, GEMM passes, tasks and the arena for the input size.
+  void plan(size_t in_h, size_t in_w) {
+    size_t max_scratch = 0;
+    std::vector<size_t> last_use(layers.size(), 0);
+    for (size_t i = 0; i < layers.size(); i++) {
+      Layer& layer = layers[i];
+      const size_t h = (layer.input < 0) ? in_h : layers[size_t(layer.input)].height;
+      const size_t w = (layer.input < 0) ? in_w : layers[size_t(layer.input)].width;
+      if (layer.input >= 0) {
+        last_use[size_t(layer.input)] = i;
+      }
+      if (layer.has_residual && (layer.residual >= 0)) {
+        last_use[size_t(layer.residual)] = i;
+      }
+
+      layer.tasks.clear();
+      if (!layer.is_conv) {
+        layer.height = h;
+        layer.width = w;
+        continue;
+      }
+
+      PlanConv(layer, h, w, &layer.passes, &layer.height, &layer.width);
+      const size_t n_panels = GemmNumPanels(layer.conv.out_channels);
+      for (size_t p = 0; p < layer.passes.size(); p++) {
+        const ConvPass& pass = layer.passes[p];
+        if ((pass.rows == 0) || (pass.cols == 0)) {
+          continue;
+        }
+        const size_t task_rows =
+            std::min(pass.rows, std::max(size_t(1), kTaskPixels / pass.cols));
+        for (size_t r = 0; r < pass.rows; r += task_rows) {
+          for (size_t n = 0; n < n_panels; n += kTaskPanels) {
+            ConvTask task;
+            task.pass = p;
+            task.row_begin = r;
+            task.row_end = std::min(pass.rows, r + task_rows);
+            task.panel_begin = n;
+            task.panel_end = std::min(n_panels, n + kTaskPanels);
+            layer.tasks.push_back(task);
+          }
+        }
+        const size_t m = task_rows * pass.cols;
+        const size_t col_size = pass.direct ? 0 : m * pass.k;
+        max_scratch = std::max(
+            max_scratch, col_size + m * kTaskPanels * kGemmPanelWidth);
+      }
+    }
+
+    // Assign arena offsets. The last layer writes to the output image.
+    ArenaPlanner planner;
+    for (size_t i = 0; i + 1 < layers.size(); i++) {
+      Layer& layer = layers[i];
+      layer.offset = planner.allocate(layer.height * layer.width * layer.channels);
+      for (size_t j = 0; j <= i; j++) {
+        if (last_use[j] == i) {
+          planner.release(layers[j].offset,
+                          layers[j].height * layers[j].width * layers[j].channels);
+        }
+      }
+    }
+    arena.assign(planner.size(), 0.0f);
+    for (size_t t = 0; t < scratch.size(); t++) {
+      scratch[t].assign(max_scratch, 0.0f);
+    }
+
+    planned_height = in_h;
+    planned_width = in_w;
+  }
+
+  const float* buffer(int layer_index, const Image<float>& inp_img) const {
+    return (layer_index < 0) ? inp_img.getData()
+                             : arena.data() + layers[size_t(layer_index)].offset;
+  }
+
+  void runConv(const Layer& layer, const float* in, size_t in_w,
+               const float* res, float* out) {
+    const size_t in_h = (layer.input < 0) ? planned_height
+                                          : layers[size_t(layer.input)].height;
+    RunTasks(n_threads, layer.tasks.size(), [&](size_t t, size_t thread_id) {
+      runConvTask(layer, layer.tasks[t], in, in_h, in_w, res, out,
+                  scratch[thread_id].data());
+    });
+  }
+
+  static void runConvTask(const Layer& layer, const ConvTask& task,
+                          const float* in, size_t in_h, size_t in_w,
+                          const float* res, float* out, float* work) {
+    const ConvPass& pass = layer.passes[task.pass];
+    const size_t ic = layer.conv.in_channels;
+    const size_t oc = layer.conv.out_channels;
+    const size_t m = (task.row_end - task.row_begin) * pass.cols;
+
+    // GEMM A
+    const float* a;
+    size_t lda;
+    float* c = work;
+    if (pass.direct) {
+      a = in + task.row_begin * in_w * ic;
+      lda = ic;
+    } else {
+      float* col = work;
+      const size_t nx = pass.tap_x.size();
+      for (size_t i = task.row_begin; i < task.row_end; i++) {
+        for (size_t j = 0; j < pass.cols; j++) {
+          float* dst = col + ((i - task.row_begin) * pass.cols + j) * pass.k;
+          for (size_t ty = 0; ty < pass.tap_y.size(); ty++) {
+            const int y = int(i * pass.in_step_y) + pass.tap_y[ty];
+            for (size_t tx = 0; tx < nx; tx++) {
+              const int x = int(j * pass.in_step_x) + pass.tap_x[tx];
+              float* d = dst + (ty * nx + tx) * ic;
+              if ((y < 0) || (y >= int(in_h)) || (x < 0) || (x >= int(in_w))) {
+                std::fill(d, d + ic, 0.0f);
+              } else {
+                const float* s = in + (size_t(y) * in_w + size_t(x)) * ic;
+                std::copy(s, s + ic, d);
+              }
+            }
+          }
+        }
+      }
+      a = col;
+      lda = pass.k;
+      c = work + m * pass.k;
+    }
+
+    // GEMM C = A * W
+    const size_t ldc = (task.panel_end - task.panel_begin) * kGemmPanelWidth;
+    if (pass.k == 0) {
+      std::fill(c, c + m * ldc, 0.0f);
+    } else {
+      Gemm(m, pass.k, a, lda, pass.packed_weights.data(), task.panel_begin,
+           task.panel_end, c, ldc);
+    }
+
+    // Epilogue
+    const size_t c_begin = task.panel_begin * kGemmPanelWidth;
+    const size_t c_end = std::min(oc, task.panel_end * kGemmPanelWidth);
+    for (size_t i = task.row_begin; i < task.row_end; i++) {
+      const size_t y = pass.out_y0 + i * pass.out_step_y;
+      for (size_t j = 0; j < pass.cols; j++) {
+        const size_t x = pass.out_x0 + j * pass.out_step_x;
+        const size_t pixel = y * layer.width + x;
+        const float* acc = c + ((i - task.row_begin) * pass.cols + j) * ldc;
+        Epilogue(layer, acc, res ? res + pixel * oc : nullptr, out + pixel * oc,
+                 c_begin, c_end);
+      }
+    }
+  }
+
+  void runElementwise(const Layer& layer, const float* in, const float* res,
+                      float* out) {
+    const size_t ch = layer.channels;
+    const size_t w = layer.width;
+    RunTasks(n_threads, layer.height, [&](size_t y, size_t) {
+      for (size_t x = 0; x < w; x++) {
+        const size_t offset = (y * w + x) * ch;
+        Epilogue(layer, in + offset, res ? res + offset : nullptr, out + offset,
+                 0, ch);
+      }
+    });
+  }
+
+  std::mutex mutex;
+  std::vector<Layer> layers;
+  size_t input_channels = 0;
+  size_t planned_height = 0;
+  size_t planned_width = 0;
+  std::vector<float> arena;
+  std::vector<std::vector<float>> scratch;  // per thread
+  size_t n_threads = 1;
+};
+
+// PImpl pattern
+NativePredictor::NativePredictor() : impl(new Impl()) {}
+NativePredictor::~NativePredictor() {}
+void NativePredictor::init(int argc, char* argv[]) { impl->init(argc, argv); }
+bool NativePredictor::load(const std::string& graph_filename,
+                           const std::string& inp_layer,
+                           const std::string& out_layer,
+                           const SessionConfig& config) {
+  return impl->load(graph_filename, inp_layer, out_layer, config);
+}
+bool NativePredictor::allocate_input(size_t width, size_t height,
+                                     size_t channels, Image<float>* img) {
+  return impl->allocate_input(width, height, channels, img);
+}
+bool NativePredictor::predict(const Image<float>& inp_img,
+                              Image<float>& out_img) {
+  return impl->predict(inp_img, out_img);
+}
+bool NativePredictor::predict(const std::vector<Image<float>>& inp_imgs,
+                              std::vector<Image<float>>& out_imgs) {
+  return impl->predict(inp_imgs, out_imgs);
+}
+
+} // namespace prnet
@@ -0,0 +1,62 @@
+#ifndef PRNET_INFER_NATIVE_PREDICTOR_H_
+#define PRNET_INFER_NATIVE_PREDICTOR_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "predictor.h"
+
+namespace prnet {
+
+///
+/// Built-in CPU inference engine for resfcn256. No TensorFlow runtime.
+///
+/// Weights are read from the frozen GraphDef once at load time. Constant
+/// subgraphs and batch norms are folded into the convolution weights, and
+/// bias, residual add and activation are fused into the convolution.
+/// Conv2D and Conv2DTranspose(Conv2DBackpropInput) run as im2col + blocked
+/// GEMM(native_kernels.h). Activations live in an arena planned for the input
+/// size, so prediction does not allocate memory.
+///
+/// Supported ops: Placeholder, Const, Identity, Cast, Conv2D,
+/// Conv2DBackpropInput, _FusedConv2D(BiasAdd, Relu), FusedBatchNorm, BiasAdd,
+/// Add, Sub, Mul, RealDiv, Relu, Sigmoid and elementwise ops on constants.
+///
+class NativePredictor : public Predictor {
+public:
+  NativePredictor();
+  ~NativePredictor() override;
+  void init(int argc, char* argv[]) override;
+
+  ///
+  /// Only `config.intra_op_threads` is used(0 = the number of cores).
+  /// Memmapped graph is not supported.
+  ///
+  bool load(const std::string& graph_filename, const std::string& inp_layer,
+            const std::string& out_layer,
+            const SessionConfig& config) override;
+
+  bool allocate_input(size_t width, size_t height, size_t channels,
+                      Image<float>* img) override;
+
+  ///
+  /// Output image storage is reused when it already has the output size.
+  ///
+  bool predict(const Image<float>& inp_img, Image<float>& out_img) override;
+
+  ///
+  /// Batched prediction. Images are evaluated one by one(each evaluation
+  /// uses all threads).
+  ///
+  bool predict(const std::vector<Image<float>>& inp_imgs,
+               std::vector<Image<float>>& out_imgs) override;
+
+private:
+  class Impl;
+  std::unique_ptr<Impl> impl;
+};
+
+} // namespace prnet
+
+#endif // PRNET_INFER_NATIVE_PREDICTOR_H_
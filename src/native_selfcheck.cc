@@ -0,0 +1,454 @@
+#include "graph_def_reader.h"
+#include "graph_def_writer.h"
+#include "native_kernels.h"
+#include "native_predictor.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace prnet;
+
+//
+// Self-check of the native engine. Builds a tiny frozen graph with
+// conv, conv-transpose and batch norm, runs it with NativePredictor using
+// each GEMM kernel and compares the result with a naive reference.
+//
+//   prnet-native-check [graph_file]
+//
+// `graph_file`(default: prnet_native_check.pb) is a temporary file.
+//
+
+namespace {
+
+// NHWC tensor with batch size 1.
+struct Tensor {
+  size_t h = 0;
+  size_t w = 0;
+  size_t c = 0;
+  std::vector<float> data;
+
+  void create(size_t _h, size_t _w, size_t _c) {
+    h = _h;
+    w = _w;
+    c = _c;
+    data.assign(h * w * c, 0.0f);
+  }
+  float& at(size_t y, size_t x, size_t ch) {
+    return data[(y * w + x) * c + ch];
+  }
+  float at(size_t y, size_t x, size_t ch) const {
+    return data[(y * w + x) * c + ch];
+  }
+};
+
+// Deterministic values in [-scale, scale).
+class Random {
+public:
+  explicit Random(uint32_t seed) : state(seed) {}
+
+  float next(float scale) {
+    state = state * 1664525u + 1013904223u;
+    return (float(state >> 8) / float(1 << 24) * 2.0f - 1.0f) * scale;
+  }
+
+  std::vector<float> vector(size_t n, float scale, float offset = 0.0f) {
+    std::vector<float> v(n);
+    for (size_t i = 0; i < n; i++) {
+      v[i] = offset + next(scale);
+    }
+    return v;
+  }
+
+private:
+  uint32_t state;
+};
+
+// ----------------------------------------------------------------------------
+// Naive reference(TensorFlow semantics)
+
+// Padding before the first pixel of a SAME conv from `in` to `out`.
+size_t SamePad(size_t in, size_t out, size_t kernel, size_t stride) {
+  const size_t span = (out - 1) * stride + kernel;
+  return (span > in) ? (span - in) / 2 : 0;
+}
+
+// Conv2D. `f` is HWIO.
+Tensor RefConv(const Tensor& x, const std::vector<float>& f, size_t kernel,
+               size_t out_c, size_t stride, bool same) {
+  const size_t out_h =
+      same ? (x.h + stride - 1) / stride : (x.h - kernel) / stride + 1;
+  const size_t out_w =
+      same ? (x.w + stride - 1) / stride : (x.w - kernel) / stride + 1;
+  const size_t pad_y = same ? SamePad(x.h, out_h, kernel, stride) : 0;
+  const size_t pad_x = same ? SamePad(x.w, out_w, kernel, stride) : 0;
+  Tensor y;
+  y.create(out_h, out_w, out_c);
+  for (size_t oy = 0; oy < out_h; oy++) {
+    for (size_t ox = 0; ox < out_w; ox++) {
+      for (size_t oc = 0; oc < out_c; oc++) {
+        double sum = 0.0;
+        for (size_t ky = 0; ky < kernel; ky++) {
+          const int iy = int(oy * stride + ky) - int(pad_y);
+          if ((iy < 0) || (iy >= int(x.h))) {
+            continue;
+          }
+          for (size_t kx = 0; kx < kernel; kx++) {
+            const int ix = int(ox * stride + kx) - int(pad_x);
+            if ((ix < 0) || (ix >= int(x.w))) {
+              continue;
+            }
+            for (size_t ic = 0; ic < x.c; ic++) {
+              sum += double(x.at(size_t(iy), size_t(ix), ic)) *
+                     double(f[((ky * kernel + kx) * x.c + ic) * out_c + oc]);
+            }
+          }
+        }
+        y.at(oy, ox, oc) = float(sum);
+      }
+    }
+  }
+  return y;
+}
+
+// Conv2DBackpropInput. `f` is [kernel, kernel, out_c, in_c]. Evaluated as a
+// scatter, independent of the phase decomposition of the engine.
+Tensor RefConvTranspose(const Tensor& x, const std::vector<float>& f,
+                        size_t kernel, size_t out_c, size_t stride,
+                        bool same) {
+  const size_t out_h = same ? x.h * stride : (x.h - 1) * stride + kernel;
+  const size_t out_w = same ? x.w * stride : (x.w - 1) * stride + kernel;
+  const size_t pad_y = same ? SamePad(out_h, x.h, kernel, stride) : 0;
+  const size_t pad_x = same ? SamePad(out_w, x.w, kernel, stride) : 0;
+  std::vector<double> sum(out_h * out_w * out_c, 0.0);
+  for (size_t iy = 0; iy < x.h; iy++) {
+    for (size_t ix = 0; ix < x.w; ix++) {
+      for (size_t ky = 0; ky < kernel; ky++) {
+        const int oy = int(iy * stride + ky) - int(pad_y);
+        if ((oy < 0) || (oy >= int(out_h))) {
+          continue;
+        }
+        for (size_t kx = 0; kx < kernel; kx++) {
+          const int ox = int(ix * stride + kx) - int(pad_x);
+          if ((ox < 0) || (ox >= int(out_w))) {
+            continue;
+          }
+          for (size_t oc = 0; oc < out_c; oc++) {
+            double& s = sum[(size_t(oy) * out_w + size_t(ox)) * out_c + oc];
+            for (size_t ic = 0; ic < x.c; ic++) {
+              s += double(x.at(iy, ix, ic)) *
+                   double(f[((ky * kernel + kx) * out_c + oc) * x.c + ic]);
+            }
+          }
+        }
+      }
+    }
+  }
+  Tensor y;
+  y.create(out_h, out_w, out_c);
+  for (size_t i = 0; i < sum.size(); i++) {
+    y.data[i] = float(sum[i]);
+  }
+  return y;
+}
+
+// FusedBatchNorm(inference) with TensorFlow's default epsilon.
+void RefBatchNorm(const std::vector<float>& gamma,
+                  const std::vector<float>& beta,
+                  const std::vector<float>& mean,
+                  const std::vector<float>& variance, Tensor* x) {
+  for (size_t i = 0; i < x->data.size(); i++) {
+    const size_t c = i % x->c;
+    x->data[i] = (x->data[i] - mean[c]) / std::sqrt(variance[c] + 0.0001f) *
+                     gamma[c] +
+                 beta[c];
+  }
+}
+
+void RefBiasAdd(const std::vector<float>& bias, Tensor* x) {
+  for (size_t i = 0; i < x->data.size(); i++) {
+    x->data[i] += bias[i % x->c];
+  }
+}
+
+void RefRelu(Tensor* x) {
+  for (size_t i = 0; i < x->data.size(); i++) {
+    x->data[i] = std::max(0.0f, x->data[i]);
+  }
+}
+
+void RefAdd(const Tensor& b, Tensor* x) {
+  for (size_t i = 0; i < x->data.size(); i++) {
+    x->data[i] += b.data[i];
+  }
+}
+
+// ----------------------------------------------------------------------------
+// Test graph
+//
+//   x(3) -> conv 3x3 -> batch norm -> relu ----------------------+
+//        -> conv 4x4 stride 2 -> bias -> relu                     |
+//        -> conv-transpose 4x4 stride 2 SAME -> add <-------------+
+//        -> conv 1x1 -> bias
+//        -> conv-transpose 3x3 stride 2 VALID -> out(5)
+//
+// 20 -> 24 channels with a 4x4 kernel makes K = 320, which crosses the K
+// block of GEMM, and 24 output channels use a partial second panel.
+//
+
+const size_t kInChannels = 3;
+const size_t kMidChannels = 20;
+const size_t kDownChannels = 24;
+const size_t kOutChannels = 5;
+
+struct Weights {
+  std::vector<float> w1;  // [3, 3, 3, 20]
+  std::vector<float> gamma, beta, mean, variance;
+  std::vector<float> w2;  // [4, 4, 20, 24]
+  std::vector<float> b2;
+  std::vector<float> w3;  // [4, 4, 20, 24] (transposed)
+  std::vector<float> w4;  // [1, 1, 20, 3]
+  std::vector<float> b4;
+  std::vector<float> w5;  // [3, 3, 5, 3] (transposed)
+
+  explicit Weights(Random* r) {
+    w1 = r->vector(3 * 3 * kInChannels * kMidChannels, 0.3f);
+    gamma = r->vector(kMidChannels, 0.5f, 1.0f);
+    beta = r->vector(kMidChannels, 0.5f);
+    mean = r->vector(kMidChannels, 0.5f);
+    variance = r->vector(kMidChannels, 0.4f, 0.6f);
+    w2 = r->vector(4 * 4 * kMidChannels * kDownChannels, 0.1f);
+    b2 = r->vector(kDownChannels, 0.2f);
+    w3 = r->vector(4 * 4 * kMidChannels * kDownChannels, 0.1f);
+    w4 = r->vector(kMidChannels * kInChannels, 0.3f);
+    b4 = r->vector(kInChannels, 0.2f);
+    w5 = r->vector(3 * 3 * kOutChannels * kInChannels, 0.3f);
+  }
+};
+
+Tensor RefNetwork(const Weights& w, const Tensor& x) {
+  Tensor a = RefConv(x, w.w1, 3, kMidChannels, 1, true);
+  RefBatchNorm(w.gamma, w.beta, w.mean, w.variance, &a);
+  RefRelu(&a);
+  Tensor b = RefConv(a, w.w2, 4, kDownChannels, 2, true);
+  RefBiasAdd(w.b2, &b);
+  RefRelu(&b);
+  Tensor c = RefConvTranspose(b, w.w3, 4, kMidChannels, 2, true);
+  RefAdd(a, &c);
+  Tensor d = RefConv(c, w.w4, 1, kInChannels, 1, true);
+  RefBiasAdd(w.b4, &d);
+  return RefConvTranspose(d, w.w5, 3, kOutChannels, 2, false);
+}
+
+std::string FloatConst(const std::string& name,
+                       const std::vector<int64_t>& shape,
+                       const std::vector<float>& values) {
+  GraphNodeWriter node(name, "Const");
+  node.set_attr_type("dtype", kGraphDataTypeFloat);
+  node.set_attr_tensor(
+      "value", kGraphDataTypeFloat, shape,
+      std::string(reinterpret_cast<const char*>(values.data()),
+                  values.size() * sizeof(float)));
+  return node.serialize_field();
+}
+
+// `input_sizes` of Conv2DBackpropInput. Not evaluated by the engine.
+std::string SizesConst(const std::string& name) {
+  const int32_t sizes[4] = {1, 0, 0, 0};
+  GraphNodeWriter node(name, "Const");
+  node.set_attr_type("dtype", kGraphDataTypeInt32);
+  node.set_attr_tensor("value", kGraphDataTypeInt32, {4},
+                       std::string(reinterpret_cast<const char*>(sizes),
+                                   sizeof(sizes)));
+  return node.serialize_field();
+}
+
+std::string Conv(const std::string& name, const std::string& op,
+                 const std::vector<std::string>& inputs, int64_t stride,
+                 const std::string& padding) {
+  GraphNodeWriter node(name, op);
+  for (size_t i = 0; i < inputs.size(); i++) {
+    node.add_input(inputs[i]);
+  }
+  node.set_attr_type("T", kGraphDataTypeFloat);
+  node.set_attr_int_list("strides", {1, stride, stride, 1});
+  node.set_attr_string("padding", padding);
+  node.set_attr_string("data_format", "NHWC");
+  return node.serialize_field();
+}
+
+std::string Binary(const std::string& name, const std::string& op,
+                   const std::string& a, const std::string& b) {
+  GraphNodeWriter node(name, op);
+  node.add_input(a);
+  node.add_input(b);
+  node.set_attr_type("T", kGraphDataTypeFloat);
+  return node.serialize_field();
+}
+
+std::string Relu(const std::string& name, const std::string& input) {
+  GraphNodeWriter node(name, "Relu");
+  node.add_input(input);
+  node.set_attr_type("T", kGraphDataTypeFloat);
+  return node.serialize_field();
+}
+
+std::string BuildGraph(const Weights& w) {
+  const int64_t mid = int64_t(kMidChannels);
+  const int64_t down = int64_t(kDownChannels);
+  const int64_t in = int64_t(kInChannels);
+  const int64_t out = int64_t(kOutChannels);
+
+  std::string graph;
+
+  GraphNodeWriter x("x", "Placeholder");
+  x.set_attr_type("dtype", kGraphDataTypeFloat);
+  x.set_attr_shape("shape", {-1, -1, -1, in});
+  graph += x.serialize_field();
+
+  graph += FloatConst("w1", {3, 3, in, mid}, w.w1);
+  graph += Conv("conv1", "Conv2D", {"x", "w1"}, 1, "SAME");
+  graph += FloatConst("gamma", {mid}, w.gamma);
+  graph += FloatConst("beta", {mid}, w.beta);
+  graph += FloatConst("mean", {mid}, w.mean);
+  graph += FloatConst("variance", {mid}, w.variance);
+  GraphNodeWriter bn("bn1", "FusedBatchNorm");
+  bn.add_input("conv1");
+  bn.add_input("gamma");
+  bn.add_input("beta");
+  bn.add_input("mean");
+  bn.add_input("variance");
+  bn.set_attr_type("T", kGraphDataTypeFloat);
+  bn.set_attr_bool("is_training", false);
+  graph += bn.serialize_field();
+  graph += Relu("relu1", "bn1");
+
+  graph += FloatConst("w2", {4, 4, mid, down}, w.w2);
+  graph += Conv("conv2", "Conv2D", {"relu1", "w2"}, 2, "SAME");
+  graph += FloatConst("b2", {down}, w.b2);
+  graph += Binary("bias2", "BiasAdd", "conv2", "b2");
+  graph += Relu("relu2", "bias2");
+
+  graph += SizesConst("sizes3");
+  graph += FloatConst("w3", {4, 4, mid, down}, w.w3);
+  graph += Conv("deconv3", "Conv2DBackpropInput",
+                {"sizes3", "w3", "relu2"}, 2, "SAME");
+  graph += Binary("add3", "Add", "deconv3", "relu1");
+
+  graph += FloatConst("w4", {1, 1, mid, in}, w.w4);
+  graph += Conv("conv4", "Conv2D", {"add3", "w4"}, 1, "SAME");
+  graph += FloatConst("b4", {in}, w.b4);
+  graph += Binary("bias4", "BiasAdd", "conv4", "b4");
+
+  graph += SizesConst("sizes5");
+  graph += FloatConst("w5", {3, 3, out, in}, w.w5);
+  graph += Conv("out", "Conv2DBackpropInput", {"sizes5", "w5", "bias4"}, 2,
+                "VALID");
+
+  return graph;
+}
+
+bool WriteFile(const std::string& filename, const std::string& content) {
+  std::ofstream ofs(filename.c_str(), std::ios::binary);
+  if (!ofs) {
+    std::cerr << "Failed to open " << filename << std::endl;
+    return false;
+  }
+  ofs.write(content.data(), std::streamsize(content.size()));
+  return bool(ofs);
+}
+
+// Compare engine output with the reference. Returns the max abs error, or
+// infinity on shape mismatch.
+float MaxError(const Image<float>& out, const Tensor& ref, float* max_ref) {
+  if ((out.getHeight() != ref.h) || (out.getWidth() != ref.w) ||
+      (out.getChannels() != ref.c)) {
+    std::cerr << "Output shape mismatch : " << out.getHeight() << "x"
+              << out.getWidth() << "x" << out.getChannels() << " vs "
+              << ref.h << "x" << ref.w << "x" << ref.c << std::endl;
+    return INFINITY;
+  }
+  float max_err = 0.0f;
+  *max_ref = 0.0f;
+  const float* data = out.getData();
+  for (size_t i = 0; i < ref.data.size(); i++) {
+    max_err = std::max(max_err, std::fabs(data[i] - ref.data[i]));
+    *max_ref = std::max(*max_ref, std::fabs(ref.data[i]));
+  }
+  return max_err;
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+  const std::string graph_filename =
+      (argc > 1) ? argv[1] : "prnet_native_check.pb";
+
+  // Several threads even on a single core, so that tasks are split.
+  SetNumThreads(4);
+
+  Random random(12345);
+  const Weights weights(&random);
+  if (!WriteFile(graph_filename, BuildGraph(weights))) {
+    return -1;
+  }
+
+  // Sizes must be even for the residual add. The second size re-plans the
+  // arena.
+  const size_t sizes[][2] = {{16, 12}, {10, 14}};
+
+  std::vector<Tensor> inputs, refs;
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    Tensor x;
+    x.create(sizes[s][0], sizes[s][1], kInChannels);
+    x.data = random.vector(x.data.size(), 1.0f);
+    inputs.push_back(x);
+    refs.push_back(RefNetwork(weights, x));
+  }
+
+  const char* kernel_names[] = {"generic", "avx2"};
+  bool ok = true;
+  for (size_t k = 0; k < sizeof(kernel_names) / sizeof(kernel_names[0]);
+       k++) {
+    if (!native::SelectGemmKernel(kernel_names[k])) {
+      std::cout << kernel_names[k] << ": not supported on this CPU. Skipped."
+                << std::endl;
+      continue;
+    }
+
+    NativePredictor predictor;
+    if (!predictor.load(graph_filename, "x", "out", SessionConfig())) {
+      ok = false;
+      break;
+    }
+
+    for (size_t s = 0; s < inputs.size(); s++) {
+      const Tensor& x = inputs[s];
+      Image<float> inp_img, out_img;
+      inp_img.create(x.w, x.h, x.c, x.data.data());
+      float max_ref = 0.0f;
+      const float err = predictor.predict(inp_img, out_img)
+                            ? MaxError(out_img, refs[s], &max_ref)
+                            : INFINITY;
+      // Reference accumulates in double. Allow float rounding of the sums.
+      const bool pass = err <= 1e-4f * std::max(1.0f, max_ref);
+      std::cout << native::GemmKernelName() << " " << x.h << "x" << x.w
+                << ": max error " << err << "(max " << max_ref << ") "
+                << (pass ? "OK" : "FAILED") << std::endl;
+      ok = ok && pass;
+    }
+  }
+
+  std::remove(graph_filename.c_str());
+
+  std::cout << (ok ? "Native engine self-check passed."
+                   : "Native engine self-check FAILED.")
+            << std::endl;
+  return ok ? 0 : 1;
+}
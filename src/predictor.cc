@@ -0,0 +1,170 @@
+#include "predictor.h"
+
+#if defined(USE_TF_AOT)
+#include "aot_predictor.h"
+#elif defined(USE_NATIVE_ENGINE)
+#include "native_predictor.h"
+#else
+#include "tf_predictor.h"
+#endif
+#include "synthetic_predictor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace prnet {
+
+Predictor::~Predictor() {}
+
+void Predictor::init(int argc, char* argv[]) {
+  (void)argc;
+  (void)argv;
+}
+
+void Predictor::set_face_data(const FaceData* _face_data) {
+  face_data = _face_data;
+}
+
+bool Predictor::preprocess(const ImageView<const uint8_t>& frame,
+                           const CropRegion& region,
+                           Image<float>* cropped_img) {
+  // 8-bit sRGB -> linear
+  CropImage(frame, region, kPredictorInputSize, kPredictorInputSize,
+            cropped_img, 2.2f);
+  return true;
+}
+
+bool Predictor::preprocess(const ImageView<const uint8_t>& frame,
+                           const std::vector<CropRegion>& regions,
+                           std::vector<Image<float>>* cropped_imgs) {
+  cropped_imgs->resize(regions.size());
+  for (size_t i = 0; i < regions.size(); i++) {
+    if (!preprocess(frame, regions[i], &(*cropped_imgs)[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Predictor::postprocess(const PositionRemap& remap,
+                            FaceGeometry* geometry) {
+  if (!face_data) {
+    std::cerr << "Face data is not set to the predictor." << std::endl;
+    return false;
+  }
+  Image<float>& pos_img = geometry->pos_img;
+  const size_t width = pos_img.getWidth();
+  const size_t height = pos_img.getHeight();
+  if (pos_img.getChannels() != 3) {
+    std::cerr << "Position map must have 3 channels but has "
+              << pos_img.getChannels() << std::endl;
+    return false;
+  }
+
+  // Restore position coordinate.
+  float* pos = pos_img.getData();
+  for (size_t i = 0; i < width * height; i++) {
+    pos[3 * i + 0] = pos[3 * i + 0] * remap.scale + remap.shift_x;
+    pos[3 * i + 1] = pos[3 * i + 1] * remap.scale + remap.shift_y;
+    pos[3 * i + 2] = pos[3 * i + 2] * remap.scale;  // no z offset
+  }
+  // Look up vertex positions.
+  const std::vector<uint32_t>& face_indices = face_data->face_indices;
+  geometry->vertices.resize(3 * face_indices.size());
+  for (size_t i = 0; i < face_indices.size(); i++) {
+    if (face_indices[i] >= width * height) {
+      std::cerr << "Face index out of range : " << face_indices[i]
+                << std::endl;
+      return false;
+    }
+    std::copy_n(pos + 3 * face_indices[i], 3, &geometry->vertices[3 * i]);
+  }
+
+  // Look up 68 keypoints. `uv_kpt_indices` = [x0, x1, ..., y0, y1, ...]
+  const size_t n_pt = face_data->uv_kpt_indices.size() / 2;
+  geometry->keypoints.resize(3 * n_pt);
+  for (size_t i = 0; i < n_pt; i++) {
+    const size_t x = face_data->uv_kpt_indices[i];
+    const size_t y = face_data->uv_kpt_indices[i + n_pt];
+    if ((x >= width) || (y >= height)) {
+      std::cerr << "Keypoint index out of range : " << x << ", " << y
+                << std::endl;
+      return false;
+    }
+    std::copy_n(pos + 3 * (y * width + x), 3, &geometry->keypoints[3 * i]);
+  }
+
+  return true;
+}
+
+bool Predictor::predict_geometry(const Image<float>& inp_img,
+                                 const PositionRemap& remap,
+                                 FaceGeometry* geometry) {
+  return predict(inp_img, geometry->pos_img) && postprocess(remap, geometry);
+}
+
+bool Predictor::predict_frame(const ImageView<const uint8_t>& frame,
+                              const CropRegion& region,
+                              Image<float>* cropped_img,
+                              const PositionRemap& remap,
+                              FaceGeometry* geometry) {
+  return preprocess(frame, region, cropped_img) &&
+         predict_geometry(*cropped_img, remap, geometry);
+}
+
+bool Predictor::predict_frame(const ImageView<const uint8_t>& frame,
+                              const std::vector<CropRegion>& regions,
+                              std::vector<Image<float>>* cropped_imgs,
+                              std::vector<Image<float>>* pos_imgs) {
+  return preprocess(frame, regions, cropped_imgs) &&
+         predict(*cropped_imgs, *pos_imgs);
+}
+
+std::vector<std::string> GetPredictorBackends() {
+  std::vector<std::string> backends;
+#if defined(USE_TF_AOT)
+  backends.push_back("aot");
+#elif defined(USE_NATIVE_ENGINE)
+  backends.push_back("native");
+#else
+  backends.push_back("tensorflow");
+#endif
+  backends.push_back("synthetic");
+  return backends;
+}
+
+std::unique_ptr<Predictor> CreatePredictor(const std::string& backend,
+                                           const PredictorOptions& options) {
+  std::unique_ptr<Predictor> predictor;
+#if defined(USE_TF_AOT)
+  if (backend == "aot") {
+    predictor.reset(new AotPredictor());
+  }
+#elif defined(USE_NATIVE_ENGINE)
+  if (backend == "native") {
+    predictor.reset(new NativePredictor());
+  }
+#else
+  if (backend == "tensorflow") {
+    predictor.reset(new TensorflowPredictor());
+  }
+#endif
+  if (backend == "synthetic") {
+    if (!options.face_data) {
+      std::cerr << "Synthetic backend requires face data." << std::endl;
+      return predictor;
+    }
+    predictor.reset(new SyntheticPredictor(*options.face_data,
+                                           options.synthetic_latency_ms));
+  }
+
+  if (!predictor) {
+    std::cerr << "Unknown backend : " << backend << std::endl;
+    return predictor;
+  }
+  predictor->set_face_data(options.face_data);
+  return predictor;
+}
+
+} // namespace prnet
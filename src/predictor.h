@@ -0,0 +1,169 @@
+#ifndef PRNET_INFER_PREDICTOR_H_
+#define PRNET_INFER_PREDICTOR_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "face-data.h"
+#include "face_cropper.h"
+#include "image.h"
+#include "session_config.h"
+
+namespace prnet {
+
+///
+/// Width and height of network input(resfcn256).
+///
+const size_t kPredictorInputSize = 256;
+
+///
+/// Maps a normalized posmap(network output) to image coordinates:
+/// `(x, y, z) * scale + (shift_x, shift_y, 0)`.
+///
+struct PositionRemap {
+  float scale = 1.f;
+  float shift_x = 0.f;
+  float shift_y = 0.f;
+};
+
+///
+/// Postprocessed network output.
+///
+struct FaceGeometry {
+  Image<float> pos_img;          // Remapped posmap(for texture)
+  std::vector<float> vertices;   // xyz of `FaceData::face_indices`
+  std::vector<float> keypoints;  // xyz of 68 landmarks(`uv_kpt_indices`)
+};
+
+///
+/// Network evaluation backend. Input is a cropped face image and output is a
+/// position map normalized by `width * 1.1`.
+///
+/// Backends(see CreatePredictor()):
+///   "tensorflow" : TensorFlow C++ API(tensorflow_cc)
+///   "aot"        : resfcn256 compiled ahead-of-time by tfcompile(XLA)
+///   "native"     : Built-in CPU inference engine(no TensorFlow)
+///   "synthetic"  : No network. Canonical face posmap with fake latency
+///
+/// The first three are exclusive and selected at CMake time. "synthetic" is
+/// always available.
+///
+class Predictor {
+public:
+  virtual ~Predictor();
+
+  ///
+  /// Process-wide initialization(e.g. command line flags of the runtime).
+  ///
+  virtual void init(int argc, char* argv[]);
+
+  ///
+  /// Face data(vertex and keypoint indices) used by postprocess(). Must be
+  /// set before load() to build the in-graph postprocessing.
+  /// `face_data` must outlive the predictor.
+  ///
+  void set_face_data(const FaceData* _face_data);
+
+  virtual bool load(const std::string& graph_filename,
+                    const std::string& inp_layer, const std::string& out_layer,
+                    const SessionConfig& config = SessionConfig()) = 0;
+
+  ///
+  /// Allocate an input image. A backend may give an image whose storage is
+  /// its input buffer, so that predict() consumes it without copy.
+  ///
+  virtual bool allocate_input(size_t width, size_t height, size_t channels,
+                              Image<float>* img) = 0;
+
+  ///
+  /// Thread-safe.
+  ///
+  virtual bool predict(const Image<float>& inp_img, Image<float>& out_img) = 0;
+
+  ///
+  /// Batched prediction. All input images must have the same size.
+  ///
+  virtual bool predict(const std::vector<Image<float>>& inp_imgs,
+                       std::vector<Image<float>>& out_imgs) = 0;
+
+  ///
+  /// Crop `region` of 8-bit sRGB `frame`(an Image or a view) into the network
+  /// input(linear color space, `kPredictorInputSize` square).
+  /// Runs on the host by default, sampling the 8-bit frame directly(the frame
+  /// is not converted to float). TensorflowPredictor runs it in the graph
+  /// when `SessionConfig::in_graph_preprocess` is set.
+  ///
+  virtual bool preprocess(const ImageView<const uint8_t>& frame,
+                          const CropRegion& region, Image<float>* cropped_img);
+
+  ///
+  /// preprocess() of all `regions` of `frame`. TensorflowPredictor crops them
+  /// with a single Session::Run when `SessionConfig::in_graph_preprocess` is
+  /// set(the frame is fed and converted once per call).
+  ///
+  virtual bool preprocess(const ImageView<const uint8_t>& frame,
+                          const std::vector<CropRegion>& regions,
+                          std::vector<Image<float>>* cropped_imgs);
+
+  ///
+  /// Remap `geometry->pos_img`(network output) in place and gather mesh
+  /// vertices and keypoints from it. Runs on the host.
+  ///
+  virtual bool postprocess(const PositionRemap& remap, FaceGeometry* geometry);
+
+  ///
+  /// predict() and postprocess(). TensorflowPredictor evaluates both with a
+  /// single Session::Run when `SessionConfig::in_graph_postprocess` is set.
+  ///
+  virtual bool predict_geometry(const Image<float>& inp_img,
+                                const PositionRemap& remap,
+                                FaceGeometry* geometry);
+
+  ///
+  /// preprocess(), predict() and postprocess(). TensorflowPredictor runs the
+  /// in-graph stages(`SessionConfig::in_graph_*`) with a single Session::Run.
+  ///
+  virtual bool predict_frame(const ImageView<const uint8_t>& frame,
+                             const CropRegion& region,
+                             Image<float>* cropped_img,
+                             const PositionRemap& remap,
+                             FaceGeometry* geometry);
+
+  ///
+  /// preprocess() and batched predict() of all `regions` of `frame` into
+  /// `pos_imgs`(not postprocessed). TensorflowPredictor runs both with a
+  /// single Session::Run when `SessionConfig::in_graph_preprocess` is set.
+  ///
+  virtual bool predict_frame(const ImageView<const uint8_t>& frame,
+                             const std::vector<CropRegion>& regions,
+                             std::vector<Image<float>>* cropped_imgs,
+                             std::vector<Image<float>>* pos_imgs);
+
+protected:
+  const FaceData* face_data = nullptr;
+};
+
+struct PredictorOptions {
+  // Indices for postprocess(). Canonical face shape for "synthetic" backend.
+  const FaceData* face_data = nullptr;
+
+  // "synthetic" backend
+  double synthetic_latency_ms = 0.0;  // Fake network time per image
+};
+
+///
+/// Names of backends compiled in. The first one is the default.
+///
+std::vector<std::string> GetPredictorBackends();
+
+///
+/// Create a predictor of `backend`. Returns nullptr for an unknown backend.
+///
+std::unique_ptr<Predictor> CreatePredictor(
+    const std::string& backend,
+    const PredictorOptions& options = PredictorOptions());
+
+} // namespace prnet
+
+#endif // PRNET_INFER_PREDICTOR_H_
@@ -0,0 +1,73 @@
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Weverything"
+#endif
+
+#include "cxxopts.hpp"
+
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+
+#include "graph_quantizer.h"
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+using namespace prnet;
+
+//
+// Convert frozen graph into a variant with reduced precision weights.
+// Validate the result with `prnet --validate-graph`.
+//
+int main(int argc, char **argv) {
+  cxxopts::Options options("prnet-quantize",
+                           "Quantize weights of PRNet frozen graph");
+  options.add_options()("i,input", "Input frozen graph file",
+                        cxxopts::value<std::string>())(
+      "o,output", "Output graph file", cxxopts::value<std::string>())(
+      "mode", "Weight precision. \"int8\" or \"fp16\"",
+      cxxopts::value<std::string>()->default_value("int8"))(
+      "per-tensor", "Use one int8 range per tensor instead of per channel")(
+      "min-elements", "Keep constants smaller than this in float",
+      cxxopts::value<int>()->default_value("1024"));
+
+  auto result = options.parse(argc, argv);
+
+  if (!result.count("input") || !result.count("output")) {
+    std::cerr << "Please specify input and output graph with -i and -o option."
+              << std::endl;
+    return -1;
+  }
+
+  QuantizeOptions quantize_options;
+  const std::string mode = result["mode"].as<std::string>();
+  if (mode == "int8") {
+    quantize_options.precision = kWeightPrecisionInt8;
+  } else if (mode == "fp16") {
+    quantize_options.precision = kWeightPrecisionHalf;
+  } else {
+    std::cerr << "Unknown mode : " << mode << "(\"int8\" or \"fp16\")"
+              << std::endl;
+    return -1;
+  }
+  quantize_options.per_channel = !result.count("per-tensor");
+  quantize_options.min_elements =
+      size_t(std::max(0, result["min-elements"].as<int>()));
+
+  const std::string input_filename = result["input"].as<std::string>();
+  const std::string output_filename = result["output"].as<std::string>();
+  QuantizeStats stats;
+  if (!QuantizeGraphFile(input_filename, output_filename, quantize_options,
+                         &stats)) {
+    return -1;
+  }
+
+  std::cout << "Quantized " << stats.n_quantized << " weight tensors : "
+            << stats.float_bytes << " -> " << stats.quantized_bytes
+            << " bytes, max abs error = " << stats.max_abs_error << std::endl;
+  std::cout << "Wrote " << output_filename << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,28 @@
+#include "session_config.h"
+
+#include <algorithm>
+#include <iostream>
+#include <thread>
+
+namespace prnet {
+
+bool GetSessionConfigPreset(const std::string& name, SessionConfig* config) {
+  if (name == "latency") {
+    const int n_cores = int(std::max(1U, std::thread::hardware_concurrency()));
+    config->intra_op_threads = n_cores;
+    config->inter_op_threads = 1;  // resfcn256 is almost a linear chain of ops.
+    config->use_per_session_threads = false;
+    config->use_global_pool = false;
+  } else if (name == "throughput") {
+    config->intra_op_threads = 1;
+    config->inter_op_threads = 1;
+    config->use_per_session_threads = true;
+    config->use_global_pool = false;
+  } else {
+    std::cerr << "Unknown session config preset : " << name << std::endl;
+    return false;
+  }
+  return true;
+}
+
+} // namespace prnet
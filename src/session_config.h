@@ -0,0 +1,46 @@
+#ifndef PRNET_INFER_SESSION_CONFIG_H_
+#define PRNET_INFER_SESSION_CONFIG_H_
+
+#include <string>
+
+namespace prnet {
+
+///
+/// Options of TensorFlow session creation.
+/// AOT backend(aot_predictor.h) only uses `intra_op_threads`.
+///
+struct SessionConfig {
+  int intra_op_threads = 0;  // 0 = TensorFlow default(the number of cores)
+  int inter_op_threads = 0;  // 0 = TensorFlow default(the number of cores)
+  bool use_per_session_threads = false;
+  // Run inter-op work in a process-wide named pool shared by all sessions.
+  bool use_global_pool = false;
+
+  // Optimize the graph at load time(see graph_optimizer.h). Optimized graph
+  // is cached next to the original graph file.
+  bool optimize_graph = false;
+
+  // Graph file is in memmapped package format
+  // (see `convert_graphdef_memmapped_format` in TensorFlow).
+  bool use_memmapped_graph = false;
+
+  // Prepend preprocessing(8-bit frame -> linear color -> CropAndResize) to
+  // the graph so that Predictor::predict_frame() runs in one Session::Run.
+  bool in_graph_preprocess = false;
+
+  // Append postprocessing(remap posmap -> Gather mesh vertices and 68
+  // keypoints) to the graph so that Predictor::predict_geometry() returns
+  // them from the same Session::Run. Requires Predictor::set_face_data().
+  bool in_graph_postprocess = false;
+};
+
+///
+/// Get preset session config.
+///   "latency"    : A single request uses all cores.
+///   "throughput" : Single-threaded session. Run many sessions in parallel.
+///
+bool GetSessionConfigPreset(const std::string& name, SessionConfig* config);
+
+} // namespace prnet
+
+#endif // PRNET_INFER_SESSION_CONFIG_H_
@@ -0,0 +1,158 @@
+#include "synthetic_predictor.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+namespace prnet {
+
+namespace {
+
+// Resolution of UV position map. `face_indices` index into it.
+const size_t kPosMapSize = 256;
+
+// Position map is normalized by this value(`MaxPos` of PRNet).
+const float kMaxPos = float(kPosMapSize) * 1.1f;
+
+// Fraction of the crop covered by the face.
+const float kFaceExtent = 0.8f;
+
+} // anonymous namespace
+
+class SyntheticPredictor::Impl {
+public:
+  Impl(const FaceData& _face_data, double _latency_ms)
+      : face_data(_face_data), latency_ms(_latency_ms) {}
+
+  bool load() {
+    const std::vector<std::array<float, 3>>& vertices =
+        face_data.canonical_vertices;
+    if (vertices.empty() ||
+        (vertices.size() != face_data.face_indices.size())) {
+      std::cerr << "Synthetic backend: canonical vertices and face indices "
+                   "are required."
+                << std::endl;
+      return false;
+    }
+
+    float bmin[3] = {vertices[0][0], vertices[0][1], vertices[0][2]};
+    float bmax[3] = {vertices[0][0], vertices[0][1], vertices[0][2]};
+    for (size_t i = 0; i < vertices.size(); i++) {
+      for (size_t k = 0; k < 3; k++) {
+        bmin[k] = std::min(bmin[k], vertices[i][k]);
+        bmax[k] = std::max(bmax[k], vertices[i][k]);
+      }
+    }
+    const float extent = std::max(bmax[0] - bmin[0], bmax[1] - bmin[1]);
+    const float inv_extent = (extent > 0.0f) ? 1.0f / extent : 1.0f;
+
+    // x, y : [-0.5, 0.5] around the center, z : [0, depth / extent]
+    unit_vertices.resize(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++) {
+      unit_vertices[i][0] =
+          (vertices[i][0] - 0.5f * (bmin[0] + bmax[0])) * inv_extent;
+      unit_vertices[i][1] =
+          (vertices[i][1] - 0.5f * (bmin[1] + bmax[1])) * inv_extent;
+      unit_vertices[i][2] = (vertices[i][2] - bmin[2]) * inv_extent;
+    }
+
+    for (size_t i = 0; i < face_data.face_indices.size(); i++) {
+      if (face_data.face_indices[i] >= kPosMapSize * kPosMapSize) {
+        std::cerr << "Synthetic backend: face index out of range : "
+                  << face_data.face_indices[i] << std::endl;
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  bool predict(const Image<float>& inp_img, Image<float>& out_img) const {
+    if (unit_vertices.empty()) {
+      std::cerr << "Synthetic backend: not loaded." << std::endl;
+      return false;
+    }
+    simulate_latency(1);
+    generate_posmap(inp_img.getWidth(), inp_img.getHeight(), &out_img);
+    return true;
+  }
+
+  bool predict(const std::vector<Image<float>>& inp_imgs,
+               std::vector<Image<float>>& out_imgs) const {
+    if (unit_vertices.empty()) {
+      std::cerr << "Synthetic backend: not loaded." << std::endl;
+      return false;
+    }
+    simulate_latency(inp_imgs.size());
+    out_imgs.resize(inp_imgs.size());
+    for (size_t i = 0; i < inp_imgs.size(); i++) {
+      generate_posmap(inp_imgs[i].getWidth(), inp_imgs[i].getHeight(),
+                      &out_imgs[i]);
+    }
+    return true;
+  }
+
+private:
+  void simulate_latency(size_t n_images) const {
+    if (latency_ms > 0.0) {
+      std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(
+          latency_ms * double(n_images)));
+    }
+  }
+
+  // Posmap of the canonical face fitted to the center of `width` x `height`
+  // crop. Pixels outside of the face region are zero.
+  void generate_posmap(size_t width, size_t height,
+                       Image<float>* out_img) const {
+    out_img->create(kPosMapSize, kPosMapSize, 3);
+    float* pos = out_img->getData();
+    std::fill(pos, pos + kPosMapSize * kPosMapSize * 3, 0.0f);
+
+    const float scale = kFaceExtent * float(std::min(width, height)) / kMaxPos;
+    const float cx = 0.5f * float(width) / kMaxPos;
+    const float cy = 0.5f * float(height) / kMaxPos;
+    for (size_t i = 0; i < unit_vertices.size(); i++) {
+      float* p = pos + 3 * face_data.face_indices[i];
+      p[0] = cx + unit_vertices[i][0] * scale;
+      p[1] = cy + unit_vertices[i][1] * scale;
+      p[2] = unit_vertices[i][2] * scale;
+    }
+  }
+
+  const FaceData& face_data;
+  const double latency_ms;
+  std::vector<std::array<float, 3>> unit_vertices;
+};
+
+// PImpl pattern
+SyntheticPredictor::SyntheticPredictor(const FaceData& face_data,
+                                       double latency_ms)
+    : impl(new Impl(face_data, latency_ms)) {}
+SyntheticPredictor::~SyntheticPredictor() {}
+bool SyntheticPredictor::load(const std::string& graph_filename,
+                              const std::string& inp_layer,
+                              const std::string& out_layer,
+                              const SessionConfig& config) {
+  (void)graph_filename;
+  (void)inp_layer;
+  (void)out_layer;
+  (void)config;
+  return impl->load();
+}
+bool SyntheticPredictor::allocate_input(size_t width, size_t height,
+                                        size_t channels, Image<float>* img) {
+  img->create(width, height, channels);
+  return true;
+}
+bool SyntheticPredictor::predict(const Image<float>& inp_img,
+                                 Image<float>& out_img) {
+  return impl->predict(inp_img, out_img);
+}
+bool SyntheticPredictor::predict(const std::vector<Image<float>>& inp_imgs,
+                                 std::vector<Image<float>>& out_imgs) {
+  return impl->predict(inp_imgs, out_imgs);
+}
+
+} // namespace prnet
@@ -0,0 +1,56 @@
+#ifndef PRNET_INFER_SYNTHETIC_PREDICTOR_H_
+#define PRNET_INFER_SYNTHETIC_PREDICTOR_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "face-data.h"
+#include "predictor.h"
+
+namespace prnet {
+
+///
+/// Stand-in backend without network evaluation, for benchmarking and load
+/// testing the stages around the network(crop, mesh, texture, output) on
+/// machines without TensorFlow.
+///
+/// Output is a deterministic posmap: the canonical face vertices fitted to
+/// the center of the crop. Each predict() sleeps `latency_ms` per image to
+/// mimic network time.
+///
+class SyntheticPredictor : public Predictor {
+public:
+  ///
+  /// `face_data` must outlive the predictor.
+  ///
+  SyntheticPredictor(const FaceData& face_data, double latency_ms);
+  ~SyntheticPredictor() override;
+
+  ///
+  /// Graph is not used. Posmap of the canonical face is built here.
+  ///
+  bool load(const std::string& graph_filename, const std::string& inp_layer,
+            const std::string& out_layer,
+            const SessionConfig& config) override;
+
+  bool allocate_input(size_t width, size_t height, size_t channels,
+                      Image<float>* img) override;
+
+  ///
+  /// Output is 256x256x3(resolution of UV map) regardless of the input size.
+  /// Positions are fitted to the input size.
+  ///
+  bool predict(const Image<float>& inp_img, Image<float>& out_img) override;
+
+  bool predict(const std::vector<Image<float>>& inp_imgs,
+               std::vector<Image<float>>& out_imgs) override;
+
+private:
+  class Impl;
+  std::unique_ptr<Impl> impl;
+};
+
+} // namespace prnet
+
+#endif // PRNET_INFER_SYNTHETIC_PREDICTOR_H_
@@ -1,4 +1,5 @@
 #include "tf_predictor.h"
+#include "graph_optimizer.h"
 
 #ifdef __clang__
 #pragma clang diagnostic push
@@ -22,30 +23,315 @@
 #include "tensorflow/core/platform/logging.h"
 #include "tensorflow/core/platform/types.h"
 #include "tensorflow/core/public/session.h"
+#include "tensorflow/core/public/version.h"
 #include "tensorflow/core/util/command_line_flags.h"
+#include "tensorflow/core/util/memmapped_file_system.h"
 
 #ifdef __clang__
 #pragma clang diagnostic pop
 #endif
 
+// Session::MakeCallable is available since r1.8.
+#if (TF_MAJOR_VERSION > 1) || ((TF_MAJOR_VERSION == 1) && (TF_MINOR_VERSION >= 8))
+#define PRNET_TF_HAS_CALLABLE 1
+#endif
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+
 using namespace tensorflow;
 
 namespace prnet {
 
 namespace {
 
+SessionOptions CreateSessionOptions(const SessionConfig& config) {
+  SessionOptions options;
+  ConfigProto& proto = options.config;
+  if (config.intra_op_threads > 0) {
+    proto.set_intra_op_parallelism_threads(config.intra_op_threads);
+  }
+  if (config.inter_op_threads > 0) {
+    proto.set_inter_op_parallelism_threads(config.inter_op_threads);
+  }
+  if (config.use_global_pool) {
+    // Sessions which specify the same `global_name` share one pool.
+    ThreadPoolOptionProto* pool = proto.add_session_inter_op_thread_pool();
+    pool->set_num_threads(config.inter_op_threads);
+    pool->set_global_name("prnet_global_inter_op_pool");
+  } else {
+    proto.set_use_per_session_threads(config.use_per_session_threads);
+  }
+  return options;
+}
+
+// Nodes of the preprocessing subgraph(SessionConfig::in_graph_preprocess).
+const char kFrameNode[] = "prnet_preprocess/frame";  // uint8 [1, H, W, 3]
+const char kBoxesNode[] = "prnet_preprocess/boxes";  // float [N, 4]
+const char kBoxIndNode[] = "prnet_preprocess/box_ind";  // int32 [N]
+const char kLinearFrameNode[] = "prnet_preprocess/linear_frame";
+const char kCroppedNode[] = "prnet_preprocess/cropped";  // [N, 256, 256, 3]
+
+//
+// Prepend frame -> Cast -> scale -> Pow(degamma) -> CropAndResize to the
+// graph, and replace the input placeholder with the cropped images.
+// Same color conversion and sampling positions as CropImage of 8-bit frame on
+// the host.
+// Unlike the host path, the whole frame is converted to float(linear_frame)
+// before cropping. Cropping the 8-bit frame first and converting after would
+// only give the same result with nearest neighbor sampling.
+//
+Status AddPreprocessGraph(const string& input_layer, GraphDef* graph_def) {
+  Scope root = Scope::NewRootScope();
+  auto frame = ops::Placeholder(root.WithOpName(kFrameNode), DT_UINT8);
+  auto boxes = ops::Placeholder(root.WithOpName(kBoxesNode), DT_FLOAT);
+  auto box_ind = ops::Placeholder(root.WithOpName(kBoxIndNode), DT_INT32);
+  auto scaled = ops::Multiply(
+      root.WithOpName("prnet_preprocess/scale"),
+      ops::Cast(root.WithOpName("prnet_preprocess/cast"), frame, DT_FLOAT),
+      1.0f / 255.0f);
+  auto linear = ops::Pow(root.WithOpName(kLinearFrameNode), scaled, 2.2f);
+  const int crop_size = static_cast<int>(kPredictorInputSize);
+  ops::CropAndResize(root.WithOpName(kCroppedNode), linear, boxes, box_ind,
+                     {crop_size, crop_size});
+
+  GraphDef preprocess_def;
+  Status status = root.ToGraphDef(&preprocess_def);
+  if (!status.ok()) {
+    return status;
+  }
+
+  bool replaced = false;
+  for (NodeDef& node : *graph_def->mutable_node()) {
+    if (node.name() != input_layer) {
+      continue;
+    }
+    if (node.op() != "Placeholder") {
+      return errors::InvalidArgument("Input layer '", input_layer,
+                                     "' is not a Placeholder");
+    }
+    node.set_op("Identity");
+    node.clear_input();
+    node.add_input(kCroppedNode);
+    node.clear_attr();
+    (*node.mutable_attr())["T"].set_type(DT_FLOAT);
+    replaced = true;
+  }
+  if (!replaced) {
+    return errors::NotFound("Input layer '", input_layer, "' not found");
+  }
+
+  for (const NodeDef& node : preprocess_def.node()) {
+    *graph_def->add_node() = node;
+  }
+  return Status::OK();
+}
+
+// Nodes of the postprocessing subgraph(SessionConfig::in_graph_postprocess).
+const char kRemapScaleNode[] = "prnet_postprocess/scale";  // float [3]
+const char kRemapShiftNode[] = "prnet_postprocess/shift";  // float [3]
+const char kPositionNode[] = "prnet_postprocess/position";  // [N, H, W, 3]
+const char kVerticesNode[] = "prnet_postprocess/vertices";  // [N, V, 3]
+const char kKeypointsNode[] = "prnet_postprocess/keypoints";  // [N, 68, 3]
+
+// int32 constant of `values`.
+Tensor MakeIndexTensor(const std::vector<size_t>& values) {
+  Tensor tensor(DT_INT32, TensorShape({static_cast<int64>(values.size())}));
+  for (size_t i = 0; i < values.size(); i++) {
+    tensor.flat<int32>()(static_cast<int64>(i)) = static_cast<int32>(values[i]);
+  }
+  return tensor;
+}
+
+//
+// Append remap(Mul, Add) -> Gather of mesh vertices and keypoints to the
+// output layer. Same computation as Predictor::postprocess() on the host.
+// The posmap is assumed to be `kPredictorInputSize` square.
+//
+Status AddPostprocessGraph(const string& output_layer,
+                           const FaceData& face_data, GraphDef* graph_def) {
+  const size_t n_pixels = kPredictorInputSize * kPredictorInputSize;
+  std::vector<size_t> vertex_indices(face_data.face_indices.begin(),
+                                     face_data.face_indices.end());
+  std::vector<size_t> keypoint_indices;
+  const size_t n_pt = face_data.uv_kpt_indices.size() / 2;
+  for (size_t i = 0; i < n_pt; i++) {
+    keypoint_indices.push_back(
+        face_data.uv_kpt_indices[i + n_pt] * kPredictorInputSize +
+        face_data.uv_kpt_indices[i]);
+  }
+  for (size_t idx : vertex_indices) {
+    if (idx >= n_pixels) {
+      return errors::InvalidArgument("Face index out of range : ", idx);
+    }
+  }
+  for (size_t idx : keypoint_indices) {
+    if (idx >= n_pixels) {
+      return errors::InvalidArgument("Keypoint index out of range : ", idx);
+    }
+  }
+
+  // Stand-in for the output layer. Not appended to the graph, so the
+  // postprocessing nodes connect to the actual output layer.
+  Scope root = Scope::NewRootScope();
+  auto pos = ops::Placeholder(root.WithOpName(output_layer), DT_FLOAT);
+  auto scale = ops::Placeholder(root.WithOpName(kRemapScaleNode), DT_FLOAT);
+  auto shift = ops::Placeholder(root.WithOpName(kRemapShiftNode), DT_FLOAT);
+  auto position = ops::Add(
+      root.WithOpName(kPositionNode),
+      ops::Multiply(root.WithOpName("prnet_postprocess/scaled"), pos, scale),
+      shift);
+  auto flat = ops::Reshape(
+      root.WithOpName("prnet_postprocess/flat"), position,
+      {-1, static_cast<int>(n_pixels), 3});
+  auto axis = ops::Const(root.WithOpName("prnet_postprocess/axis"), 1);
+  ops::GatherV2(root.WithOpName(kVerticesNode), flat,
+                ops::Const(root.WithOpName("prnet_postprocess/face_indices"),
+                           Input::Initializer(MakeIndexTensor(vertex_indices))),
+                axis);
+  ops::GatherV2(
+      root.WithOpName(kKeypointsNode), flat,
+      ops::Const(root.WithOpName("prnet_postprocess/kpt_indices"),
+                 Input::Initializer(MakeIndexTensor(keypoint_indices))),
+      axis);
+
+  GraphDef postprocess_def;
+  Status status = root.ToGraphDef(&postprocess_def);
+  if (!status.ok()) {
+    return status;
+  }
+
+  for (const NodeDef& node : postprocess_def.node()) {
+    if (node.name() != output_layer) {
+      *graph_def->add_node() = node;
+    }
+  }
+  return Status::OK();
+}
+
+// Normalized CropAndResize box [y1, x1, y2, x2] sampling the same positions
+// as CropImage(face_cropper.h).
+void CropRegionToBox(const CropRegion& region, size_t width, size_t height,
+                     float* box) {
+  const float crop_size = float(kPredictorInputSize);
+  const float w = float(width);
+  const float h = float(height);
+  box[0] = (float(region.ys) + 0.5f) / h;
+  box[1] = (float(region.xs) + 0.5f) / w;
+  box[2] = box[0] + float(region.ye - region.ys + 1) * (crop_size - 1.0f) /
+                        (h * crop_size);
+  box[3] = box[1] + float(region.xe - region.xs + 1) * (crop_size - 1.0f) /
+                        (w * crop_size);
+}
+
+// Add pre/postprocessing subgraphs enabled in `config`.
+Status AddInGraphStages(const string& input_layer, const string& output_layer,
+                        const SessionConfig& config, const FaceData* face_data,
+                        GraphDef* graph_def) {
+  if (config.in_graph_preprocess) {
+    Status status = AddPreprocessGraph(input_layer, graph_def);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  if (config.in_graph_postprocess) {
+    if (!face_data) {
+      return errors::InvalidArgument(
+          "In-graph postprocessing requires face data");
+    }
+    Status status = AddPostprocessGraph(output_layer, *face_data, graph_def);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return Status::OK();
+}
+
+// Reads a graph in TensorFlow's memmapped package format(created by
+// `convert_graphdef_memmapped_format`). Constant weights are not parsed into
+// the heap but read through `ImmutableConst` ops from the mmapped file, so
+// that processes loading the same file share one page cache copy.
+Status LoadMemmappedGraph(const string& graph_file_name,
+                          const string& input_layer,
+                          const string& output_layer,
+                          const SessionConfig& config,
+                          const FaceData* face_data,
+                          std::unique_ptr<MemmappedEnv>* memmapped_env,
+                          std::unique_ptr<tensorflow::Session>* session) {
+  std::unique_ptr<MemmappedEnv> env(new MemmappedEnv(Env::Default()));
+  Status status = env->InitializeFromFile(graph_file_name);
+  if (!status.ok()) {
+    return status;
+  }
+
+  tensorflow::GraphDef graph_def;
+  status = ReadBinaryProto(
+      env.get(), MemmappedFileSystem::kMemmappedPackageDefaultGraphDef,
+      &graph_def);
+  if (!status.ok()) {
+    return status;
+  }
+  status = AddInGraphStages(input_layer, output_layer, config, face_data,
+                            &graph_def);
+  if (!status.ok()) {
+    return status;
+  }
+
+  SessionOptions options = CreateSessionOptions(config);
+  options.env = env.get();
+  // Constant folding copies mmapped weights into heap tensors. Disable it.
+  GraphOptions* graph_options = options.config.mutable_graph_options();
+  graph_options->mutable_optimizer_options()->set_opt_level(
+      OptimizerOptions::L0);
+  graph_options->mutable_rewrite_options()->set_constant_folding(
+      RewriterConfig::OFF);
+
+  // Previous session is released before previous env.
+  session->reset(tensorflow::NewSession(options));
+  *memmapped_env = std::move(env);
+  return (*session)->Create(graph_def);
+}
+
 // Reads a model graph definition from disk, and creates a session object you
 // can use to run it.
-Status LoadGraph(const string& graph_file_name,
+Status LoadGraph(const string& graph_file_name, const string& input_layer,
+                 const string& output_layer, const SessionConfig& config,
+                 const FaceData* face_data,
+                 std::unique_ptr<MemmappedEnv>* memmapped_env,
                  std::unique_ptr<tensorflow::Session>* session) {
+  if (config.use_memmapped_graph) {
+    if (config.optimize_graph) {
+      std::cerr << "Graph optimization is not applied to memmapped graph. "
+                << "Optimize graph before converting it to memmapped format."
+                << std::endl;
+    }
+    return LoadMemmappedGraph(graph_file_name, input_layer, output_layer,
+                              config, face_data, memmapped_env, session);
+  }
+
   tensorflow::GraphDef graph_def;
-  Status load_graph_status =
-      ReadBinaryProto(tensorflow::Env::Default(), graph_file_name, &graph_def);
-  if (!load_graph_status.ok()) {
-    return tensorflow::errors::NotFound("Failed to load compute graph at '",
-                                        graph_file_name, "'");
+  if (config.optimize_graph) {
+    if (!LoadOptimizedGraph(graph_file_name, {input_layer}, {output_layer},
+                            &graph_def)) {
+      return tensorflow::errors::Internal("Failed to optimize graph '",
+                                          graph_file_name, "'");
+    }
+  } else {
+    Status load_graph_status = ReadBinaryProto(tensorflow::Env::Default(),
+                                               graph_file_name, &graph_def);
+    if (!load_graph_status.ok()) {
+      return tensorflow::errors::NotFound("Failed to load compute graph at '",
+                                          graph_file_name, "'");
+    }
+  }
+  Status status = AddInGraphStages(input_layer, output_layer, config,
+                                   face_data, &graph_def);
+  if (!status.ok()) {
+    return status;
   }
-  session->reset(tensorflow::NewSession(tensorflow::SessionOptions()));
+  session->reset(tensorflow::NewSession(CreateSessionOptions(config)));
+  memmapped_env->reset();
   Status session_create_status = (*session)->Create(graph_def);
   if (!session_create_status.ok()) {
     return session_create_status;
@@ -53,19 +339,92 @@ Status LoadGraph(const string& graph_file_name,
   return Status::OK();
 }
 
+
+//
+// Pool of reusable float tensors.
+// Tensors handed out as image storage go back to the pool when the last
+// Image referring to it is released.
+//
+class TensorPool {
+public:
+  Tensor acquire(const TensorShape& shape) {
+    std::lock_guard<std::mutex> guard(mutex);
+    Tensor tensor;
+    for (size_t i = 0; i < free_tensors.size(); i++) {
+      if (free_tensors[i].shape() == shape) {
+        tensor = free_tensors[i];
+        free_tensors.erase(free_tensors.begin() + long(i));
+        break;
+      }
+    }
+    if (!tensor.IsInitialized()) {
+      tensor = Tensor(DT_FLOAT, shape);
+    }
+    in_use[tensor.flat<float>().data()] = tensor;
+    return tensor;
+  }
+
+  void release(const float* ptr) {
+    std::lock_guard<std::mutex> guard(mutex);
+    auto it = in_use.find(ptr);
+    if (it == in_use.end()) {
+      return;
+    }
+    if (free_tensors.size() >= kMaxFreeTensors) {
+      free_tensors.erase(free_tensors.begin());
+    }
+    free_tensors.push_back(it->second);
+    in_use.erase(it);
+  }
+
+  // Find the tensor whose buffer starts at `ptr`.
+  bool find(const float* ptr, Tensor* tensor) {
+    std::lock_guard<std::mutex> guard(mutex);
+    auto it = in_use.find(ptr);
+    if (it == in_use.end()) {
+      return false;
+    }
+    *tensor = it->second;
+    return true;
+  }
+
+private:
+  static const size_t kMaxFreeTensors = 16;
+
+  std::mutex mutex;
+  std::vector<Tensor> free_tensors;
+  std::map<const float*, Tensor> in_use;
+};
+
+// Use a part of tensor buffer as image storage without copy.
+// The tensor buffer is kept alive while the image refers to it.
+void WrapTensor(const Tensor& tensor, size_t offset, size_t width,
+                size_t height, size_t channels, Image<float>* img) {
+  float* ptr = const_cast<float*>(tensor.flat<float>().data()) + offset;
+  std::shared_ptr<float> storage(ptr, [tensor](float*) {});
+  img->create(width, height, channels, storage);
+}
+
 } // anonymous namespace
 
 class TensorflowPredictor::Impl {
 public:
+  ~Impl() { release_callables(); }
+
   void init(int argc, char* argv[]) {
     // We need to call this to set up global state for TensorFlow.
     tensorflow::port::InitMain(argv[0], &argc, &argv);
   }
 
   bool load(const std::string& graph_filename, const std::string& inp_layer,
-            const std::string& out_layer) {
+            const std::string& out_layer, const SessionConfig& config,
+            const FaceData* face_data) {
+    release_callables();
+
     // First we load and initialize the model.
-    Status load_graph_status = LoadGraph(graph_filename, &session);
+    Status load_graph_status =
+        LoadGraph(graph_filename, inp_layer, out_layer, config, face_data,
+                  &memmapped_env, &session);
     if (!load_graph_status.ok()) {
       std::cerr << load_graph_status;
       return false;
@@ -73,47 +432,456 @@ public:
 
     input_layer = inp_layer;
     output_layer = out_layer;
+    has_preprocess = config.in_graph_preprocess;
+    has_postprocess = config.in_graph_postprocess;
+
+#ifdef PRNET_TF_HAS_CALLABLE
+    // Prepare the callable of predict() at load time.
+    Session::CallableHandle handle;
+    get_callable({input_layer}, {output_layer}, &handle);
+#endif
 
     return true;
   }
 
+  bool has_preprocess_graph() const { return has_preprocess; }
+  bool has_postprocess_graph() const { return has_postprocess; }
+
+  bool allocate_input(size_t width, size_t height, size_t channels,
+                      Image<float>* img) {
+    Tensor tensor = input_pool->acquire(
+        TensorShape({1, static_cast<int64>(height), static_cast<int64>(width),
+                     static_cast<int64>(channels)}));
+    std::shared_ptr<TensorPool> pool = input_pool;
+    std::shared_ptr<float> storage(tensor.flat<float>().data(),
+                                   [pool](float* ptr) { pool->release(ptr); });
+    img->create(width, height, channels, storage);
+    return true;
+  }
+
   bool predict(const Image<float>& inp_img, Image<float>& out_img) {
-    // Copy from input image
-    Eigen::Index inp_width = static_cast<Eigen::Index>(inp_img.getWidth());
-    Eigen::Index inp_height = static_cast<Eigen::Index>(inp_img.getHeight());
-    Eigen::Index inp_channels = static_cast<Eigen::Index>(inp_img.getChannels());
-    Tensor input_tensor(DT_FLOAT, {1, inp_height, inp_width, inp_channels});
-    // TODO: No copy
-    std::copy_n(inp_img.getData(), inp_width * inp_height * inp_channels,
-                input_tensor.flat<float>().data());
+    const int64 inp_width = static_cast<int64>(inp_img.getWidth());
+    const int64 inp_height = static_cast<int64>(inp_img.getHeight());
+    const int64 inp_channels = static_cast<int64>(inp_img.getChannels());
+    const TensorShape inp_shape({1, inp_height, inp_width, inp_channels});
+
+    // Feed the tensor directly when the image is allocated by
+    // allocate_input(). Otherwise copy into a pooled tensor.
+    Tensor input_tensor;
+    bool is_pooled = false;
+    if (!input_pool->find(inp_img.getData(), &input_tensor) ||
+        (input_tensor.shape() != inp_shape)) {
+      input_tensor = input_pool->acquire(inp_shape);
+      std::copy_n(inp_img.getData(), inp_width * inp_height * inp_channels,
+                  input_tensor.flat<float>().data());
+      is_pooled = true;
+    }
+
+    // Run
+    std::vector<Tensor> output_tensors;
+    Status run_status =
+        run({{input_layer, input_tensor}}, {output_layer}, &output_tensors);
+    if (is_pooled) {
+      input_pool->release(input_tensor.flat<float>().data());
+    }
+    if (!run_status.ok()) {
+      std::cerr << "Running model failed: " << run_status;
+      return false;
+    }
+    const Tensor& output_tensor = output_tensors[0];
+
+    // Output image refers to the output tensor(no copy).
+    if ((output_tensor.dims() != 4) || (output_tensor.dim_size(0) != 1)) {
+      std::cerr << "Unexpected output shape : "
+                << output_tensor.shape().DebugString() << std::endl;
+      return false;
+    }
+    size_t out_height = static_cast<size_t>(output_tensor.dim_size(1));
+    size_t out_width = static_cast<size_t>(output_tensor.dim_size(2));
+    size_t out_channels = static_cast<size_t>(output_tensor.dim_size(3));
+    WrapTensor(output_tensor, 0, out_width, out_height, out_channels,
+               &out_img);
+
+    return true;
+  }
+
+  bool predict(const std::vector<Image<float>>& inp_imgs,
+               std::vector<Image<float>>& out_imgs) {
+    out_imgs.clear();
+    if (inp_imgs.empty()) {
+      return true;
+    }
+
+    const size_t batch_size = inp_imgs.size();
+    const size_t inp_width = inp_imgs[0].getWidth();
+    const size_t inp_height = inp_imgs[0].getHeight();
+    const size_t inp_channels = inp_imgs[0].getChannels();
+    for (size_t i = 1; i < batch_size; i++) {
+      if ((inp_imgs[i].getWidth() != inp_width) ||
+          (inp_imgs[i].getHeight() != inp_height) ||
+          (inp_imgs[i].getChannels() != inp_channels)) {
+        std::cerr << "All images in a batch must have the same size. image["
+                  << i << "] has " << inp_imgs[i].getWidth() << "x"
+                  << inp_imgs[i].getHeight() << "x"
+                  << inp_imgs[i].getChannels() << std::endl;
+        return false;
+      }
+    }
+
+    // Pack input images into NHWC tensor.
+    const size_t inp_size = inp_width * inp_height * inp_channels;
+    Tensor input_tensor = input_pool->acquire(
+        TensorShape({static_cast<int64>(batch_size),
+                     static_cast<int64>(inp_height),
+                     static_cast<int64>(inp_width),
+                     static_cast<int64>(inp_channels)}));
+    float* inp_data = input_tensor.flat<float>().data();
+    for (size_t i = 0; i < batch_size; i++) {
+      std::copy_n(inp_imgs[i].getData(), inp_size, inp_data + i * inp_size);
+    }
 
     // Run
     std::vector<Tensor> output_tensors;
-    Status run_status = session->Run({{input_layer, input_tensor}},
-                                     {output_layer}, {}, &output_tensors);
+    Status run_status =
+        run({{input_layer, input_tensor}}, {output_layer}, &output_tensors);
+    input_pool->release(inp_data);
     if (!run_status.ok()) {
       std::cerr << "Running model failed: " << run_status;
       return false;
     }
     const Tensor& output_tensor = output_tensors[0];
 
-    // Copy to output image
-    TTypes<float, 4>::ConstTensor tensor = output_tensor.tensor<float, 4>();
-    assert(tensor.dimension(0) == 1);
-    size_t out_height = static_cast<size_t>(tensor.dimension(1));
-    size_t out_width = static_cast<size_t>(tensor.dimension(2));
-    size_t out_channels = static_cast<size_t>(tensor.dimension(3));
-    out_img.create(out_width, out_height, out_channels);
-    out_img.foreach([&](int x, int y, int c, float& v) {
-      v = tensor(0, y, x, c);
-    });
+    // Split output tensor into images. Each image refers to its part of the
+    // output tensor(no copy).
+    if ((output_tensor.dims() != 4) ||
+        (static_cast<size_t>(output_tensor.dim_size(0)) != batch_size)) {
+      std::cerr << "Unexpected output shape : "
+                << output_tensor.shape().DebugString() << ". Expected batch "
+                << "size " << batch_size << std::endl;
+      return false;
+    }
+    size_t out_height = static_cast<size_t>(output_tensor.dim_size(1));
+    size_t out_width = static_cast<size_t>(output_tensor.dim_size(2));
+    size_t out_channels = static_cast<size_t>(output_tensor.dim_size(3));
+    const size_t out_size = out_width * out_height * out_channels;
+    out_imgs.resize(batch_size);
+    for (size_t i = 0; i < batch_size; i++) {
+      WrapTensor(output_tensor, i * out_size, out_width, out_height,
+                 out_channels, &out_imgs[i]);
+    }
+
+    return true;
+  }
+
+  //
+  // Predict and postprocess with the postprocessing subgraph in a single
+  // Session::Run.
+  //
+  bool predict_geometry(const Image<float>& inp_img,
+                        const PositionRemap& remap, FaceGeometry* geometry) {
+    const int64 inp_width = static_cast<int64>(inp_img.getWidth());
+    const int64 inp_height = static_cast<int64>(inp_img.getHeight());
+    const int64 inp_channels = static_cast<int64>(inp_img.getChannels());
+    const TensorShape inp_shape({1, inp_height, inp_width, inp_channels});
+
+    Tensor input_tensor;
+    bool is_pooled = false;
+    if (!input_pool->find(inp_img.getData(), &input_tensor) ||
+        (input_tensor.shape() != inp_shape)) {
+      input_tensor = input_pool->acquire(inp_shape);
+      std::copy_n(inp_img.getData(), inp_width * inp_height * inp_channels,
+                  input_tensor.flat<float>().data());
+      is_pooled = true;
+    }
+
+    std::vector<std::pair<string, Tensor>> feeds;
+    feeds.push_back({input_layer, input_tensor});
+    add_remap_feeds(remap, &feeds);
+
+    std::vector<Tensor> output_tensors;
+    Status run_status = run(feeds, {kPositionNode, kVerticesNode,
+                                    kKeypointsNode}, &output_tensors);
+    if (is_pooled) {
+      input_pool->release(input_tensor.flat<float>().data());
+    }
+    if (!run_status.ok()) {
+      std::cerr << "Running model failed: " << run_status;
+      return false;
+    }
+
+    return fetch_geometry(output_tensors, 0, geometry);
+  }
+
+  //
+  // Crop with the preprocessing subgraph in a single Session::Run. When
+  // `geometry` is given, also predict, and postprocess if the graph has the
+  // postprocessing subgraph(otherwise `geometry->pos_img` is the raw
+  // network output).
+  //
+  bool run_frame(const ImageView<const uint8_t>& frame,
+                 const CropRegion& region,
+                 Image<float>* cropped_img, const PositionRemap& remap,
+                 FaceGeometry* geometry) {
+    std::vector<std::pair<string, Tensor>> feeds;
+    if (!add_frame_feeds(frame, &region, 1, &feeds)) {
+      return false;
+    }
+    std::vector<string> fetches;
+    fetches.push_back(kCroppedNode);
+    if (geometry && has_postprocess) {
+      add_remap_feeds(remap, &feeds);
+      fetches.push_back(kPositionNode);
+      fetches.push_back(kVerticesNode);
+      fetches.push_back(kKeypointsNode);
+    } else if (geometry) {
+      fetches.push_back(output_layer);
+    }
+
+    std::vector<Tensor> output_tensors;
+    Status run_status = run(feeds, fetches, &output_tensors);
+    if (!run_status.ok()) {
+      std::cerr << "Running model failed: " << run_status;
+      return false;
+    }
+
+    // Outputs refer to the output tensors(no copy).
+    size_t index = 0;
+    WrapTensor(output_tensors[index++], 0, kPredictorInputSize,
+               kPredictorInputSize, frame.getChannels(), cropped_img);
+    if (geometry && has_postprocess) {
+      return fetch_geometry(output_tensors, index, geometry);
+    } else if (geometry) {
+      return wrap_posmap(output_tensors[index], &geometry->pos_img);
+    }
+
+    return true;
+  }
+
+  //
+  // Crop all `regions` of the frame with a single Session::Run(the frame is
+  // fed once). When `pos_imgs` is given, also predict them in the same run.
+  // Network outputs are not postprocessed(remap is per face).
+  //
+  bool run_frame(const ImageView<const uint8_t>& frame,
+                 const std::vector<CropRegion>& regions,
+                 std::vector<Image<float>>* cropped_imgs,
+                 std::vector<Image<float>>* pos_imgs) {
+    cropped_imgs->clear();
+    if (pos_imgs) {
+      pos_imgs->clear();
+    }
+    if (regions.empty()) {
+      return true;
+    }
+
+    std::vector<std::pair<string, Tensor>> feeds;
+    if (!add_frame_feeds(frame, regions.data(), regions.size(), &feeds)) {
+      return false;
+    }
+    std::vector<string> fetches;
+    fetches.push_back(kCroppedNode);
+    if (pos_imgs) {
+      fetches.push_back(output_layer);
+    }
+
+    std::vector<Tensor> output_tensors;
+    Status run_status = run(feeds, fetches, &output_tensors);
+    if (!run_status.ok()) {
+      std::cerr << "Running model failed: " << run_status;
+      return false;
+    }
+
+    // Split [N, H, W, C] outputs into images referring to their part of the
+    // output tensors(no copy).
+    const size_t n = regions.size();
+    for (size_t i = 0; i < output_tensors.size(); i++) {
+      const Tensor& tensor = output_tensors[i];
+      if ((tensor.dims() != 4) ||
+          (static_cast<size_t>(tensor.dim_size(0)) != n)) {
+        std::cerr << "Unexpected output shape : "
+                  << tensor.shape().DebugString() << ". Expected batch "
+                  << "size " << n << std::endl;
+        return false;
+      }
+      const size_t height = static_cast<size_t>(tensor.dim_size(1));
+      const size_t width = static_cast<size_t>(tensor.dim_size(2));
+      const size_t channels = static_cast<size_t>(tensor.dim_size(3));
+      const size_t size = width * height * channels;
+      std::vector<Image<float>>* imgs = (i == 0) ? cropped_imgs : pos_imgs;
+      imgs->resize(n);
+      for (size_t j = 0; j < n; j++) {
+        WrapTensor(tensor, j * size, width, height, channels, &(*imgs)[j]);
+      }
+    }
 
     return true;
   }
 
 private:
+  // Feed the frame(copied once into a uint8 tensor) and the CropAndResize
+  // boxes of `regions[0, n)`.
+  static bool add_frame_feeds(const ImageView<const uint8_t>& frame,
+                              const CropRegion* regions, size_t n,
+                              std::vector<std::pair<string, Tensor>>* feeds) {
+    const size_t width = frame.getWidth();
+    const size_t height = frame.getHeight();
+    const size_t channels = frame.getChannels();
+    if (channels != 3) {
+      std::cerr << "Frame must have 3 channels but has " << channels
+                << std::endl;
+      return false;
+    }
+    Tensor frame_tensor(DT_UINT8,
+                        TensorShape({1, static_cast<int64>(height),
+                                     static_cast<int64>(width),
+                                     static_cast<int64>(channels)}));
+    // The frame may be a view with row padding or a sub-rectangle.
+    frame.copyTo(ImageView<uint8_t>(frame_tensor.flat<uint8>().data(), width,
+                                    height, channels));
+    Tensor boxes_tensor(DT_FLOAT, TensorShape({static_cast<int64>(n), 4}));
+    Tensor box_ind_tensor(DT_INT32, TensorShape({static_cast<int64>(n)}));
+    float* boxes = boxes_tensor.flat<float>().data();
+    for (size_t i = 0; i < n; i++) {
+      CropRegionToBox(regions[i], width, height, boxes + 4 * i);
+      box_ind_tensor.flat<int32>()(static_cast<int64>(i)) = 0;
+    }
+
+    feeds->push_back({kFrameNode, frame_tensor});
+    feeds->push_back({kBoxesNode, boxes_tensor});
+    feeds->push_back({kBoxIndNode, box_ind_tensor});
+    return true;
+  }
+
+  static void add_remap_feeds(const PositionRemap& remap,
+                              std::vector<std::pair<string, Tensor>>* feeds) {
+    Tensor scale_tensor(DT_FLOAT, TensorShape({3}));
+    scale_tensor.flat<float>()(0) = remap.scale;
+    scale_tensor.flat<float>()(1) = remap.scale;
+    scale_tensor.flat<float>()(2) = remap.scale;
+    Tensor shift_tensor(DT_FLOAT, TensorShape({3}));
+    shift_tensor.flat<float>()(0) = remap.shift_x;
+    shift_tensor.flat<float>()(1) = remap.shift_y;
+    shift_tensor.flat<float>()(2) = 0.0f;
+    feeds->push_back({kRemapScaleNode, scale_tensor});
+    feeds->push_back({kRemapShiftNode, shift_tensor});
+  }
+
+  // Posmap image refers to the [1, H, W, C] tensor(no copy).
+  static bool wrap_posmap(const Tensor& tensor, Image<float>* pos_img) {
+    if ((tensor.dims() != 4) || (tensor.dim_size(0) != 1)) {
+      std::cerr << "Unexpected output shape : "
+                << tensor.shape().DebugString() << std::endl;
+      return false;
+    }
+    WrapTensor(tensor, 0, static_cast<size_t>(tensor.dim_size(2)),
+               static_cast<size_t>(tensor.dim_size(1)),
+               static_cast<size_t>(tensor.dim_size(3)), pos_img);
+    return true;
+  }
+
+  // Remapped posmap, vertices and keypoints from `tensors[index...]`.
+  static bool fetch_geometry(const std::vector<Tensor>& tensors, size_t index,
+                             FaceGeometry* geometry) {
+    if (!wrap_posmap(tensors[index], &geometry->pos_img)) {
+      return false;
+    }
+    const Tensor& vertices = tensors[index + 1];
+    const Tensor& keypoints = tensors[index + 2];
+    const float* vertices_data = vertices.flat<float>().data();
+    const float* keypoints_data = keypoints.flat<float>().data();
+    geometry->vertices.assign(vertices_data,
+                              vertices_data + vertices.NumElements());
+    geometry->keypoints.assign(keypoints_data,
+                               keypoints_data + keypoints.NumElements());
+    return true;
+  }
+
+#ifdef PRNET_TF_HAS_CALLABLE
+  // Find or create the callable of a feed/fetch set. Feed/fetch names are
+  // resolved and the graph is pruned once, so that each prediction skips the
+  // per-call setup of Session::Run.
+  bool get_callable(const std::vector<string>& feeds,
+                    const std::vector<string>& fetches,
+                    Session::CallableHandle* handle) {
+    string key;
+    for (const string& feed : feeds) {
+      key += feed + ",";
+    }
+    key += ";";
+    for (const string& fetch : fetches) {
+      key += fetch + ",";
+    }
+
+    std::lock_guard<std::mutex> guard(callable_mutex);
+    auto it = callables.find(key);
+    if (it == callables.end()) {
+      CallableOptions callable_options;
+      for (const string& feed : feeds) {
+        callable_options.add_feed(feed);
+      }
+      for (const string& fetch : fetches) {
+        callable_options.add_fetch(fetch);
+      }
+      Callable callable;
+      Status status = session->MakeCallable(callable_options, &callable.handle);
+      callable.ok = status.ok();
+      if (!callable.ok) {
+        std::cerr << "MakeCallable failed. Use Session::Run instead : "
+                  << status << std::endl;
+      }
+      it = callables.insert(std::make_pair(key, callable)).first;
+    }
+    *handle = it->second.handle;
+    return it->second.ok;
+  }
+#endif
+
+  void release_callables() {
+#ifdef PRNET_TF_HAS_CALLABLE
+    std::lock_guard<std::mutex> guard(callable_mutex);
+    for (auto& callable : callables) {
+      if (callable.second.ok) {
+        session->ReleaseCallable(callable.second.handle);
+      }
+    }
+    callables.clear();
+#endif
+  }
+
+  Status run(const std::vector<std::pair<string, Tensor>>& feeds,
+             const std::vector<string>& fetches,
+             std::vector<Tensor>* output_tensors) {
+#ifdef PRNET_TF_HAS_CALLABLE
+    std::vector<string> feed_names;
+    std::vector<Tensor> feed_tensors;
+    for (const auto& feed : feeds) {
+      feed_names.push_back(feed.first);
+      feed_tensors.push_back(feed.second);
+    }
+    Session::CallableHandle handle;
+    if (get_callable(feed_names, fetches, &handle)) {
+      return session->RunCallable(handle, feed_tensors, output_tensors,
+                                  nullptr);
+    }
+#endif
+    return session->Run(feeds, fetches, {}, output_tensors);
+  }
+
+  // Must outlive `session`.
+  std::unique_ptr<MemmappedEnv> memmapped_env;
   std::unique_ptr<tensorflow::Session> session;
+  std::shared_ptr<TensorPool> input_pool = std::make_shared<TensorPool>();
+#ifdef PRNET_TF_HAS_CALLABLE
+  struct Callable {
+    Session::CallableHandle handle = 0;
+    bool ok = false;
+  };
+  std::mutex callable_mutex;
+  std::map<string, Callable> callables;  // key = feed/fetch names
+#endif
   std::string input_layer, output_layer;
+  bool has_preprocess = false;
+  bool has_postprocess = false;
 };
 
 // PImpl pattern
@@ -124,12 +892,74 @@ void TensorflowPredictor::init(int argc, char* argv[]) {
 }
 bool TensorflowPredictor::load(const std::string& graph_filename,
                                const std::string& inp_layer,
-                               const std::string& out_layer) {
-  return impl->load(graph_filename, inp_layer, out_layer);
+                               const std::string& out_layer,
+                               const SessionConfig& config) {
+  return impl->load(graph_filename, inp_layer, out_layer, config, face_data);
+}
+bool TensorflowPredictor::allocate_input(size_t width, size_t height,
+                                         size_t channels, Image<float>* img) {
+  return impl->allocate_input(width, height, channels, img);
 }
 bool TensorflowPredictor::predict(const Image<float>& inp_img,
                                   Image<float>& out_img) {
   return impl->predict(inp_img, out_img);
 }
+bool TensorflowPredictor::predict(const std::vector<Image<float>>& inp_imgs,
+                                  std::vector<Image<float>>& out_imgs) {
+  return impl->predict(inp_imgs, out_imgs);
+}
+bool TensorflowPredictor::preprocess(const ImageView<const uint8_t>& frame,
+                                     const CropRegion& region,
+                                     Image<float>* cropped_img) {
+  if (!impl->has_preprocess_graph()) {
+    return Predictor::preprocess(frame, region, cropped_img);
+  }
+  return impl->run_frame(frame, region, cropped_img, PositionRemap(),
+                         nullptr);
+}
+bool TensorflowPredictor::preprocess(
+    const ImageView<const uint8_t>& frame,
+    const std::vector<CropRegion>& regions,
+    std::vector<Image<float>>* cropped_imgs) {
+  if (!impl->has_preprocess_graph()) {
+    return Predictor::preprocess(frame, regions, cropped_imgs);
+  }
+  return impl->run_frame(frame, regions, cropped_imgs, nullptr);
+}
+bool TensorflowPredictor::predict_geometry(const Image<float>& inp_img,
+                                           const PositionRemap& remap,
+                                           FaceGeometry* geometry) {
+  if (!impl->has_postprocess_graph()) {
+    return Predictor::predict_geometry(inp_img, remap, geometry);
+  }
+  return impl->predict_geometry(inp_img, remap, geometry);
+}
+bool TensorflowPredictor::predict_frame(
+    const ImageView<const uint8_t>& frame, const CropRegion& region,
+    Image<float>* cropped_img, const PositionRemap& remap,
+    FaceGeometry* geometry) {
+  if (!impl->has_preprocess_graph()) {
+    return Predictor::predict_frame(frame, region, cropped_img, remap,
+                                    geometry);
+  }
+  if (!impl->run_frame(frame, region, cropped_img, remap, geometry)) {
+    return false;
+  }
+  if (!impl->has_postprocess_graph()) {
+    // `geometry->pos_img` is the network output.
+    return postprocess(remap, geometry);
+  }
+  return true;
+}
+bool TensorflowPredictor::predict_frame(
+    const ImageView<const uint8_t>& frame,
+    const std::vector<CropRegion>& regions,
+    std::vector<Image<float>>* cropped_imgs,
+    std::vector<Image<float>>* pos_imgs) {
+  if (!impl->has_preprocess_graph()) {
+    return Predictor::predict_frame(frame, regions, cropped_imgs, pos_imgs);
+  }
+  return impl->run_frame(frame, regions, cropped_imgs, pos_imgs);
+}
 
 } // namespace prnet
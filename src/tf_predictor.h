@@ -2,19 +2,81 @@
 #define TF_PREDICTOR_180602
 
 #include <string>
+#include <vector>
 
-#include "image.h"
+#include "predictor.h"
 
 namespace prnet {
 
-class TensorflowPredictor {
+class TensorflowPredictor : public Predictor {
 public:
   TensorflowPredictor();
-  ~TensorflowPredictor();
-  void init(int argc, char* argv[]);
+  ~TensorflowPredictor() override;
+  void init(int argc, char* argv[]) override;
   bool load(const std::string& graph_filename, const std::string& inp_layer,
-            const std::string& out_layer);
-  bool predict(const Image<float>& inp_img, Image<float>& out_img);
+            const std::string& out_layer,
+            const SessionConfig& config) override;
+
+  ///
+  /// Allocate an input image whose storage is a pooled input tensor.
+  /// predict() feeds such an image to the network without copy.
+  /// The tensor returns to the pool when `img` is released.
+  ///
+  bool allocate_input(size_t width, size_t height, size_t channels,
+                      Image<float>* img) override;
+
+  ///
+  /// Output image refers to the output tensor of the network(no copy).
+  ///
+  bool predict(const Image<float>& inp_img, Image<float>& out_img) override;
+
+  ///
+  /// Batched prediction. All input images must have the same size.
+  /// Inputs are packed into one NHWC tensor and evaluated with a single
+  /// Session::Run.
+  ///
+  bool predict(const std::vector<Image<float>>& inp_imgs,
+               std::vector<Image<float>>& out_imgs) override;
+
+  ///
+  /// With `SessionConfig::in_graph_preprocess`, the frame is fed as uint8 and
+  /// cropped/resized by CropAndResize in the graph. Otherwise runs on the
+  /// host.
+  ///
+  bool preprocess(const ImageView<const uint8_t>& frame,
+                  const CropRegion& region,
+                  Image<float>* cropped_img) override;
+
+  ///
+  /// With `SessionConfig::in_graph_preprocess`, all regions are cropped by
+  /// one CropAndResize in a single Session::Run(the frame is fed once).
+  ///
+  bool preprocess(const ImageView<const uint8_t>& frame,
+                  const std::vector<CropRegion>& regions,
+                  std::vector<Image<float>>* cropped_imgs) override;
+
+  ///
+  /// With `SessionConfig::in_graph_postprocess`, the remapped posmap, mesh
+  /// vertices and keypoints are fetched from the graph. Otherwise
+  /// postprocess() runs on the host.
+  ///
+  bool predict_geometry(const Image<float>& inp_img,
+                        const PositionRemap& remap,
+                        FaceGeometry* geometry) override;
+
+  bool predict_frame(const ImageView<const uint8_t>& frame,
+                     const CropRegion& region, Image<float>* cropped_img,
+                     const PositionRemap& remap,
+                     FaceGeometry* geometry) override;
+
+  ///
+  /// With `SessionConfig::in_graph_preprocess`, all regions are cropped and
+  /// predicted in a single Session::Run.
+  ///
+  bool predict_frame(const ImageView<const uint8_t>& frame,
+                     const std::vector<CropRegion>& regions,
+                     std::vector<Image<float>>* cropped_imgs,
+                     std::vector<Image<float>>* pos_imgs) override;
 
 private:
   class Impl;
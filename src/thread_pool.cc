@@ -0,0 +1,240 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace prnet {
+
+namespace {
+
+std::atomic<size_t> g_num_threads(0);
+
+// True in worker threads and while the caller runs a loop body.
+thread_local bool t_in_loop = false;
+
+size_t DefaultNumThreads() {
+  return size_t(std::max(1U, std::thread::hardware_concurrency()));
+}
+
+// Chunks [begin, end) owned by a thread. Owner takes from the front, thieves
+// take from the back.
+struct Slot {
+  std::mutex mutex;
+  size_t begin = 0;
+  size_t end = 0;
+};
+
+// Lives on the stack of the parallel_for() caller.
+struct Job {
+  ThreadPool::RangeFunc func = nullptr;
+  void* ctx = nullptr;
+  size_t begin = 0;
+  size_t end = 0;
+  size_t grain = 1;
+  size_t n_slots = 0;
+  Slot* slots = nullptr;
+
+  // Slots are allocated only for a large pool.
+  static const size_t kInlineSlots = 16;
+  Slot inline_slots[kInlineSlots];
+  std::unique_ptr<Slot[]> heap_slots;
+
+  // Guarded by the pool mutex.
+  size_t n_joined = 0;  // slots handed out
+  size_t n_active = 0;  // workers running this job
+};
+
+} // anonymous namespace
+
+class ThreadPool::Impl {
+public:
+  explicit Impl(size_t n_threads) {
+    for (size_t i = 1; i < n_threads; i++) {
+      threads.emplace_back([this]() { work(); });
+    }
+  }
+
+  ~Impl() {
+    {
+      std::lock_guard<std::mutex> guard(mutex);
+      quit = true;
+    }
+    cond.notify_all();
+    for (size_t i = 0; i < threads.size(); i++) {
+      threads[i].join();
+    }
+  }
+
+  size_t size() const { return threads.size() + 1; }
+
+  void parallel_for(size_t begin, size_t end, size_t grain,
+                    size_t max_threads, RangeFunc func, void* ctx) {
+    if (begin >= end) {
+      return;
+    }
+    const size_t n = end - begin;
+    const size_t n_threads =
+        (max_threads > 0) ? std::min(max_threads, size()) : size();
+    if (grain == 0) {
+      // A few chunks per thread so that stealing can balance the load.
+      grain = std::max(size_t(1), n / (4 * n_threads));
+    }
+    const size_t n_chunks = (n + grain - 1) / grain;
+    const size_t n_slots = std::min(n_threads, n_chunks);
+    if ((n_slots <= 1) || t_in_loop) {
+      func(ctx, begin, end, 0);
+      return;
+    }
+
+    Job job;
+    job.func = func;
+    job.ctx = ctx;
+    job.begin = begin;
+    job.end = end;
+    job.grain = grain;
+    job.n_slots = n_slots;
+    if (n_slots <= Job::kInlineSlots) {
+      job.slots = job.inline_slots;
+    } else {
+      job.heap_slots.reset(new Slot[n_slots]);
+      job.slots = job.heap_slots.get();
+    }
+    for (size_t s = 0; s < n_slots; s++) {
+      job.slots[s].begin = s * n_chunks / n_slots;
+      job.slots[s].end = (s + 1) * n_chunks / n_slots;
+    }
+    job.n_joined = 1;  // slot 0 = caller
+
+    {
+      std::lock_guard<std::mutex> guard(mutex);
+      jobs.push_back(&job);
+    }
+    for (size_t s = 1; s < n_slots; s++) {
+      cond.notify_one();
+    }
+
+    t_in_loop = true;
+    run(&job, 0);
+    t_in_loop = false;
+
+    // Chunks are all taken. Wait for workers still running theirs.
+    std::unique_lock<std::mutex> lock(mutex);
+    auto it = std::find(jobs.begin(), jobs.end(), &job);
+    if (it != jobs.end()) {
+      jobs.erase(it);
+    }
+    done_cond.wait(lock, [&job]() { return job.n_active == 0; });
+  }
+
+private:
+  void work() {
+    t_in_loop = true;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      cond.wait(lock, [this]() { return quit || !jobs.empty(); });
+      if (quit) {
+        return;
+      }
+      Job* job = jobs.front();
+      const size_t slot = job->n_joined++;
+      if (job->n_joined == job->n_slots) {
+        jobs.erase(jobs.begin());
+      }
+      job->n_active++;
+      lock.unlock();
+
+      run(job, slot);
+
+      lock.lock();
+      if (--job->n_active == 0) {
+        done_cond.notify_all();
+      }
+    }
+  }
+
+  // Process own chunks, then steal until no chunk is left.
+  static void run(Job* job, size_t slot) {
+    Slot& own = job->slots[slot];
+    while (true) {
+      size_t chunk = 0;
+      bool has_chunk = false;
+      {
+        std::lock_guard<std::mutex> guard(own.mutex);
+        if (own.begin < own.end) {
+          chunk = own.begin++;
+          has_chunk = true;
+        }
+      }
+      if (!has_chunk) {
+        if (!steal(job, slot)) {
+          return;
+        }
+        continue;
+      }
+      const size_t begin = job->begin + chunk * job->grain;
+      const size_t end = std::min(begin + job->grain, job->end);
+      job->func(job->ctx, begin, end, slot);
+    }
+  }
+
+  // Move the latter half of another slot's chunks to `slot`.
+  static bool steal(Job* job, size_t slot) {
+    for (size_t k = 1; k < job->n_slots; k++) {
+      Slot& victim = job->slots[(slot + k) % job->n_slots];
+      size_t begin = 0;
+      size_t end = 0;
+      {
+        std::lock_guard<std::mutex> guard(victim.mutex);
+        if (victim.begin >= victim.end) {
+          continue;
+        }
+        const size_t half = (victim.end - victim.begin + 1) / 2;
+        end = victim.end;
+        begin = end - half;
+        victim.end = begin;
+      }
+      Slot& own = job->slots[slot];
+      std::lock_guard<std::mutex> guard(own.mutex);
+      own.begin = begin;
+      own.end = end;
+      return true;
+    }
+    return false;
+  }
+
+  std::vector<std::thread> threads;
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::condition_variable done_cond;
+  std::vector<Job*> jobs;  // jobs accepting more threads. Oldest first
+  bool quit = false;
+};
+
+// PImpl pattern
+ThreadPool::ThreadPool(size_t n_threads)
+    : impl(new Impl((n_threads > 0) ? n_threads : DefaultNumThreads())) {}
+ThreadPool::~ThreadPool() {}
+size_t ThreadPool::size() const { return impl->size(); }
+void ThreadPool::parallel_for(size_t begin, size_t end, size_t grain,
+                              size_t max_threads, RangeFunc func, void* ctx) {
+  impl->parallel_for(begin, end, grain, max_threads, func, ctx);
+}
+
+ThreadPool& ThreadPool::global() {
+  // Never destroyed, so that it can be used during static destruction.
+  static ThreadPool* pool = new ThreadPool(GetNumThreads());
+  return *pool;
+}
+
+void SetNumThreads(size_t n_threads) { g_num_threads = n_threads; }
+
+size_t GetNumThreads() {
+  const size_t n_threads = g_num_threads;
+  return (n_threads > 0) ? n_threads : DefaultNumThreads();
+}
+
+} // namespace prnet
@@ -0,0 +1,87 @@
+#ifndef PRNET_INFER_THREAD_POOL_H_
+#define PRNET_INFER_THREAD_POOL_H_
+
+#include <cstddef>
+#include <memory>
+
+namespace prnet {
+
+///
+/// Persistent worker threads for data-parallel loops(image conversion,
+/// cropping, rendering, native engine). Threads are created once and reused
+/// by all loops, instead of spawning threads per call.
+///
+/// parallel_for() splits a range into chunks and gives each participating
+/// thread(the caller and idle workers) an equal share of them. A thread which
+/// runs out of chunks steals half of the remaining chunks of another thread.
+/// parallel_for() may be called from several threads at the same time. A
+/// parallel_for() called inside a loop body runs on the calling thread.
+///
+class ThreadPool {
+public:
+  ///
+  /// Processes [begin, end). `slot` is unique among the threads running the
+  /// same parallel_for() and less than its thread count(e.g. index of per
+  /// thread scratch buffer).
+  ///
+  typedef void (*RangeFunc)(void* ctx, size_t begin, size_t end, size_t slot);
+
+  ///
+  /// `n_threads` includes the calling thread. 0 = hardware concurrency.
+  ///
+  explicit ThreadPool(size_t n_threads = 0);
+  ~ThreadPool();
+
+  ///
+  /// The number of threads including the calling thread.
+  ///
+  size_t size() const;
+
+  ///
+  /// Run `func` over [begin, end) in chunks of `grain`(0 = automatic) with
+  /// at most `max_threads` threads(0 = size()). Returns when all chunks are
+  /// done.
+  ///
+  void parallel_for(size_t begin, size_t end, size_t grain, size_t max_threads,
+                    RangeFunc func, void* ctx);
+
+  ///
+  /// Pool shared by the whole process. Created on first use with
+  /// GetNumThreads() threads.
+  ///
+  static ThreadPool& global();
+
+private:
+  class Impl;
+  std::unique_ptr<Impl> impl;
+};
+
+///
+/// Core budget of the global pool(0 = hardware concurrency). Must be called
+/// before the first use of the global pool to take effect.
+///
+void SetNumThreads(size_t n_threads);
+
+///
+/// The number of threads of the global pool.
+///
+size_t GetNumThreads();
+
+///
+/// Run `f(begin, end)` over row ranges of [0, n) on the global pool.
+///
+template <typename F>
+void ParallelFor(size_t n, const F& f, size_t grain = 0,
+                 size_t max_threads = 0) {
+  ThreadPool::global().parallel_for(
+      0, n, grain, max_threads,
+      [](void* ctx, size_t begin, size_t end, size_t slot) {
+        (void)slot;
+        (*static_cast<const F*>(ctx))(begin, end);
+      },
+      const_cast<F*>(&f));
+}
+
+} // namespace prnet
+
+#endif // PRNET_INFER_THREAD_POOL_H_
@@ -2,6 +2,7 @@
 
 #include "ui.h"
 
+#include "image_convert.h"
 #include "stb_image_write.h"
 
 #include "gui/render-buffer.h"
@@ -43,52 +44,29 @@ static std::atomic<bool> gRenderRefresh;
 static example::RenderConfig gRenderConfig;
 static std::mutex gMutex;
 
+static Image<uint8_t> gDisplayImage;  // reused by Display()
+
 #ifdef __clang__
 #pragma clang diagnostic pop
 #endif
 
-template <typename T>
-inline T clamp(T f, T fmin, T fmax) {
-  return std::max(std::min(fmax, f), fmin);
-}
-
 //
 // Assume pixel values are basially in the range of [0.0, 1.0].
 //
 static bool SaveRGBAImageAsPNG(const std::string &filename,
                                const std::vector<float> &src, int width,
                                int height, bool gamma) {
-  std::vector<uint8_t> image;
-
-  image.resize(size_t(width * height) * 3);
-
-  for (size_t y = 0; y < size_t(height); y++) {
-    for (size_t x = 0; x < size_t(width); x++) {
-      size_t dst_idx = (size_t(height) - y - 1) * size_t(width) + x; // flip Y
-      size_t src_idx = y * size_t(width) + x;
-      if (gamma) {
-        // apply gamma correction
-        image[3 * dst_idx + 0] = static_cast<uint8_t>(
-            clamp(std::pow(src[4 * src_idx + 0], 1.0f / 2.2f) * 255.0f, 0.0f, 255.0f));
-        image[3 * dst_idx + 1] = static_cast<uint8_t>(
-            clamp(std::pow(src[4 * src_idx + 1], 1.0f / 2.2f) * 255.0f, 0.0f, 255.0f));
-        image[3 * dst_idx + 2] = static_cast<uint8_t>(
-            clamp(std::pow(src[4 * src_idx + 2], 1.0f / 2.2f) * 255.0f, 0.0f, 255.0f));
-      } else {
-        // linear
-        image[3 * dst_idx + 0] =
-            static_cast<uint8_t>(clamp(src[4 * src_idx + 0] * 255.0f, 0.0f, 255.0f));
-        image[3 * dst_idx + 1] =
-            static_cast<uint8_t>(clamp(src[4 * src_idx + 1] * 255.0f, 0.0f, 255.0f));
-        image[3 * dst_idx + 2] =
-            static_cast<uint8_t>(clamp(src[4 * src_idx + 2] * 255.0f, 0.0f, 255.0f));
-      }
-    }
-  }
-
-  // Save
-  int ret = stbi_write_png(filename.c_str(), width, height, 3, &image.at(0),
-                           /* stride_in_bytes */ width * 3);
+  // RGB channels of RGBA.
+  const ImageView<const float> rgb(src.data(), size_t(width), size_t(height),
+                                   3, size_t(width) * 4, 4, 1);
+  Image<uint8_t> image;
+  ConvertImage(rgb, &image, 255.0f, gamma ? (1.0f / 2.2f) : 1.0f);
+
+  // Save(flip Y)
+  stbi_flip_vertically_on_write(1);
+  int ret = stbi_write_png(filename.c_str(), width, height, 3,
+                           image.getData(), /* stride_in_bytes */ width * 3);
+  stbi_flip_vertically_on_write(0);
 
   return (ret > 0) ? true : false;
 }
@@ -224,16 +202,31 @@ inline float pseudoColor(float v, int ch) {
 
 static void Display(int width, int height, int buffer_mode,
                     const example::RenderBuffer &buffer) {
-  std::vector<float> buf(size_t(width * height * 4));
+  glRasterPos2i(-1, -1);
+
+  // Color buffers are shown with gamma correction as 8-bit RGB.
+  const std::vector<float> *color = nullptr;
   if (buffer_mode == example::SHOW_BUFFER_COLOR) {
     // TODO: normalize
-    for (size_t i = 0; i < buf.size() / 4; i++) {
-      buf[4 * i + 0] = std::pow(buffer.rgba[4 * i + 0], 1.0f / 2.2f);
-      buf[4 * i + 1] = std::pow(buffer.rgba[4 * i + 1], 1.0f / 2.2f);
-      buf[4 * i + 2] = std::pow(buffer.rgba[4 * i + 2], 1.0f / 2.2f);
-      buf[4 * i + 3] = buffer.rgba[4 * i + 3]; // no gamma correction for alpha
-    }
-  } else if (buffer_mode == example::SHOW_BUFFER_NORMAL) {
+    color = &buffer.rgba;
+  } else if (buffer_mode == example::SHOW_BUFFER_TEXCOORD) {
+    color = &buffer.texcoord;
+  } else if (buffer_mode == example::SHOW_BUFFER_DIFFUSE) {
+    color = &buffer.diffuse;
+  }
+  if (color) {
+    const ImageView<const float> rgb(color->data(), size_t(width),
+                                     size_t(height), 3, size_t(width) * 4, 4,
+                                     1);
+    ConvertImage(rgb, &gDisplayImage, 255.0f, 1.0f / 2.2f);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glDrawPixels(width, height, GL_RGB, GL_UNSIGNED_BYTE,
+                 static_cast<const GLvoid *>(gDisplayImage.getData()));
+    return;
+  }
+
+  std::vector<float> buf(size_t(width * height * 4));
+  if (buffer_mode == example::SHOW_BUFFER_NORMAL) {
     for (size_t i = 0; i < buf.size(); i++) {
       buf[i] = buffer.normal[i];
     }
@@ -255,23 +248,8 @@ static void Display(int width, int height, int buffer_mode,
         buf[i] = v;
       }
     }
-  } else if (buffer_mode == example::SHOW_BUFFER_TEXCOORD) {
-    for (size_t i = 0; i < buf.size() / 4; i++) {
-      buf[4 * i + 0] = std::pow(buffer.texcoord[4 * i + 0], 1.0f / 2.2f);
-      buf[4 * i + 1] = std::pow(buffer.texcoord[4 * i + 1], 1.0f / 2.2f);
-      buf[4 * i + 2] = std::pow(buffer.texcoord[4 * i + 2], 1.0f / 2.2f);
-      buf[4 * i + 3] = buffer.rgba[4 * i + 3]; // no gamma correction for alpha
-    }
-  } else if (buffer_mode == example::SHOW_BUFFER_DIFFUSE) {
-    for (size_t i = 0; i < buf.size() / 4; i++) {
-      buf[4 * i + 0] = std::pow(buffer.diffuse[4 * i + 0], 1.0f / 2.2f);
-      buf[4 * i + 1] = std::pow(buffer.diffuse[4 * i + 1], 1.0f / 2.2f);
-      buf[4 * i + 2] = std::pow(buffer.diffuse[4 * i + 2], 1.0f / 2.2f);
-      buf[4 * i + 3] = buffer.diffuse[4 * i + 2];
-    }
   }
 
-  glRasterPos2i(-1, -1);
   glDrawPixels(width, height, GL_RGBA, GL_FLOAT,
                static_cast<const GLvoid *>(&buf.at(0)));
 }
@@ -342,7 +320,9 @@ static void HandleUserInput(GLFWwindow *window, const double view_width,
   *prev_mouse_y = mouse_y;
 }
 
-static int CreateHDRTextureGL(const Image<float> &image, int prev_id = -1) {
+// Upload an 8-bit sRGB image as a texture.
+static int CreateTextureGL(const ImageView<const uint8_t> &image,
+                           int prev_id = -1) {
   const size_t width = image.getWidth();
   const size_t height = image.getHeight();
   const size_t n_channel = image.getChannels();
@@ -379,42 +359,23 @@ static int CreateHDRTextureGL(const Image<float> &image, int prev_id = -1) {
     return prev_id;
   }
 
-  // gamma correction.
-  std::vector<float> dst;
-  dst.resize(width * height * n_channel);
-
-  if (n_channel == 1) {
-    for (size_t i = 0; i < width * height; i++) {
-      dst[i] = std::pow(image.getData()[i], 1.0f / 2.2f);
-    }
-  } else if (n_channel == 2) {
-    for (size_t i = 0; i < width * height; i++) {
-      dst[2 * i + 0] = std::pow(image.getData()[2 * i + 0], 1.0f / 2.2f);
-      dst[2 * i + 1] = image.getData()[2 * i + 1];
-    }
-  } else if (n_channel == 3) {
-    for (size_t i = 0; i < width * height; i++) {
-      dst[3 * i + 0] = std::pow(image.getData()[3 * i + 0], 1.0f / 2.2f);
-      dst[3 * i + 1] = std::pow(image.getData()[3 * i + 1], 1.0f / 2.2f);
-      dst[3 * i + 2] = std::pow(image.getData()[3 * i + 2], 1.0f / 2.2f);
-    }
-  } else if (n_channel == 4) {
-    for (size_t i = 0; i < width * height; i++) {
-      dst[4 * i + 0] = std::pow(image.getData()[4 * i + 0], 1.0f / 2.2f);
-      dst[4 * i + 1] = std::pow(image.getData()[4 * i + 1], 1.0f / 2.2f);
-      dst[4 * i + 2] = std::pow(image.getData()[4 * i + 2], 1.0f / 2.2f);
-      dst[4 * i + 3] = image.getData()[4 * i + 3];
-    }
+  // Already display encoded. GL takes packed pixels.
+  Image<uint8_t> packed;
+  const uint8_t *data = image.getData();
+  if (!image.isPacked()) {
+    image.copyTo(&packed);
+    data = packed.getData();
   }
-  
-  
 
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
   if (prev_id < 0) {
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, int(width), int(height), 0, format, GL_FLOAT,
-                 reinterpret_cast<const void *>(dst.data()));
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, int(width), int(height), 0, format,
+                 GL_UNSIGNED_BYTE,
+                 reinterpret_cast<const void *>(data));
   } else {
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, int(width), int(height), format, GL_FLOAT,
-                    reinterpret_cast<const void *>(dst.data()));
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, int(width), int(height), format,
+                    GL_UNSIGNED_BYTE,
+                    reinterpret_cast<const void *>(data));
   }
 
   glBindTexture(GL_TEXTURE_2D, static_cast<GLuint>(last_texture));
@@ -422,9 +383,10 @@ static int CreateHDRTextureGL(const Image<float> &image, int prev_id = -1) {
   return static_cast<int>(id);
 }
 
-bool RunUI(const Mesh &mesh, const Mesh &front_mesh,
-           const Image<float> &input_image,
-           const std::vector<Image<float>> &debug_images) {
+bool RunUI(std::shared_ptr<const Mesh> mesh,
+           std::shared_ptr<const Mesh> front_mesh,
+           std::shared_ptr<const Image<float>> input_image,
+           const std::vector<Image<uint8_t>> &debug_images) {
   // Setup window
   glfwSetErrorCallback(error_callback);
   if (!glfwInit()) {
@@ -476,7 +438,7 @@ bool RunUI(const Mesh &mesh, const Mesh &front_mesh,
 
   // Setup renderer.
   gRenderer.SetMesh(mesh);
-  gRenderer.SetImage(input_image);
+  gRenderer.SetImage(std::move(input_image));
   gRenderer.BuildBVH();
 
   // Launch render thread
@@ -488,7 +450,7 @@ bool RunUI(const Mesh &mesh, const Mesh &front_mesh,
 
   std::vector<int> debug_image_texs;
   for (size_t i = 0; i < debug_images.size(); i++) {
-      const int id = CreateHDRTextureGL(debug_images[i]);
+      const int id = CreateTextureGL(debug_images[i]);
       debug_image_texs.push_back(id);
   }
 
@@ -573,13 +535,17 @@ bool RunUI(const Mesh &mesh, const Mesh &front_mesh,
 
 #ifdef USE_DLIB
       if (ImGui::Checkbox("frontalized mesh", &use_front_mesh)) {
-        // Switch mesh
-        if (use_front_mesh) {
-          gRenderer.SetMesh(front_mesh);
-          gRenderer.BuildBVH();
-        } else {
-          gRenderer.SetMesh(mesh);
-          gRenderer.BuildBVH();
+        // Switch mesh. Render() of the render thread reads the mesh and the
+        // BVH, so wait for it.
+        {
+          std::lock_guard<std::mutex> guard(gMutex);
+          if (use_front_mesh) {
+            gRenderer.SetMesh(front_mesh);
+            gRenderer.BuildBVH();
+          } else {
+            gRenderer.SetMesh(mesh);
+            gRenderer.BuildBVH();
+          }
         }
         RequestRender();
       }
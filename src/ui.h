@@ -1,14 +1,22 @@
 #ifndef PRNET_INFER_UI_H_
 #define PRNET_INFER_UI_H_
 
+#include <memory>
+#include <vector>
+
 #include "image.h"
 #include "mesh.h"
 
 namespace prnet {
 
-bool RunUI(const Mesh &mesh, const Mesh &front_mesh,
-           const Image<float> &input_image,
-           const std::vector<Image<float>> &debug_images);
+///
+/// Meshes and input image are shared with the renderer(not copied).
+/// Debug images are 8-bit sRGB.
+///
+bool RunUI(std::shared_ptr<const Mesh> mesh,
+           std::shared_ptr<const Mesh> front_mesh,
+           std::shared_ptr<const Image<float>> input_image,
+           const std::vector<Image<uint8_t>> &debug_images);
 
 };
 